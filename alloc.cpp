@@ -0,0 +1,222 @@
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <sys/resource.h>
+#include <fmt/core.h>
+
+#include "./alloc.hpp"
+
+using namespace std;
+
+namespace ALLOC
+{
+    // plain thread locals: no constructor runs, usable from operator new
+    static thread_local Counters tls;
+    static thread_local char const* innermost { nullptr };
+
+    static bool tagging { false };
+
+    // what all scopes of one tag added up to
+    struct Tally
+    {
+        size_t   calls {};
+        Counters sum;
+    };
+
+    static map<string, Tally>& tallies(void)
+    {
+        static map<string, Tally> t;
+        return t;
+    }
+
+    // scopes end on the ui thread and on the db thread
+    static mutex tallies_mutex;
+
+    Counters counters(void)
+    {
+        return tls;
+    }
+
+    void enable(void)
+    {
+        tagging = true;
+    }
+
+    bool enabled(void)
+    {
+        return tagging;
+    }
+
+    Scope::Scope(char const* tag, bool const counted)
+        : tag_(tag), outer_(innermost), counted_(counted), start_(tls)
+    {
+        innermost = tag;
+    }
+
+    char const* current(void)
+    {
+        return innermost;
+    }
+
+    Counters Scope::so_far(void) const
+    {
+        Counters const now { tls };
+        return { now.allocs - start_.allocs, now.frees - start_.frees,
+            now.bytes - start_.bytes };
+    }
+
+    Scope::~Scope()
+    {
+        innermost = outer_;
+        if (!tagging) {
+            return;
+        }
+
+        // taken before the map insert below, which allocates itself
+        Counters const d { so_far() };
+
+        lock_guard<mutex> lock(tallies_mutex);
+        Tally& t { tallies()[tag_] };
+        t.calls += counted_ ? 1 : 0;
+        t.sum.allocs += d.allocs;
+        t.sum.frees  += d.frees;
+        t.sum.bytes  += d.bytes;
+    }
+
+    Counters take(char const* tag)
+    {
+        lock_guard<mutex> lock(tallies_mutex);
+        auto it = tallies().find(tag);
+        if (it == tallies().end() || it->second.calls == 0) {
+            return {};
+        }
+        Tally const t { it->second };
+        tallies().erase(it);
+        return { t.sum.allocs / t.calls, t.sum.frees / t.calls,
+            t.sum.bytes / t.calls };
+    }
+
+    long peak_rss_kib(void)
+    {
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss; // KiB on Linux
+    }
+
+    void report(ostream& out)
+    {
+        lock_guard<mutex> lock(tallies_mutex);
+        out << "Allocations per operation:\n";
+        for (auto const& [tag, t] : tallies())
+        {
+            if (t.calls == 0) {
+                continue;
+            }
+            double const n { static_cast<double>(t.calls) };
+            out << fmt::format(
+                    "  {:<20} {:>6} calls, {:10.1f} allocs, {:12.1f} bytes\n",
+                    tag, t.calls, static_cast<double>(t.sum.allocs) / n,
+                    static_cast<double>(t.sum.bytes) / n);
+        }
+        out << fmt::format("Peak RSS: {} KiB\n", peak_rss_kib());
+    }
+
+    static void* allocate(size_t const size)
+    {
+        void* p { malloc(size == 0 ? 1 : size) };
+        if (!p) {
+            throw bad_alloc();
+        }
+        ++tls.allocs;
+        tls.bytes += size;
+        return p;
+    }
+
+    static void* allocate(size_t const size, align_val_t const align)
+    {
+        size_t const a { static_cast<size_t>(align) };
+        // aligned_alloc wants a multiple of the alignment
+        size_t const rounded { (size + a - 1) / a * a };
+        void* p { aligned_alloc(a, rounded == 0 ? a : rounded) };
+        if (!p) {
+            throw bad_alloc();
+        }
+        ++tls.allocs;
+        tls.bytes += size;
+        return p;
+    }
+
+    static void release(void* p) noexcept
+    {
+        if (p) {
+            ++tls.frees;
+            free(p);
+        }
+    }
+}
+
+// replacements of the global allocation functions, see ALLOC::Counters
+// (the nothrow forms of libstdc++ call these)
+
+void* operator new(size_t size)
+{
+    return ALLOC::allocate(size);
+}
+
+void* operator new[](size_t size)
+{
+    return ALLOC::allocate(size);
+}
+
+void* operator new(size_t size, align_val_t align)
+{
+    return ALLOC::allocate(size, align);
+}
+
+void* operator new[](size_t size, align_val_t align)
+{
+    return ALLOC::allocate(size, align);
+}
+
+void operator delete(void* p) noexcept
+{
+    ALLOC::release(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    ALLOC::release(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    ALLOC::release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    ALLOC::release(p);
+}
+
+void operator delete(void* p, align_val_t) noexcept
+{
+    ALLOC::release(p);
+}
+
+void operator delete[](void* p, align_val_t) noexcept
+{
+    ALLOC::release(p);
+}
+
+void operator delete(void* p, size_t, align_val_t) noexcept
+{
+    ALLOC::release(p);
+}
+
+void operator delete[](void* p, size_t, align_val_t) noexcept
+{
+    ALLOC::release(p);
+}
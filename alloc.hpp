@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+
+namespace ALLOC {
+
+    /* heap use of the calling thread since it started, counted by the
+     * global operator new/delete replacements in alloc.cpp (always on,
+     * a thread local add per call)
+     */
+    struct Counters
+    {
+        std::size_t allocs {};
+        std::size_t frees  {};
+        std::size_t bytes  {}; // requested bytes, frees not subtracted
+    };
+
+    Counters counters(void);
+
+    // makes Scope record its tag; off by default, tags cost nothing then
+    void enable(void);
+    bool enabled(void);
+
+    /* tags what's allocated between construction and destruction, sums
+     * per tag are kept for report() (only if enabled)
+     * work a scope hands to another thread (WRITER::Thread) runs in a scope
+     * of the same tag there that isn't counted as a call of its own, so
+     * the tag's sum has both threads' share
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(char const* tag, bool const counted = true);
+        ~Scope();
+
+        Scope(Scope const&) = delete;
+        Scope& operator=(Scope const&) = delete;
+
+        // allocations so far inside this scope, on this thread
+        Counters so_far(void) const;
+
+    private:
+        char const* tag_;
+        char const* outer_;
+        bool        counted_;
+        Counters    start_;
+    };
+
+    // tag of the innermost scope open on the calling thread, nullptr if none
+    char const* current(void);
+
+    /* allocations per call of tag so far, on all threads (only if enabled),
+     * and forgets them
+     */
+    Counters take(char const* tag);
+
+    // allocations and bytes per call of every tag, plus peak RSS
+    void report(std::ostream& out);
+
+    // peak resident set size of the process in KiB
+    long peak_rss_kib(void);
+}
@@ -0,0 +1,2406 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fmt/core.h>
+#include <soci/soci.h>
+#include <soci/sqlite3/soci-sqlite3.h>
+
+#include "./alloc.hpp"
+#include "./bench.hpp"
+#include "./filter.hpp"
+#include "./retention.hpp"
+#include "./schema.hpp"
+#include "./snapshot.hpp"
+#include "./status.hpp"
+#include "./time.hpp"
+#include "./sql.hpp"
+#include "./stats.hpp"
+#include "./storage.hpp"
+#include "./tracker.hpp"
+#include "./writer.hpp"
+
+using namespace std;
+// soci's sqlite3 backend declares the sqlite3 api in here
+using namespace sqlite_api;
+
+namespace BENCH
+{
+    // milliseconds spent in f, best of a few runs
+    template <typename F>
+    static double time_ms(F&& f, int const runs = 3)
+    {
+        double best { -1.0 };
+        for (int i {}; i < runs; ++i)
+        {
+            auto s = chrono::steady_clock::now();
+            f();
+            auto e = chrono::steady_clock::now();
+            double ms { chrono::duration<double, milli>(e - s).count() };
+            if (best < 0 || ms < best) {
+                best = ms;
+            }
+        }
+        return best;
+    }
+
+    // history-like rows: one row per activity per day, date ordered
+    static SQL::HistoryColumns generate_history(
+            size_t const rows,
+            int const activities,
+            int const groups)
+    {
+        SQL::HistoryColumns data;
+        data.day.reserve(rows);
+        data.activity.reserve(rows);
+        data.group.reserve(rows);
+        data.hours.reserve(rows);
+
+        mt19937 rng { 42 };
+        uniform_real_distribution<double> hours { 0.0, 8.0 };
+
+        for (size_t i {}; i < rows; ++i)
+        {
+            int act { static_cast<int>(i % static_cast<size_t>(activities)) };
+            data.day.push_back(static_cast<int>(i / static_cast<size_t>(activities)));
+            data.activity.push_back(act + 1);
+            data.group.push_back(act % groups + 1);
+            data.hours.push_back(hours(rng));
+        }
+        return data;
+    }
+
+    void aggregation(void)
+    {
+        /* compares the std::map based aggregation print_stats used to do
+         * with the dense index + bucketed SIMD reduction in STATS
+         */
+        int const activities { 20 };
+        int const groups     { 5 };
+
+        cout << "aggregation: map vs dense (" << activities
+             << " activities, " << groups << " groups)" << endl;
+
+        for (size_t rows : { size_t { 1000000 }, size_t { 10000000 } })
+        {
+            SQL::HistoryColumns const data {
+                generate_history(rows, activities, groups) };
+
+            vector<string> names;
+            vector<int> act_ids, grp_ids;
+            for (int i {}; i < activities; ++i) {
+                names.push_back("activity_" + to_string(i + 1));
+                act_ids.push_back(i + 1);
+                grp_ids.push_back(i % groups + 1);
+            }
+
+            double map_total {};
+            double map_ms { time_ms([&]() {
+                map<int, double> id_to_hh;
+                map<int, double> gr_to_hh;
+                map<int, string> id_to_nm;
+                for (size_t i {}; i < data.size(); ++i) {
+                    id_to_hh[data.activity[i]] += data.hours[i];
+                    gr_to_hh[data.group[i]]    += data.hours[i];
+                    id_to_nm[data.activity[i]]  =
+                        names[static_cast<size_t>(data.activity[i] - 1)];
+                }
+                map_total = 0;
+                for (auto const& p : id_to_hh) map_total += p.second;
+            }) };
+
+            double dense_total {};
+            double dense_ms { time_ms([&]() {
+                STATS::DenseIndex const act_index(act_ids);
+                STATS::DenseIndex const grp_index(grp_ids);
+                STATS::Totals a;
+                STATS::Totals g;
+                STATS::aggregate(data.activity, data.hours, act_index, a);
+                STATS::aggregate(data.group, data.hours, grp_index, g);
+                dense_total = STATS::sum(a.sum.data(), a.sum.size());
+            }) };
+
+            cout << fmt::format(
+                    "  {:>9} rows: map {:9.2f} ms, dense {:9.2f} ms "
+                    "({:.1f}x), totals {:.2f} / {:.2f}\n",
+                    rows, map_ms, dense_ms, map_ms / dense_ms,
+                    map_total, dense_total);
+        }
+    }
+
+    // db with activities x days history rows, one row per activity and day
+    static void generate_db(
+            string const& path,
+            int const activities,
+            int const days)
+    {
+        filesystem::remove(path);
+        soci::session sql("sqlite3", "db=" + path);
+        SCHEMA::open(sql);
+
+        soci::transaction tr(sql);
+
+        for (int a {}; a < activities; ++a)
+        {
+            string name { "activity_" + to_string(a + 1) };
+            int group { a % 5 + 1 };
+            sql <<
+                "INSERT INTO activities (name, group_id, added_when) "
+                "VALUES (:name, :group_id, '2000-01-01')",
+                soci::use(name), soci::use(group);
+        }
+
+        vector<int>    id, yy, mm, dd, wk;
+        vector<double> hh;
+        vector<string> date;
+
+        // rows go to the partition of their year, sealed or not
+        auto flush = [&]() {
+            if (date.empty()) {
+                return;
+            }
+            sql <<
+                "INSERT INTO " + SQL::partition(sql, date.front(), true) + " "
+                "(id_activity, year, month, day, weeknumber, hours_on_day, "
+                "date, user_id) "
+                "VALUES (:id, :yy, :mm, :dd, :wk, :hh, :date, 1)",
+                soci::use(id), soci::use(yy), soci::use(mm), soci::use(dd),
+                soci::use(wk), soci::use(hh), soci::use(date);
+            id.clear(); yy.clear(); mm.clear(); dd.clear();
+            wk.clear(); hh.clear(); date.clear();
+        };
+
+        int const first { TIME::conv_date_to_epoch_day("2000-01-01") };
+        for (int d {}; d < days; ++d)
+        {
+            string const ds { TIME::conv_epoch_day_to_date(first + d) };
+            int const week { stoi(TIME::get_weeknumber_for_date(ds)) };
+
+            if (!date.empty() && date.front().substr(0, 4) != ds.substr(0, 4)) {
+                flush();
+            }
+
+            for (int a {}; a < activities; ++a)
+            {
+                id.push_back(a + 1);
+                yy.push_back(stoi(ds.substr(0, 4)));
+                mm.push_back(stoi(ds.substr(5, 2)));
+                dd.push_back(stoi(ds.substr(8, 2)));
+                wk.push_back(week);
+                hh.push_back(static_cast<double>((d * 7 + a * 13) % 480) / 60);
+                date.push_back(ds);
+            }
+
+            if (id.size() >= 10000) {
+                flush();
+            }
+        }
+        flush();
+
+        tr.commit();
+    }
+
+    bool startup(void)
+    {
+        /* time from opening the db to the first menu on screen, the way
+         * main() and menu() get there: session + SCHEMA::open, the
+         * snapshot attached, the db thread, goal progress from history, a
+         * retention step and the menu itself (printed to nowhere), on a
+         * db with 10^6 history rows, a snapshot and a goal
+         * process exec and dynamic linking come on top of this
+         */
+        double const budget_ms { 5.0 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_startup.db").string() };
+        string const snap_path { path + ".snap" };
+
+        cout << "startup: generating db with 10^6 history rows" << endl;
+        generate_db(path, 100, 10000);
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            SNAPSHOT::write(sql, snap_path);
+            STORAGE::Sqlite(sql).set_goal(
+                    { 0, false, 1, GOALS::Period::week, 10 });
+        }
+
+        // ms per run of each stage, the last one is the whole path
+        vector<string> const stages { "open and migrate", "snapshot attach",
+            "db thread", "goal progress", "retention step", "menu",
+            "open to menu" };
+        vector<vector<double>> ms(stages.size());
+        for (int i {}; i < 20; ++i)
+        {
+            auto const s = chrono::steady_clock::now();
+            auto last = s;
+            size_t stage {};
+            auto done = [&]() {
+                auto const now = chrono::steady_clock::now();
+                ms[stage++].push_back(
+                        chrono::duration<double, milli>(now - last).count());
+                last = now;
+            };
+            {
+                soci::session sql("sqlite3", "db=" + path);
+                SCHEMA::open(sql);
+                done();
+
+                STORAGE::Sqlite sqlite(sql);
+                sqlite.attach_snapshot(
+                        make_shared<SNAPSHOT::File const>(snap_path));
+                done();
+
+                WRITER::Thread db;
+                WRITER::Queued storage(sqlite, db);
+                done();
+
+                GOALS::progress().rebuild(storage);
+                done();
+
+                soci::session* const session { &sql };
+                db.call([session]() {
+                    return RETENTION::step(*session,
+                            chrono::milliseconds(20));
+                }).get();
+                done();
+
+                STORAGE::catch_up(storage);
+                streambuf* const out { cout.rdbuf(nullptr) };
+                TRACKER::print_menu();
+                cout.rdbuf(out);
+                cout.clear();
+                done();
+            }
+            ms.back().push_back(chrono::duration<double, milli>(
+                        chrono::steady_clock::now() - s).count());
+        }
+
+        for (size_t k {}; k + 1 < stages.size(); ++k)
+        {
+            sort(ms[k].begin(), ms[k].end());
+            cout << fmt::format("  {:<20} median {:8.3f} ms\n", stages[k],
+                    ms[k][ms[k].size() / 2]);
+        }
+        sort(ms.back().begin(), ms.back().end());
+        double const median { ms.back()[ms.back().size() / 2] };
+        cout << fmt::format(
+                "  {:<20} median {:8.3f} ms, max {:.3f} ms "
+                "(budget {:.1f} ms: {})\n", stages.back(),
+                median, ms.back().back(), budget_ms,
+                median <= budget_ms ? "ok" : "EXCEEDED");
+
+        filesystem::remove(snap_path);
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+        return median <= budget_ms;
+    }
+
+    void segments(void)
+    {
+        /* range and overlap queries on a segments table with 10^7 rows
+         * (about 27 years of a phase every 90 seconds, around the clock)
+         */
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_segments.db").string() };
+        size_t const rows { 10000000 };
+        long long const first { 946684800 }; // 2000-01-01 00:00:00 UTC
+        long long const step  { 90 };
+
+        cout << "segments: generating db with 10^7 segments" << endl;
+        filesystem::remove(path);
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            sql << "INSERT INTO activities (name, group_id, added_when) "
+                   "VALUES ('bench', 1, '2000-01-01')";
+
+            soci::transaction tr(sql);
+            vector<long long> start;
+            vector<int> id, duration;
+            soci::statement st = (sql.prepare <<
+                "INSERT INTO segments (start, id_activity, duration) "
+                "VALUES (:start, :id, :duration)",
+                soci::use(start), soci::use(id), soci::use(duration));
+
+            for (size_t i {}; i < rows; ++i)
+            {
+                start.push_back(first + static_cast<long long>(i) * step);
+                id.push_back(1);
+                duration.push_back(60);
+                if (start.size() == 10000 || i == rows - 1) {
+                    st.execute(true);
+                    start.clear(); id.clear(); duration.clear();
+                }
+            }
+            tr.commit();
+        }
+
+        soci::session sql("sqlite3", "db=" + path);
+        SCHEMA::open(sql);
+
+        long long const mid { first + static_cast<long long>(rows / 2) * step };
+        struct Query { char const* name; long long span; bool overlapping; };
+
+        for (Query q : { Query { "1 day range    ", 86400, false },
+                         Query { "1 day overlap  ", 86400, true },
+                         Query { "1 week overlap ", 7 * 86400, true },
+                         Query { "1 year range   ", 365 * 86400, false } })
+        {
+            size_t got {};
+            double ms { time_ms([&]() {
+                got = 0;
+                auto count = [&got](SQL::SegmentColumns const& c) {
+                    got += c.size();
+                };
+                if (q.overlapping) {
+                    SQL::stream_overlapping_segments(sql, mid, mid + q.span,
+                            count);
+                }
+                else {
+                    SQL::stream_segments(sql, mid, mid + q.span, count);
+                }
+            }) };
+            cout << fmt::format("  {}: {:9.3f} ms ({} segments)\n",
+                    q.name, ms, got);
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+    }
+
+    void heatmap(void)
+    {
+        /* heatmap grid over 10 years of segments (48 phases a day, split
+         * over 8 activities): streaming the segments plus the bucketing
+         * print_heatmap does, without the printing
+         */
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_heatmap.db").string() };
+        int const activities { 8 };
+        long long const first {
+            TIME::conv_datetime_to_epoch("2014-01-01", "00:00:00") };
+        long long const last {
+            TIME::conv_datetime_to_epoch("2024-01-01", "00:00:00") };
+
+        cout << "heatmap: generating db with 10 years of segments" << endl;
+        filesystem::remove(path);
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            for (int a {}; a < activities; ++a) {
+                int group { a % 3 + 1 };
+                sql << "INSERT INTO activities (name, group_id, added_when) "
+                       "VALUES ('bench', :g, '2014-01-01')",
+                       soci::use(group);
+            }
+
+            soci::transaction tr(sql);
+            vector<long long> start;
+            vector<int> id, duration;
+            soci::statement st = (sql.prepare <<
+                "INSERT INTO segments (start, id_activity, duration) "
+                "VALUES (:start, :id, :duration)",
+                soci::use(start), soci::use(id), soci::use(duration));
+
+            // a 25 minute phase every 30 minutes
+            for (long long t { first }; t < last; t += 1800)
+            {
+                start.push_back(t);
+                id.push_back(static_cast<int>((t / 1800) % activities) + 1);
+                duration.push_back(1500);
+                if (start.size() == 10000) {
+                    st.execute(true);
+                    start.clear(); id.clear(); duration.clear();
+                }
+            }
+            if (!start.empty()) {
+                st.execute(true);
+            }
+            tr.commit();
+        }
+
+        soci::session sql("sqlite3", "db=" + path);
+        SCHEMA::open(sql);
+
+        size_t got {};
+        double ms { time_ms([&]() {
+            STATS::HourGrid grid(static_cast<size_t>(activities));
+            TIME::LocalOffset offset;
+            got = 0;
+            SQL::stream_segments(sql, first, last,
+                    [&](SQL::SegmentColumns const& c) {
+                got += c.size();
+                for (size_t i {}; i < c.size(); ++i) {
+                    grid.add(static_cast<size_t>(c.activity[i] - 1),
+                            c.start[i] + offset(c.start[i]), c.duration[i]);
+                }
+            });
+        }) };
+
+        cout << fmt::format("  10 years, {} segments: {:.2f} ms "
+                "(budget 100 ms: {})\n", got, ms, ms < 100 ? "ok" : "EXCEEDED");
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+    }
+
+    // milliseconds per step of the storage workload on one backend
+    struct Workload
+    {
+        double commit;
+        double days;
+        double segments;
+        double stats;
+        double hours; // checksum: all hours streamed back
+    };
+
+    static Workload workload(STORAGE::Backend& storage, int const activities,
+            int const days)
+    {
+        /* what a few years of use look like: one work phase per activity
+         * and day, committed one by one, then the reads the reports do
+         */
+        Workload w {};
+        int const first { TIME::conv_date_to_epoch_day("2000-01-01") };
+        string const first_date { TIME::conv_epoch_day_to_date(first) };
+        string const last_date {
+            TIME::conv_epoch_day_to_date(first + days - 1) };
+
+        for (int a {}; a < activities; ++a) {
+            storage.add_activity("activity_" + to_string(a + 1), a % 5 + 1,
+                    first_date);
+        }
+
+        w.commit = time_ms([&]() {
+            for (int d {}; d < days; ++d)
+            {
+                string const date { TIME::conv_epoch_day_to_date(first + d) };
+                long long const midnight { (first + d) * 86400LL };
+                for (int a {}; a < activities; ++a)
+                {
+                    int const seconds { ((d * 7 + a * 13) % 480) * 60 };
+                    storage.commit_work(a + 1, { { date,
+                            static_cast<double>(seconds) / 3600,
+                            midnight + 3600 * (a % 20), seconds } });
+                }
+            }
+        }, 1);
+
+        w.days = time_ms([&]() {
+            w.hours = 0;
+            storage.stream_days(first_date, last_date,
+                    [&w](SQL::HistoryColumns const& c) {
+                w.hours += STATS::sum(c.hours.data(), c.size());
+            });
+        });
+
+        size_t got {};
+        w.segments = time_ms([&]() {
+            got = 0;
+            storage.stream_segments(first * 86400LL,
+                    (first + days) * 86400LL,
+                    [&got](SQL::SegmentColumns const& c) {
+                got += c.size();
+            });
+        });
+
+        vector<int> act_ids, grp_ids;
+        for (SQL::Activity const& act : storage.activities()) {
+            act_ids.push_back(act.id);
+            grp_ids.push_back(act.group);
+        }
+        STATS::DenseIndex const act_index(act_ids);
+        STATS::DenseIndex const grp_index(grp_ids);
+
+        w.stats = time_ms([&]() {
+            STATS::Engine engine(first, first + days - 1, act_index, grp_index);
+            storage.stream_days(first_date, last_date,
+                    [&engine](SQL::HistoryColumns const& c) {
+                engine.add(c);
+            });
+            engine.finish();
+        });
+
+        return w;
+    }
+
+    void storage(void)
+    {
+        /* the same workload against the sqlite and the in memory backend
+         */
+        int const activities { 20 };
+        int const days       { 3 * 365 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_storage.db").string() };
+
+        cout << fmt::format("storage: {} activities, {} days, one commit per "
+                "activity and day\n", activities, days);
+
+        auto print = [](string const& name, Workload const& w) {
+            cout << fmt::format(
+                    "  {:<7}: commit {:9.2f} ms, days {:7.2f} ms, "
+                    "segments {:7.2f} ms, stats {:7.2f} ms ({:.2f} hours)\n",
+                    name, w.commit, w.days, w.segments, w.stats, w.hours);
+        };
+
+        STORAGE::Memory memory;
+        print("memory", workload(memory, activities, days));
+
+        filesystem::remove(path);
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite sqlite(sql);
+            print("sqlite", workload(sqlite, activities, days));
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+    }
+
+    void writer(void)
+    {
+        /* how long the ui waits at a phase switch: commit_work straight on
+         * the db against handing it to the db thread, with the usual
+         * synchronous = NORMAL and with FULL (an fsync per commit, like a
+         * busy or slow disk); phases are minutes apart, so every commit
+         * finds the queue empty: each one is flushed before the next,
+         * "stored" is the time until then
+         */
+        int const commits { 500 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_writer.db").string() };
+
+        cout << fmt::format("writer: {} work phase commits per run\n",
+                commits);
+
+        for (string const sync : { "NORMAL", "FULL" })
+        {
+            for (bool const queued : { false, true })
+            {
+                filesystem::remove(path);
+                filesystem::remove(path + "-wal");
+                filesystem::remove(path + "-shm");
+
+                soci::session sql("sqlite3", "db=" + path);
+                SCHEMA::open(sql);
+                sql << "PRAGMA synchronous = " + sync;
+
+                STORAGE::Sqlite sqlite(sql);
+                sqlite.add_activity("activity", 1, "2000-01-01");
+
+                WRITER::Thread db;
+                WRITER::Queued queue(sqlite, db);
+                STORAGE::Backend& storage { queued ?
+                    static_cast<STORAGE::Backend&>(queue) : sqlite };
+
+                int const first { TIME::conv_date_to_epoch_day("2000-01-01") };
+                vector<double> latency, stored;
+                for (int i {}; i < commits; ++i)
+                {
+                    int const day { first + i / 10 };
+                    vector<STORAGE::WorkPart> const parts { {
+                        TIME::conv_epoch_day_to_date(day), 0.25,
+                        day * 86400LL + (i % 10) * 3600, 900 } };
+
+                    auto s = chrono::steady_clock::now();
+                    storage.commit_work(1, parts);
+                    auto e = chrono::steady_clock::now();
+                    storage.flush();
+                    auto f = chrono::steady_clock::now();
+                    latency.push_back(
+                            chrono::duration<double, milli>(e - s).count());
+                    stored.push_back(
+                            chrono::duration<double, milli>(f - s).count());
+                }
+
+                sort(latency.begin(), latency.end());
+                sort(stored.begin(), stored.end());
+                cout << fmt::format(
+                        "  {:<6} {:<6}: switch p50 {:7.3f} ms, p99 {:7.3f} ms, "
+                        "max {:7.3f} ms; stored p50 {:7.3f} ms\n",
+                        sync, queued ? "queued" : "direct",
+                        latency[latency.size() / 2],
+                        latency[latency.size() * 99 / 100], latency.back(),
+                        stored[stored.size() / 2]);
+            }
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+    }
+
+    bool status(void)
+    {
+        /* a forked reader hammers the status segment while the publisher
+         * rewrites it as fast as it can; every snapshot is made from one
+         * counter, so a torn read (fields of two snapshots) shows up as
+         * fields that don't agree
+         */
+        double const seconds { 1.0 };
+        string const name {
+            "/tracker-status-bench-" + to_string(getpid()) };
+
+        struct Result
+        {
+            size_t reads;
+            size_t torn;
+            size_t gave_up;
+        };
+        auto* result = static_cast<Result*>(mmap(nullptr, sizeof(Result),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+        if (result == MAP_FAILED) {
+            throw runtime_error("status: mmap failed");
+        }
+        *result = {};
+
+        STATUS::Publisher publisher(name);
+        auto fill = [](STATUS::Snapshot& s, int const k) {
+            s.activity    = k;
+            s.phase_start = k;
+            s.today_hours = k;
+            string const text { to_string(k) };
+            memset(s.name, 0, sizeof(s.name));
+            text.copy(s.name, sizeof(s.name) - 1);
+        };
+        STATUS::Snapshot snapshot {};
+        fill(snapshot, 1);
+        publisher.publish(snapshot);
+
+        pid_t const child { fork() };
+        if (child == 0)
+        {
+            STATUS::Reader reader(name);
+            Result r {};
+            auto const end = chrono::steady_clock::now() +
+                chrono::duration<double>(seconds);
+            while (chrono::steady_clock::now() < end)
+            {
+                STATUS::Snapshot s;
+                if (!reader.read(s)) {
+                    ++r.gave_up;
+                    continue;
+                }
+                ++r.reads;
+                if (s.phase_start != s.activity ||
+                        s.today_hours != s.activity ||
+                        to_string(s.activity) != s.name) {
+                    ++r.torn;
+                }
+            }
+            *result = r;
+            _exit(0);
+        }
+
+        size_t publishes {};
+        double const ms { time_ms([&]() {
+            auto const end = chrono::steady_clock::now() +
+                chrono::duration<double>(seconds);
+            while (chrono::steady_clock::now() < end) {
+                fill(snapshot, static_cast<int>(++publishes % 1000000) + 1);
+                publisher.publish(snapshot);
+            }
+        }, 1) };
+        waitpid(child, nullptr, 0);
+
+        cout << fmt::format(
+                "status: {:.0f} publishes/s ({:.0f} ns each), {:.0f} reads/s, "
+                "{} torn, {} given up\n",
+                static_cast<double>(publishes) / ms * 1000,
+                ms * 1e6 / static_cast<double>(publishes),
+                static_cast<double>(result->reads) / seconds,
+                result->torn, result->gave_up);
+
+        bool const ok { result->torn == 0 };
+        munmap(result, sizeof(Result));
+        return ok;
+    }
+
+    bool filter(void)
+    {
+        /* filtered stats scans against the plain range scan on 365k rows
+         * each filter runs through the prepared sql plan and through the
+         * in memory predicate (the Backend default), both have to agree
+         */
+        int const activities { 100 };
+        int const days       { 3650 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_filter.db").string() };
+
+        cout << fmt::format("filter: generating db with {} history rows\n",
+                activities * days);
+        generate_db(path, activities, days);
+
+        bool ok { true };
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite storage(sql);
+
+            string const first { "2000-01-01" };
+            string const last  {
+                TIME::conv_epoch_day_to_date(
+                        TIME::conv_date_to_epoch_day(first) + days - 1) };
+
+            double hours {};
+            double const plain { time_ms([&]() {
+                hours = 0;
+                storage.stream_days(first, last,
+                        [&hours](SQL::HistoryColumns const& c) {
+                    hours += STATS::sum(c.hours.data(), c.size());
+                });
+            }) };
+            cout << fmt::format("  {:<36} {:8.2f} ms ({:.1f} hours)\n",
+                    "range scan", plain, hours);
+
+            for (string const text : { "", "group:2",
+                    "activity:1,5,9-20 weekday:mon-fri",
+                    "week:1-10,52 min:2", "from:2005-01-01 weekday:sat,sun" })
+            {
+                FILTER::Filter const& f { FILTER::compile(text) };
+
+                double planned {};
+                double const ms { time_ms([&]() {
+                    planned = 0;
+                    storage.stream_filtered_days(first, last, f,
+                            [&planned](SQL::HistoryColumns const& c) {
+                        planned += STATS::sum(c.hours.data(), c.size());
+                    });
+                }) };
+
+                double predicate {};
+                storage.STORAGE::Backend::stream_filtered_days(first, last, f,
+                        [&predicate](SQL::HistoryColumns const& c) {
+                    predicate += STATS::sum(c.hours.data(), c.size());
+                });
+
+                bool const same { abs(planned - predicate) < 1e-6 };
+                ok = ok && same;
+                cout << fmt::format(
+                        "  {:<36} {:8.2f} ms ({:.2f}x range scan, {:.1f} "
+                        "hours, predicate {})\n",
+                        "\"" + text + "\"", ms, ms / plain, planned,
+                        same ? "agrees" : "DIFFERS");
+            }
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+
+        return ok;
+    }
+
+    bool totals(void)
+    {
+        /* hours of one activity in a random date range over 10 years of
+         * history, scanning the range against the range index; both have
+         * to agree
+         */
+        int const activities { 20 };
+        int const days       { 3650 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_totals.db").string() };
+
+        cout << fmt::format("totals: generating db with {} history rows\n",
+                activities * days);
+        generate_db(path, activities, days);
+
+        bool ok { true };
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite storage(sql);
+
+            int const origin { TIME::conv_date_to_epoch_day("2000-01-01") };
+            auto scan = [&storage](int const a, int const b,
+                    function<void(SQL::HistoryColumns const&)> const& sink) {
+                storage.stream_days(TIME::conv_epoch_day_to_date(a),
+                        TIME::conv_epoch_day_to_date(b), sink);
+            };
+
+            STATS::RangeIndex index;
+            double const build { time_ms([&]() {
+                index.build(storage.activities(), origin, origin + days - 1,
+                        scan);
+            }, 1) };
+            cout << fmt::format("  {:<24} {:10.2f} ms\n", "build", build);
+
+            struct Query
+            {
+                int activity;
+                int first;
+                int last;
+            };
+            mt19937 rng { 7 };
+            vector<Query> queries;
+            for (int i {}; i < 1000; ++i)
+            {
+                int a { static_cast<int>(rng() % static_cast<unsigned>(days)) };
+                int b { static_cast<int>(rng() % static_cast<unsigned>(days)) };
+                queries.push_back({
+                        static_cast<int>(rng() % activities) + 1,
+                        origin + min(a, b), origin + max(a, b) });
+            }
+
+            // the scans are slow, a few of them are enough
+            size_t const scanned { 20 };
+            vector<double> by_scan(scanned);
+            double const scan_ms { time_ms([&]() {
+                for (size_t q {}; q < scanned; ++q)
+                {
+                    by_scan[q] = 0;
+                    scan(queries[q].first, queries[q].last,
+                            [&](SQL::HistoryColumns const& c) {
+                        for (size_t i {}; i < c.size(); ++i) {
+                            if (c.activity[i] == queries[q].activity) {
+                                by_scan[q] += c.hours[i];
+                            }
+                        }
+                    });
+                }
+            }, 1) / static_cast<double>(scanned) };
+
+            vector<double> by_index(queries.size());
+            double const index_ms { time_ms([&]() {
+                for (size_t q {}; q < queries.size(); ++q) {
+                    by_index[q] = index.activity(queries[q].activity,
+                            queries[q].first, queries[q].last);
+                }
+            }) / static_cast<double>(queries.size()) };
+
+            for (size_t q {}; q < scanned; ++q) {
+                ok = ok && abs(by_scan[q] - by_index[q]) < 1e-6;
+            }
+
+            double const add_ms { time_ms([&]() {
+                for (Query const& q : queries) {
+                    index.add(q.activity, q.last, 0.0);
+                }
+            }) / static_cast<double>(queries.size()) };
+
+            cout << fmt::format("  {:<24} {:10.4f} ms per range\n",
+                    "range scan", scan_ms);
+            cout << fmt::format(
+                    "  {:<24} {:10.4f} us per range ({:.0f}x faster, {})\n",
+                    "range index", index_ms * 1000, scan_ms / index_ms,
+                    ok ? "agrees" : "DIFFERS");
+            cout << fmt::format("  {:<24} {:10.4f} us per add\n",
+                    "commit", add_ms * 1000);
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+
+        return ok;
+    }
+
+    bool partitions(void)
+    {
+        /* a 30 year stats collect with nothing cached, one scan against
+         * the range cut into its years, each read from its own partition
+         * (history_yyyy) by 2, 4, .. workers (each on its own connection);
+         * all have to come to the same accumulators
+         */
+        int const activities { 20 };
+        int const days       { 30 * 365 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_partitions.db").string() };
+
+        cout << fmt::format(
+                "partitions: generating db with {} history rows in yearly "
+                "partitions\n",
+                activities * days);
+        generate_db(path, activities, days);
+
+        bool ok { true };
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite storage(sql);
+
+            vector<int> act_ids;
+            vector<int> grp_ids;
+            for (SQL::Activity const& a : storage.activities()) {
+                act_ids.push_back(a.id);
+                grp_ids.push_back(a.group);
+            }
+            STATS::DenseIndex const act_index(act_ids);
+            STATS::DenseIndex const grp_index(grp_ids);
+
+            int const first { TIME::conv_date_to_epoch_day("2000-01-01") };
+            int const last  { first + days - 1 };
+            auto scan = [&storage](int const a, int const b,
+                    function<void(SQL::HistoryColumns const&)> const& sink) {
+                storage.stream_days(TIME::conv_epoch_day_to_date(a),
+                        TIME::conv_epoch_day_to_date(b), sink);
+            };
+
+            vector<STATS::Accumulator> single;
+            double const single_ms { time_ms([&]() {
+                STATS::cache().clear();
+                single = STATS::collect(first, last, 28, act_index,
+                        grp_index, scan);
+            }) };
+            cout << fmt::format("  {:<24} {:10.2f} ms\n", "one scan",
+                    single_ms);
+
+            // every year's partition on its own: with a core per year the
+            // report can't be faster than its slowest year
+            double years_ms {};
+            double slowest_ms {};
+            for (int y { 2000 }; y < 2030; ++y)
+            {
+                int const a { max(first,
+                        TIME::conv_date_to_epoch_day(fmt::format(
+                                "{}-01-01", y))) };
+                int const b { min(last,
+                        TIME::conv_date_to_epoch_day(fmt::format(
+                                "{}-12-31", y))) };
+                if (a > b) {
+                    continue;
+                }
+                double const ms { time_ms([&]() {
+                    STATS::Engine engine(a, b, act_index, grp_index);
+                    scan(a, b, [&engine](SQL::HistoryColumns const& c) {
+                        engine.add(c);
+                    });
+                    engine.finish();
+                }) };
+                years_ms += ms;
+                slowest_ms = max(slowest_ms, ms);
+            }
+            cout << fmt::format(
+                    "  {:<24} {:10.2f} ms (slowest {:.2f} ms, at most "
+                    "{:.1f}x with a core per year)\n", "years one by one",
+                    years_ms, slowest_ms, years_ms / slowest_ms);
+
+            size_t const cores { max(1u, thread::hardware_concurrency()) };
+            for (size_t workers { 2 }; workers <= max<size_t>(cores, 4);
+                    workers *= 2)
+            {
+                vector<STATS::Scan> const parallel {
+                    storage.parallel_scans(workers) };
+
+                vector<STATS::Accumulator> accs;
+                double const ms { time_ms([&]() {
+                    STATS::cache().clear();
+                    accs = STATS::collect(first, last, 28, act_index,
+                            grp_index, scan, parallel);
+                }) };
+
+                bool same { accs.size() == single.size() };
+                for (size_t k {}; same && k < accs.size(); ++k) {
+                    same = abs(accs[k].sum - single[k].sum) < 1e-6 &&
+                        accs[k].active_days == single[k].active_days &&
+                        accs[k].longest == single[k].longest;
+                }
+                ok = ok && same;
+
+                cout << fmt::format(
+                        "  {:<24} {:10.2f} ms ({:.2f}x one scan, {})\n",
+                        fmt::format("{} workers", workers), ms,
+                        single_ms / ms, same ? "same" : "DIFFERS");
+            }
+            cout << fmt::format("  ({} cores)\n", cores);
+            STATS::cache().clear();
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+
+        return ok;
+    }
+
+    bool snapshot(void)
+    {
+        /* a 10 year report (all rows streamed, then a full stats collect
+         * with nothing cached) from sqlite against the snapshot file;
+         * both have to come to the same hours
+         */
+        int const activities { 20 };
+        int const days       { 3650 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_snapshot.db").string() };
+        string const snap { path + ".snap" };
+
+        cout << fmt::format("snapshot: generating db with {} history rows\n",
+                activities * days);
+        generate_db(path, activities, days);
+
+        bool ok { true };
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+
+            SNAPSHOT::Written written {};
+            double const write_ms { time_ms([&]() {
+                written = SNAPSHOT::write(sql, snap);
+            }, 1) };
+            cout << fmt::format("  {:<24} {:10.2f} ms ({} KiB)\n", "write",
+                    write_ms, written.bytes / 1024);
+
+            STORAGE::Sqlite plain(sql);
+            STORAGE::Sqlite mapped(sql);
+            mapped.attach_snapshot(make_shared<SNAPSHOT::File const>(snap));
+
+            string const first { "2000-01-01" };
+            string const last  {
+                TIME::conv_epoch_day_to_date(
+                        TIME::conv_date_to_epoch_day(first) + days - 1) };
+
+            vector<int> act_ids;
+            vector<int> grp_ids;
+            for (SQL::Activity const& a : plain.activities()) {
+                act_ids.push_back(a.id);
+                grp_ids.push_back(a.group);
+            }
+            STATS::DenseIndex const act_index(act_ids);
+            STATS::DenseIndex const grp_index(grp_ids);
+
+            double plain_ms {};
+            double plain_hours {};
+            for (STORAGE::Sqlite* storage : { &plain, &mapped })
+            {
+                double hours {};
+                double const stream { time_ms([&]() {
+                    hours = 0;
+                    storage->stream_days(first, last,
+                            [&hours](SQL::HistoryColumns const& c) {
+                        hours += STATS::sum(c.hours.data(), c.size());
+                    });
+                }) };
+
+                auto scan = [storage](int const a, int const b,
+                        function<void(SQL::HistoryColumns const&)> const&
+                        sink) {
+                    storage->stream_days(TIME::conv_epoch_day_to_date(a),
+                            TIME::conv_epoch_day_to_date(b), sink);
+                };
+                double const report { time_ms([&]() {
+                    STATS::cache().clear();
+                    STATS::collect(TIME::conv_date_to_epoch_day(first),
+                            TIME::conv_date_to_epoch_day(last), 28,
+                            act_index, grp_index, scan);
+                }) };
+
+                if (storage == &plain)
+                {
+                    plain_ms    = stream;
+                    plain_hours = hours;
+                    cout << fmt::format(
+                            "  {:<24} {:10.2f} ms stream, {:8.2f} ms report "
+                            "({:.1f} hours)\n", "sqlite", stream, report,
+                            hours);
+                }
+                else
+                {
+                    bool const same { abs(hours - plain_hours) < 1e-6 };
+                    ok = ok && same;
+                    cout << fmt::format(
+                            "  {:<24} {:10.2f} ms stream, {:8.2f} ms report "
+                            "({:.2f}x sqlite stream, {})\n", "snapshot",
+                            stream, report, stream / plain_ms,
+                            same ? "same hours" : "DIFFERS");
+                }
+            }
+            STATS::cache().clear();
+        }
+
+        filesystem::remove(snap);
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+
+        return ok;
+    }
+
+    bool pipeline(void)
+    {
+        /* a stats collect over many rows with nothing cached, aggregated as
+         * the rows come against pipelined with 1, 2, 4, .. aggregating
+         * workers; once from memory (only the aggregation costs) and once
+         * from sqlite (fetch and aggregation overlap)
+         * every run has to come to the same accumulators
+         */
+        int const activities { 100 };
+        int const groups     { 20 };
+        int const days       { 3650 };
+
+        SQL::HistoryColumns const data { generate_history(
+                static_cast<size_t>(activities * days), activities, groups) };
+        auto from_memory = [&data](int const a, int const b,
+                function<void(SQL::HistoryColumns const&)> const& sink) {
+            // the rows are day ordered, day d starts at row d * activities
+            size_t const from { static_cast<size_t>(a * activities) };
+            size_t const to { min(data.size(),
+                    static_cast<size_t>((b + 1) * activities)) };
+            SQL::HistoryColumns chunk;
+            for (size_t i { from }; i < to; i += SQL::FETCH_CHUNK)
+            {
+                size_t const end { min(to, i + SQL::FETCH_CHUNK) };
+                auto const at = [i](auto const& v) {
+                    return v.begin() + static_cast<ptrdiff_t>(i); };
+                auto const until = [end](auto const& v) {
+                    return v.begin() + static_cast<ptrdiff_t>(end); };
+                chunk.day.assign(at(data.day), until(data.day));
+                chunk.activity.assign(at(data.activity),
+                        until(data.activity));
+                chunk.group.assign(at(data.group), until(data.group));
+                chunk.hours.assign(at(data.hours), until(data.hours));
+                sink(chunk);
+            }
+        };
+
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_pipeline.db").string() };
+        cout << fmt::format(
+                "pipeline: {} rows in memory, generating db with as many\n",
+                data.size());
+        generate_db(path, activities, days);
+
+        bool ok { true };
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite storage(sql);
+            auto from_db = [&storage](int const a, int const b,
+                    function<void(SQL::HistoryColumns const&)> const& sink) {
+                storage.stream_days(TIME::conv_epoch_day_to_date(a),
+                        TIME::conv_epoch_day_to_date(b), sink);
+            };
+
+            size_t const cores { max(1u, thread::hardware_concurrency()) };
+
+            // the fetch thread of the pipeline reads on a connection of its
+            // own, like print_stats does it
+            STATS::Scan const from_reader { storage.parallel_scans(1).at(0) };
+
+            for (auto const& [name, scan, fetch, first] : {
+                    tuple<string, STATS::Scan, STATS::Scan, int> { "memory",
+                        from_memory, from_memory, 0 },
+                    tuple<string, STATS::Scan, STATS::Scan, int> { "sqlite",
+                        from_db, from_reader,
+                        TIME::conv_date_to_epoch_day("2000-01-01") } })
+            {
+                vector<int> act_ids;
+                vector<int> grp_ids;
+                for (int a {}; a < activities; ++a) {
+                    act_ids.push_back(a + 1);
+                    grp_ids.push_back(name == "memory" ?
+                            a % groups + 1 : a % 5 + 1);
+                }
+                STATS::DenseIndex const act_index(act_ids);
+                STATS::DenseIndex const grp_index(grp_ids);
+                int const last { first + days - 1 };
+
+                vector<STATS::Accumulator> single;
+                double const single_ms { time_ms([&]() {
+                    STATS::cache().clear();
+                    single = STATS::collect(first, last, 28, act_index,
+                            grp_index, scan);
+                }) };
+                cout << fmt::format("  {:<24} {:10.2f} ms\n",
+                        name + ", as they come", single_ms);
+
+                for (size_t workers { 1 }; workers <= max<size_t>(cores, 4);
+                        workers *= 2)
+                {
+                    vector<STATS::Accumulator> accs;
+                    double const ms { time_ms([&]() {
+                        STATS::cache().clear();
+                        accs = STATS::collect(first, last, 28, act_index,
+                                grp_index, scan, { fetch }, workers);
+                    }) };
+
+                    bool same { accs.size() == single.size() };
+                    for (size_t k {}; same && k < accs.size(); ++k) {
+                        same = abs(accs[k].sum - single[k].sum) < 1e-6 &&
+                            accs[k].active_days == single[k].active_days &&
+                            accs[k].longest == single[k].longest;
+                    }
+                    ok = ok && same;
+
+                    cout << fmt::format(
+                            "  {:<24} {:10.2f} ms ({:.2f}x, {})\n",
+                            fmt::format("{}, {} workers", name, workers), ms,
+                            single_ms / ms, same ? "same" : "DIFFERS");
+                }
+            }
+            cout << fmt::format("  ({} cores)\n", cores);
+            STATS::cache().clear();
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+
+        return ok;
+    }
+
+    bool users(void)
+    {
+        /* one db shared by many users against a db of one user's size:
+         * a user's reports read their part of history_user_date, so they
+         * should cost about what they cost alone, however many others
+         * there are; every user's streamed hours have to match their rows
+         * in everyone's stream, and writes to another user's activity, its
+         * goals or the shared group tree have to be turned down; a user's
+         * group tree only has their hours
+         */
+        int const users      { 500 };
+        int const per_user   { 2 };
+        int const days       { 1826 };
+        int const sampled    { 20 };
+
+        string const tmp { filesystem::temp_directory_path().string() };
+        string const shared_path { tmp + "/tracker_bench_users.db" };
+        string const alone_path  { tmp + "/tracker_bench_user.db" };
+
+        cout << fmt::format(
+                "users: generating db of {} users with {} activities each, "
+                "{} days\n", users, per_user, days);
+        generate_db(shared_path, users * per_user, days);
+        generate_db(alone_path, per_user, days);
+        {
+            soci::session sql("sqlite3", "db=" + shared_path);
+            // no SCHEMA::open, it would seal the years just generated
+            soci::transaction tr(sql);
+            sql << "UPDATE activities SET user_id = (id + :n - 1) / :n, "
+                "hours_total = id",
+                soci::use(per_user);
+            sql <<
+                "INSERT OR IGNORE INTO users (id, name) "
+                "SELECT DISTINCT user_id, 'user_' || user_id FROM activities";
+            for (int const year : SCHEMA::partition_years(sql)) {
+                sql <<
+                    "UPDATE " + SCHEMA::partition_table(year) + " "
+                    "SET user_id = "
+                    "(SELECT user_id FROM activities WHERE id = id_activity)";
+            }
+            tr.commit();
+        }
+
+        string const first { "2000-01-01" };
+        string const last  { TIME::conv_epoch_day_to_date(
+                TIME::conv_date_to_epoch_day(first) + days - 1) };
+        int const first_day { TIME::conv_date_to_epoch_day(first) };
+        int const last_day  { first_day + days - 1 };
+
+        // every report of the bench: all of the user's history, collected
+        auto report = [&](STORAGE::Backend& storage) {
+            vector<int> act_ids;
+            vector<int> grp_ids;
+            for (SQL::Activity const& a : storage.activities()) {
+                act_ids.push_back(a.id);
+                grp_ids.push_back(a.group);
+            }
+            STATS::DenseIndex const act_index(act_ids);
+            STATS::DenseIndex const grp_index(grp_ids);
+            STATS::cache().clear();
+            return STATS::collect(first_day, last_day, 28, act_index,
+                    grp_index, [&storage](int const a, int const b,
+                        function<void(SQL::HistoryColumns const&)> const&
+                        sink) {
+                storage.stream_days(TIME::conv_epoch_day_to_date(a),
+                        TIME::conv_epoch_day_to_date(b), sink);
+            });
+        };
+
+        double alone_ms {};
+        {
+            soci::session sql("sqlite3", "db=" + alone_path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite storage(sql);
+            alone_ms = time_ms([&]() { report(storage); });
+        }
+
+        bool ok { true };
+        {
+            soci::session sql("sqlite3", "db=" + shared_path);
+            SCHEMA::open(sql);
+
+            // hours per activity of everyone's stream, what users must get
+            map<int, double> expected;
+            STORAGE::Sqlite everyone(sql);
+            double const everyone_ms { time_ms([&]() {
+                report(everyone);
+            }) };
+            everyone.stream_days(first, last,
+                    [&expected](SQL::HistoryColumns const& c) {
+                for (size_t i {}; i < c.size(); ++i) {
+                    expected[c.activity[i]] += c.hours[i];
+                }
+            });
+
+            double scoped_ms {};
+            int mismatches {};
+            for (int k {}; k < sampled; ++k)
+            {
+                int const user { 1 + k * (users / sampled) };
+                STORAGE::Sqlite storage(sql, { user });
+                scoped_ms += time_ms([&]() { report(storage); });
+
+                map<int, double> got;
+                storage.stream_days(first, last,
+                        [&got](SQL::HistoryColumns const& c) {
+                    for (size_t i {}; i < c.size(); ++i) {
+                        got[c.activity[i]] += c.hours[i];
+                    }
+                });
+                bool same { got.size() == static_cast<size_t>(per_user) };
+                for (auto const& [id, hours] : got) {
+                    same = same && (id + per_user - 1) / per_user == user &&
+                        abs(hours - expected[id]) < 1e-6;
+                }
+                mismatches += same ? 0 : 1;
+            }
+            ok = mismatches == 0;
+
+            // the first activity is user 1's, user 2 may not write to it,
+            // nor set a goal on it or change the group tree
+            STORAGE::Sqlite other(sql, { 2 });
+            int refused {};
+            auto refuses = [&refused](auto const& write) {
+                try {
+                    write();
+                }
+                catch (runtime_error const&) {
+                    ++refused;
+                }
+            };
+            refuses([&]() { other.add_hours(1, TIME::get_date_string(),
+                        1.0); });
+            refuses([&]() { other.set_goal({ 0, false, 1,
+                        GOALS::Period::day, 1.0 }); });
+            refuses([&]() { other.add_group("mine", 0); });
+            refuses([&]() { other.move_group(1, 2); });
+            ok = ok && refused == 4;
+
+            // user 2's groups are those of their activities, with their
+            // hours_total (activity id) only
+            double own {};
+            for (SQL::Activity const& a : other.activities()) {
+                own += a.hours_total;
+            }
+            double in_groups {};
+            for (SQL::Group const& g : other.groups()) {
+                in_groups += g.parent == 0 ? g.hours_total : 0;
+            }
+            bool const own_groups { abs(own - in_groups) < 1e-6 };
+            ok = ok && own_groups;
+
+            cout << fmt::format(
+                    "  everyone ({} rows)   {:10.2f} ms\n"
+                    "  one user, alone        {:10.2f} ms\n"
+                    "  one user, shared db    {:10.2f} ms ({:.2f}x alone, "
+                    "mean of {})\n"
+                    "  {} of {} users differ, {} of 4 foreign writes "
+                    "refused, own group hours {}\n",
+                    users * per_user * days, everyone_ms, alone_ms,
+                    scoped_ms / sampled, scoped_ms / sampled / alone_ms,
+                    sampled, mismatches, sampled, refused,
+                    own_groups ? "only" : "MIXED");
+            STATS::cache().clear();
+        }
+
+        for (string const& path : { shared_path, alone_path })
+        {
+            filesystem::remove(path);
+            filesystem::remove(path + "-wal");
+            filesystem::remove(path + "-shm");
+        }
+
+        return ok;
+    }
+
+    // what the trace saw of one statement of one operation
+    struct Traced
+    {
+        string    op;
+        string    sql;          // as prepared, parameters unbound
+        size_t    runs {};
+        size_t    rows {};      // rows it returned
+        long long fullscan {};  // SQLITE_STMTSTATUS_FULLSCAN_STEP
+        long long vm_steps {};  // SQLITE_STMTSTATUS_VM_STEP
+        double    ms {};
+    };
+
+    struct Trace
+    {
+        string op;                          // empty: not recorded
+        map<pair<string, string>, Traced> statements; // by op and sql
+        map<void*, size_t> rows;            // of the statements running
+        map<void*, chrono::steady_clock::time_point> started;
+    };
+
+    static int on_trace(unsigned const type, void* const ctx, void* const p,
+            void* const x)
+    {
+        /* sqlite3_trace_v2 callback: counts the rows of every statement,
+         * and once it finishes adds them, its counters and its run time
+         * to the statement's entry (the time sqlite passes in x only has
+         * milliseconds, so it's measured here)
+         */
+        (void)x;
+        Trace& trace { *static_cast<Trace*>(ctx) };
+        if (type == SQLITE_TRACE_STMT) {
+            trace.started[p] = chrono::steady_clock::now();
+            return 0;
+        }
+        if (type == SQLITE_TRACE_ROW) {
+            ++trace.rows[p];
+            return 0;
+        }
+
+        double const ms { chrono::duration<double, milli>(
+                chrono::steady_clock::now() - trace.started[p]).count() };
+        trace.started.erase(p);
+
+        sqlite3_stmt* const st { static_cast<sqlite3_stmt*>(p) };
+        size_t const rows { trace.rows[p] };
+        trace.rows.erase(p);
+        long long const fullscan { sqlite3_stmt_status(st,
+                SQLITE_STMTSTATUS_FULLSCAN_STEP, 1) };
+        long long const vm_steps { sqlite3_stmt_status(st,
+                SQLITE_STMTSTATUS_VM_STEP, 1) };
+        char const* const text { sqlite3_sql(st) };
+        if (trace.op.empty() || !text) {
+            return 0;
+        }
+
+        Traced& t { trace.statements[{ trace.op, text }] };
+        t.op = trace.op;
+        t.sql = text;
+        ++t.runs;
+        t.rows += rows;
+        t.fullscan += fullscan;
+        t.vm_steps += vm_steps;
+        t.ms += ms;
+        return 0;
+    }
+
+    static vector<string> query_plan(sqlite3* const db, string const& sql)
+    {
+        // the detail column of EXPLAIN QUERY PLAN, one line per loop
+        vector<string> lines;
+        sqlite3_stmt* st { nullptr };
+        string const explain { "EXPLAIN QUERY PLAN " + sql };
+        if (sqlite3_prepare_v2(db, explain.c_str(), -1, &st, nullptr) !=
+                SQLITE_OK) {
+            return lines;
+        }
+        while (sqlite3_step(st) == SQLITE_ROW) {
+            lines.push_back(reinterpret_cast<char const*>(
+                        sqlite3_column_text(st, 3)));
+        }
+        sqlite3_finalize(st);
+        return lines;
+    }
+
+    static bool is_word(char const c)
+    {
+        return isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    static bool guarded_table(string const& name)
+    {
+        // history (a view), its partitions history_yyyy, activities
+        bool const partition { name.size() == 12 &&
+            name.rfind("history_", 0) == 0 &&
+            all_of(name.begin() + 8, name.end(), [](char const c) {
+                return isdigit(static_cast<unsigned char>(c)); }) };
+        return partition || name == "history" || name == "activities";
+    }
+
+    static bool scans_guarded(vector<string> const& plan, string const& sql)
+    {
+        /* whether a loop of the plan runs through all of history or
+         * activities (a plain SCAN, or one along an index), under their own
+         * name or an alias given to them in sql
+         */
+        vector<string> aliases;
+        string const as { " AS " };
+        for (size_t at { sql.find(as) }; at != string::npos;
+                at = sql.find(as, at + 1))
+        {
+            size_t begin { at };
+            while (begin > 0 && is_word(sql[begin - 1])) {
+                --begin;
+            }
+            if (!guarded_table(sql.substr(begin, at - begin))) {
+                continue;
+            }
+            size_t const from { at + as.size() };
+            size_t to { from };
+            while (to < sql.size() && is_word(sql[to])) {
+                ++to;
+            }
+            aliases.push_back(sql.substr(from, to - from));
+        }
+
+        for (string const& line : plan)
+        {
+            if (line.rfind("SCAN ", 0) != 0) {
+                continue;
+            }
+            string const name { line.substr(5, line.find(' ', 5) - 5) };
+            if (guarded_table(name) ||
+                    find(aliases.begin(), aliases.end(), name) !=
+                    aliases.end()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static string one_line(string const& sql, size_t const width)
+    {
+        string line;
+        for (char const c : sql) {
+            if (!isspace(static_cast<unsigned char>(c)) ||
+                    (!line.empty() && line.back() != ' ')) {
+                line += isspace(static_cast<unsigned char>(c)) ? ' ' : c;
+            }
+        }
+        return line.size() > width ? line.substr(0, width - 3) + "..." : line;
+    }
+
+    bool plans(string const& baseline)
+    {
+        /* every statement the tracker's operations issue, traced on a db
+         * with 730k history rows of two users: each one is explained and
+         * fails if its plan runs through history or activities and it
+         * visited more rows in full scans than it returned (reading the
+         * whole activity list is fine, filtering a scan of history isn't)
+         * VM steps and run times per statement go to baseline if there's
+         * no such file yet; if there is, twice the VM steps of the
+         * baseline fails as well (they don't depend on the machine, the
+         * times are only printed next to each other)
+         */
+        int const activities { 200 };
+        int const days       { 3650 };
+
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_plans.db").string() };
+        cout << fmt::format("plans: generating db with {} history rows\n",
+                activities * days);
+        generate_db(path, activities, days);
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            // no SCHEMA::open, it would seal the years just generated
+            soci::transaction tr(sql);
+            int const user { SQL::ensure_user(sql, "second") };
+            sql << "UPDATE activities SET user_id = :u WHERE id > :n",
+                soci::use(user), soci::use(activities / 2);
+            for (int const year : SCHEMA::partition_years(sql)) {
+                sql <<
+                    "UPDATE " + SCHEMA::partition_table(year) + " "
+                    "SET user_id = :u WHERE id_activity > :n",
+                    soci::use(user), soci::use(activities / 2);
+            }
+            tr.commit();
+        }
+
+        Trace trace;
+        bool ok { true };
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            sqlite3* const db { static_cast<soci::sqlite3_session_backend*>(
+                    sql.get_backend())->conn_ };
+            sqlite3_trace_v2(db, SQLITE_TRACE_STMT | SQLITE_TRACE_ROW |
+                    SQLITE_TRACE_PROFILE, on_trace, &trace);
+
+            auto run = [&trace](string const& op, function<void()> const& f) {
+                trace.op = op;
+                f();
+                trace.op.clear();
+            };
+
+            run("startup", [&]() { SCHEMA::open(sql); });
+
+            STORAGE::Sqlite everyone(sql);
+            STORAGE::Sqlite second(sql, { 2 });
+
+            string const first { "2009-01-01" };
+            string const last  { "2009-10-31" };
+            string const today { TIME::get_date_string() };
+            // manual entries can't go to the sealed years of the reports
+            string const open { to_string(SCHEMA::sealed_before()) +
+                "-03-01" };
+
+            // the reports print, only their statements matter here
+            streambuf* const out { cout.rdbuf(nullptr) };
+
+            run("activities", [&]() { everyone.activities(); });
+            run("activities, one user", [&]() { second.activities(); });
+            run("oldest date", [&]() { everyone.oldest_date(); });
+            run("oldest date, one user", [&]() { second.oldest_date(); });
+            for (auto const& [op, storage] : {
+                    pair<string, STORAGE::Backend*> { "report", &everyone },
+                    pair<string, STORAGE::Backend*> { "report, one user",
+                        &second } })
+            {
+                run(op, [&, storage = storage]() {
+                    STATS::cache().clear();
+                    STATS::totals().clear();
+                    SQL::print_stats(*storage, first, last);
+                });
+            }
+            run("filtered report", [&]() {
+                SQL::print_stats(everyone, first, last,
+                        FILTER::compile("group:2 weekday:mon-fri min:1"));
+            });
+            run("filtered report, one user", [&]() {
+                SQL::print_stats(second, first, last,
+                        FILTER::compile("activity:101-120 week:1-10"));
+            });
+            run("heatmap", [&]() { SQL::print_heatmap(everyone, 2009, 2009); });
+            run("goals", [&]() {
+                everyone.set_goal({ 0, false, 1, GOALS::Period::week, 10 });
+                GOALS::progress().rebuild(everyone);
+            });
+            run("work phase commit", [&]() {
+                unordered_map<string, string> smap {
+                    TIME::get_datetime_map() };
+                unordered_map<string, string> emap {
+                    TIME::get_datetime_map() };
+                TRACKER::update_work_time(everyone, "1", smap, emap, 1);
+            });
+            run("manual entry", [&]() {
+                everyone.add_hours(2, open, 1.0);
+                everyone.add_hours(2, today, 1.0);
+            });
+            run("manual entry, one user", [&]() {
+                second.add_hours(activities, open, 1.0);
+            });
+            run("segments", [&]() {
+                everyone.stream_segments(0, 2000000000,
+                        [](SQL::SegmentColumns const&) {});
+                second.stream_segments(0, 2000000000,
+                        [](SQL::SegmentColumns const&) {});
+            });
+
+            string const snap_path { path + ".snap" };
+            SNAPSHOT::write(sql, snap_path);
+            run("snapshot check", [&]() {
+                SNAPSHOT::File const snap(snap_path);
+                snap.matches(sql);
+            });
+            filesystem::remove(snap_path);
+
+            RETENTION::set_years(sql, 20);
+            run("retention step", [&]() {
+                // the first steps may only give back pages of the vacuum
+                RETENTION::Step step {};
+                while (step.months == 0 && !step.done) {
+                    step = RETENTION::step(sql, chrono::milliseconds(20));
+                }
+            });
+
+            cout.rdbuf(out);
+            cout.clear();
+            STATS::cache().clear();
+            STATS::totals().clear();
+
+            // op, sql -> vm steps and ms per run of the baseline
+            map<pair<string, string>, pair<double, double>> before;
+            ifstream in(baseline);
+            for (string line; getline(in, line); )
+            {
+                stringstream fields(line);
+                string op, vm, ms, sql_text;
+                getline(fields, op, '\t');
+                getline(fields, vm, '\t');
+                getline(fields, ms, '\t');
+                getline(fields, sql_text);
+                if (!sql_text.empty()) {
+                    before[{ op, sql_text }] = { stod(vm), stod(ms) };
+                }
+            }
+            bool const compare { !before.empty() };
+
+            size_t failed {};
+            string current_op;
+            string saved;
+            for (auto const& [key, t] : trace.statements)
+            {
+                if (t.op != current_op) {
+                    current_op = t.op;
+                    cout << "  " << current_op << endl;
+                }
+
+                vector<string> const plan { query_plan(db, t.sql) };
+                bool const scan { scans_guarded(plan, t.sql) &&
+                    static_cast<size_t>(t.fullscan) > t.rows };
+
+                string const sql_text { one_line(t.sql, 1000) };
+                double const vm { static_cast<double>(t.vm_steps) /
+                    static_cast<double>(t.runs) };
+                double const ms { t.ms / static_cast<double>(t.runs) };
+                saved += fmt::format("{}\t{:.0f}\t{:.4f}\t{}\n", t.op, vm, ms,
+                        sql_text);
+
+                string versus;
+                bool grew { false };
+                auto const it = before.find({ t.op, sql_text });
+                if (compare && it != before.end()) {
+                    grew = vm > 2 * max(it->second.first, 1.0);
+                    versus = fmt::format(", {:.2f}x steps {:.2f}x time",
+                            vm / max(it->second.first, 1.0),
+                            ms / max(it->second.second, 1e-2));
+                }
+                else if (compare) {
+                    versus = ", new";
+                }
+
+                bool const fine { !scan && !grew };
+                failed += fine ? 0 : 1;
+                cout << fmt::format(
+                        "    {:<4} {:>3} runs {:>8} rows {:>8} scanned "
+                        "{:>10.0f} steps {:>9.3f} ms{}  {}\n",
+                        fine ? "ok" : scan ? "SCAN" : "SLOW", t.runs, t.rows,
+                        t.fullscan, vm, ms, versus, one_line(t.sql, 60));
+                if (!fine) {
+                    for (string const& line : plan) {
+                        cout << "           " << line << endl;
+                    }
+                }
+            }
+            ok = failed == 0;
+            cout << fmt::format("  {} statements, {} failed\n",
+                    trace.statements.size(), failed);
+
+            if (!baseline.empty() && !compare)
+            {
+                ofstream(baseline) << saved;
+                cout << "  baseline written to " << baseline << endl;
+            }
+            sqlite3_trace_v2(db, 0, nullptr, nullptr);
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+
+        return ok;
+    }
+
+    // operations each simulated client of the contention bench runs
+    constexpr size_t CLIENT_OPS { 200 };
+
+    // what one client got done, lives in memory shared with the driver
+    struct ClientSlot
+    {
+        size_t ops;
+        size_t busy;    // SQLITE_BUSY/LOCKED errors, each one retried
+        size_t failed;  // other errors, operation given up
+        double hours;   // hours this client successfully wrote
+        double latency[CLIENT_OPS]; // ms per operation, retries included
+    };
+
+    static void client(string const& path, int const index, Mix const& mix,
+            int const activities, ClientSlot& slot)
+    {
+        /* one simulated tracker: its own connection, a random sequence of
+         * work phase commits, manual entries and stats reports
+         */
+        soci::session sql("sqlite3", "db=" + path);
+        SCHEMA::apply_pragmas(sql);
+        STORAGE::Sqlite storage(sql);
+
+        // the reports print, nobody's reading
+        cout.rdbuf(nullptr);
+
+        mt19937 rng { static_cast<unsigned int>(index + 1) };
+        string const today { TIME::get_date_string() };
+        int const day { TIME::conv_date_to_epoch_day(today) };
+        string const month_ago { TIME::conv_epoch_day_to_date(day - 30) };
+        long long const base {
+            static_cast<long long>(day) * 86400 + index * 1000000LL };
+
+        for (size_t op {}; op < CLIENT_OPS; ++op)
+        {
+            int const roll { static_cast<int>(rng() % 100) };
+            int const act { static_cast<int>(rng() %
+                    static_cast<unsigned int>(activities)) + 1 };
+            double const hours {
+                static_cast<double>(rng() % 1000 + 1) / 1000 };
+            string const date { TIME::conv_epoch_day_to_date(
+                    day - static_cast<int>(rng() % 365)) };
+
+            auto s = chrono::steady_clock::now();
+            while (true)
+            {
+                try
+                {
+                    if (roll < mix.commits) {
+                        storage.commit_work(act, { { today, hours,
+                                base + static_cast<long long>(op),
+                                static_cast<int>(hours * 3600) } });
+                        slot.hours += hours;
+                    }
+                    else if (roll < mix.commits + mix.manual) {
+                        storage.add_hours(act, date, hours);
+                        slot.hours += hours;
+                    }
+                    else {
+                        SQL::print_stats(storage, month_ago, today);
+                    }
+                    break;
+                }
+                catch (soci::sqlite3_soci_error const& e)
+                {
+                    int const rc { e.result() & 0xff };
+                    if (rc != 5 && rc != 6) { // SQLITE_BUSY, SQLITE_LOCKED
+                        ++slot.failed;
+                        break;
+                    }
+                    ++slot.busy;
+                }
+            }
+            auto e = chrono::steady_clock::now();
+
+            slot.latency[op] = chrono::duration<double, milli>(e - s).count();
+            ++slot.ops;
+        }
+    }
+
+    static bool fresh_reports(string const& path, int const activities)
+    {
+        /* reports of one connection before and after a forked process
+         * wrote through a connection of its own (so nothing of this process
+         * heard of the writes); the second report has to be the one a
+         * fresh scan prints, not blocks and totals cached by the first
+         */
+        string const today { TIME::get_date_string() };
+        int const day { TIME::conv_date_to_epoch_day(today) };
+        vector<pair<string, string>> const ranges {
+            { TIME::conv_epoch_day_to_date(day - 30), today },
+            { TIME::conv_epoch_day_to_date(day - 730), today } };
+
+        soci::session sql("sqlite3", "db=" + path);
+        SCHEMA::apply_pragmas(sql);
+        STORAGE::Sqlite storage(sql);
+        STATS::cache().clear();
+        STATS::totals().clear();
+
+        auto report = [&storage](pair<string, string> const& range) {
+            ostringstream out;
+            streambuf* const old { cout.rdbuf(out.rdbuf()) };
+            SQL::print_stats(storage, range.first, range.second);
+            cout.rdbuf(old);
+            return out.str();
+        };
+
+        for (auto const& range : ranges) {
+            report(range);
+        }
+
+        cout << flush;
+        pid_t const pid { fork() };
+        if (pid == 0)
+        {
+            int code { 0 };
+            try {
+                soci::session other("sqlite3", "db=" + path);
+                SCHEMA::apply_pragmas(other);
+                STORAGE::Sqlite writer(other);
+                long long const now { static_cast<long long>(day) * 86400 };
+                for (int a { 1 }; a <= activities; ++a) {
+                    writer.commit_work(a, { { today, 0.5, now + a, 1800 } });
+                    writer.add_hours(a, TIME::conv_epoch_day_to_date(
+                                day - 20 * a), 1.25);
+                }
+            }
+            catch (exception const&) {
+                code = 1;
+            }
+            _exit(code);
+        }
+        int status {};
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            throw runtime_error("contention: writer process failed");
+        }
+
+        vector<string> after;
+        for (auto const& range : ranges) {
+            after.push_back(report(range));
+        }
+        STATS::cache().clear();
+        STATS::totals().clear();
+
+        bool ok { true };
+        for (size_t i {}; i < ranges.size(); ++i)
+        {
+            bool const same { after[i] == report(ranges[i]) };
+            cout << fmt::format("  report {}..{} after another connection "
+                    "wrote: {}\n", ranges[i].first, ranges[i].second,
+                    same ? "matches a fresh scan" : "STALE");
+            ok = ok && same;
+        }
+        return ok;
+    }
+
+    bool contention(Mix const& mix, int const max_clients)
+    {
+        /* N forked clients against one db, N = 1, 2, 4, .. up to
+         * max_clients (the core count unless given); afterwards the hours
+         * in the db have to match what the clients wrote, anything missing
+         * is a lost update; before that, reports have to notice writes of
+         * other connections (see fresh_reports)
+         * false on a stale report, a lost update, a failed operation (other
+         * than busy) or a crashed client
+         */
+        int const activities { 10 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_contention.db").string() };
+        bool ok { true };
+
+        cout << fmt::format("contention: {} ops per client, {}% commits, "
+                "{}% manual entries, {}% stats\n", CLIENT_OPS, mix.commits,
+                mix.manual, 100 - mix.commits - mix.manual);
+
+        vector<int> counts;
+        for (int n { 1 }; n < max_clients; n *= 2) {
+            counts.push_back(n);
+        }
+        counts.push_back(max_clients);
+
+        auto create = [&path, activities]() {
+            filesystem::remove(path);
+            filesystem::remove(path + "-wal");
+            filesystem::remove(path + "-shm");
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite storage(sql);
+            for (int a {}; a < activities; ++a) {
+                storage.add_activity("activity_" + to_string(a + 1),
+                        a % 3 + 1, "2000-01-01");
+            }
+        };
+
+        create();
+        ok = fresh_reports(path, activities);
+
+        for (int const n : counts)
+        {
+            create();
+
+            size_t const bytes { sizeof(ClientSlot) * static_cast<size_t>(n) };
+            void* shared { mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0) };
+            if (shared == MAP_FAILED) {
+                throw runtime_error("contention: mmap failed");
+            }
+            ClientSlot* slots { static_cast<ClientSlot*>(shared) };
+
+            // children would flush the driver's pending output again
+            cout << flush;
+
+            auto s = chrono::steady_clock::now();
+            vector<pid_t> pids;
+            for (int c {}; c < n; ++c)
+            {
+                pid_t const pid { fork() };
+                if (pid == 0)
+                {
+                    int code { 0 };
+                    try {
+                        client(path, c, mix, activities, slots[c]);
+                    }
+                    catch (exception const&) {
+                        code = 1;
+                    }
+                    _exit(code);
+                }
+                pids.push_back(pid);
+            }
+            int crashed {};
+            for (pid_t const pid : pids)
+            {
+                int status {};
+                waitpid(pid, &status, 0);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    ++crashed;
+                }
+            }
+            auto e = chrono::steady_clock::now();
+            double const wall { chrono::duration<double>(e - s).count() };
+
+            size_t ops {}, busy {}, failed {};
+            double hours {};
+            vector<double> latency;
+            for (int c {}; c < n; ++c)
+            {
+                ClientSlot const& slot { slots[c] };
+                ops    += slot.ops;
+                busy   += slot.busy;
+                failed += slot.failed;
+                hours  += slot.hours;
+                latency.insert(latency.end(), slot.latency,
+                        slot.latency + slot.ops);
+            }
+            munmap(shared, bytes);
+
+            sort(latency.begin(), latency.end());
+            auto pct = [&latency](double const q) {
+                if (latency.empty()) {
+                    return 0.0;
+                }
+                size_t i { static_cast<size_t>(
+                        q * static_cast<double>(latency.size() - 1)) };
+                return latency[i];
+            };
+
+            double in_history {}, in_totals {};
+            {
+                soci::session sql("sqlite3", "db=" + path);
+                sql << "SELECT COALESCE(SUM(hours_on_day), 0) FROM history",
+                    soci::into(in_history);
+                sql << "SELECT COALESCE(SUM(hours_total), 0) FROM activities",
+                    soci::into(in_totals);
+            }
+            double const lost_days   { hours - in_history };
+            double const lost_totals { hours - in_totals };
+            bool const lost {
+                abs(lost_days) > 1e-6 || abs(lost_totals) > 1e-6 };
+
+            cout << fmt::format(
+                    "  {:>3} clients: {:8.1f} ops/s, p50 {:7.2f} ms, "
+                    "p99 {:7.2f} ms, p999 {:7.2f} ms, busy {}, failed {}{}\n"
+                    "               lost updates: {} (days {:+.3f} h, "
+                    "totals {:+.3f} h)\n",
+                    n, static_cast<double>(ops) / wall, pct(0.5), pct(0.99),
+                    pct(0.999), busy, failed,
+                    crashed > 0 ? fmt::format(", {} crashed", crashed) : "",
+                    lost ? "YES" : "none", lost_days, lost_totals);
+
+            ok = ok && !lost && failed == 0 && crashed == 0;
+        }
+
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+        return ok;
+    }
+
+    /* average allocations of one call of f, over n calls, including what
+     * the calls handed to the db thread of storage (if it has one); before
+     * runs ahead of every call and doesn't count
+     */
+    template <typename F>
+    static ALLOC::Counters allocs_per_call(STORAGE::Backend& storage, F&& f,
+            size_t const n, function<void()> const& before = {})
+    {
+        static char const tag[] { "bench" };
+        ALLOC::enable();
+        for (size_t i {}; i < n; ++i)
+        {
+            if (before) {
+                before();
+            }
+            {
+                ALLOC::Scope scope(tag);
+                f();
+            }
+            // the posted share still counts to the tag, the wait doesn't
+            storage.flush();
+        }
+        return ALLOC::take(tag);
+    }
+
+    bool allocations(void)
+    {
+        /* allocations per work phase commit, stats report and menu render
+         * against fixed budgets, on both storage backends and on sqlite
+         * through the db thread like the tracker uses it; returns false if
+         * any budget is exceeded (budgets are a bit above what the code
+         * needs today, so new allocations in these paths show up here)
+         * a report runs warm (all but the first from the cache) and cold
+         * (every cached block and the range totals dropped before each)
+         */
+        struct Budget
+        {
+            char const* op;
+            size_t      allocs;
+        };
+        Budget const budgets[] {
+            { "work phase commit", 300 },
+            { "stats report",      1000 },
+            { "cold stats report", 800  },
+            { "menu render",       0   },
+        };
+
+        int const activities { 10 };
+        int const days       { 90 };
+        string const path {
+            (filesystem::temp_directory_path() /
+             "tracker_bench_allocations.db").string() };
+
+        cout << "allocations: per operation, budget in brackets" << endl;
+
+        bool ok { true };
+
+        // forget drops what the backend keeps of STATS::cache() itself
+        auto measure = [&](string const& name, STORAGE::Backend& storage,
+                function<void()> const& forget) {
+            string const today { TIME::get_date_string() };
+            int const day { TIME::conv_date_to_epoch_day(today) };
+            for (int a {}; a < activities; ++a) {
+                storage.add_activity("activity_" + to_string(a + 1),
+                        a % 3 + 1, "2000-01-01");
+            }
+            for (int d { days }; d > 0; --d) {
+                for (int a {}; a < activities; ++a) {
+                    storage.add_hours(a + 1,
+                            TIME::conv_epoch_day_to_date(day - d),
+                            static_cast<double>((d + a) % 8) / 2);
+                }
+            }
+            string const month_ago { TIME::conv_epoch_day_to_date(day - 30) };
+            string const yesterday { TIME::conv_epoch_day_to_date(day - 1) };
+
+            // the reports print, only their allocations matter here
+            streambuf* const out { cout.rdbuf(nullptr) };
+
+            ALLOC::Counters const per_call[] {
+                allocs_per_call(storage, [&]() {
+                    unordered_map<string, string> smap {
+                        TIME::get_datetime_map() };
+                    unordered_map<string, string> emap {
+                        TIME::get_datetime_map() };
+                    TRACKER::update_work_time(storage, "1", smap, emap, 1);
+                }, 100),
+                allocs_per_call(storage, [&]() {
+                    SQL::print_stats(storage, month_ago, yesterday);
+                }, 20),
+                allocs_per_call(storage, [&]() {
+                    SQL::print_stats(storage, month_ago, yesterday);
+                }, 20, [&]() {
+                    STATS::cache().clear();
+                    STATS::totals().clear();
+                    if (forget) {
+                        forget();
+                    }
+                }),
+                allocs_per_call(storage, [&]() {
+                    TRACKER::print_menu();
+                }, 100),
+            };
+
+            cout.rdbuf(out);
+            cout.clear();
+
+            for (size_t i {}; i < size(budgets); ++i)
+            {
+                bool const fits { per_call[i].allocs <= budgets[i].allocs };
+                ok = ok && fits;
+                cout << fmt::format(
+                        "  {:<7} {:<18}: {:6} allocs [{:>4}], {:8} bytes {}\n",
+                        name, budgets[i].op, per_call[i].allocs,
+                        budgets[i].allocs, per_call[i].bytes,
+                        fits ? "ok" : "EXCEEDED");
+            }
+        };
+
+        {
+            STORAGE::Memory memory;
+            measure("memory", memory, {});
+        }
+
+        filesystem::remove(path);
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite sqlite(sql);
+            measure("sqlite", sqlite, [&sql]() {
+                SCHEMA::ensure_stats_cache(sql);
+                sql << "DELETE FROM stats_cache";
+            });
+        }
+        filesystem::remove(path);
+        {
+            soci::session sql("sqlite3", "db=" + path);
+            SCHEMA::open(sql);
+            STORAGE::Sqlite sqlite(sql);
+            WRITER::Thread db;
+            WRITER::Queued queued(sqlite, db);
+            measure("queued", queued, [&sql, &db]() {
+                db.call([&sql]() {
+                    SCHEMA::ensure_stats_cache(sql);
+                    sql << "DELETE FROM stats_cache";
+                }).get();
+            });
+        }
+        filesystem::remove(path);
+        filesystem::remove(path + "-wal");
+        filesystem::remove(path + "-shm");
+
+        cout << fmt::format("  peak RSS: {} KiB\n", ALLOC::peak_rss_kib());
+
+        return ok;
+    }
+
+    void run(string const& name, vector<string> const& options)
+    {
+        bool const all { name == "all" };
+        bool ran { false };
+
+        if (all || name == "aggregation") {
+            aggregation();
+            ran = true;
+        }
+
+        if (all || name == "startup") {
+            if (!startup()) {
+                throw runtime_error("startup exceeds its budget");
+            }
+            ran = true;
+        }
+
+        if (all || name == "segments") {
+            segments();
+            ran = true;
+        }
+
+        if (all || name == "heatmap") {
+            heatmap();
+            ran = true;
+        }
+
+        if (all || name == "storage") {
+            storage();
+            ran = true;
+        }
+
+        if (all || name == "writer") {
+            writer();
+            ran = true;
+        }
+
+        if (all || name == "status") {
+            if (!status()) {
+                throw runtime_error("status: torn reads");
+            }
+            ran = true;
+        }
+
+        if (all || name == "filter") {
+            if (!filter()) {
+                throw runtime_error("filtered scans don't match the predicate");
+            }
+            ran = true;
+        }
+
+        if (all || name == "totals") {
+            if (!totals()) {
+                throw runtime_error("range index doesn't match the scan");
+            }
+            ran = true;
+        }
+
+        if (all || name == "partitions") {
+            if (!partitions()) {
+                throw runtime_error(
+                        "parallel range scans don't match one scan");
+            }
+            ran = true;
+        }
+
+        if (all || name == "snapshot") {
+            if (!snapshot()) {
+                throw runtime_error("snapshot doesn't match the db");
+            }
+            ran = true;
+        }
+
+        if (all || name == "pipeline") {
+            if (!pipeline()) {
+                throw runtime_error("pipelined collect doesn't match");
+            }
+            ran = true;
+        }
+
+        if (all || name == "users") {
+            if (!users()) {
+                throw runtime_error("a user's reports don't match their rows");
+            }
+            ran = true;
+        }
+
+        if (all || name == "plans") {
+            if (!plans(options.empty() ? "" : options[0])) {
+                throw runtime_error("a statement's plan scans or got slower");
+            }
+            ran = true;
+        }
+
+        if (all || name == "contention") {
+            // options: commits,manual[,stats] percentages and max clients
+            Mix mix;
+            if (!options.empty()) {
+                string const& m { options[0] };
+                size_t const comma { m.find(',') };
+                mix.commits = stoi(m.substr(0, comma));
+                mix.manual  = comma == string::npos ? 0 :
+                    stoi(m.substr(comma + 1));
+            }
+            if (mix.commits < 0 || mix.manual < 0 ||
+                    mix.commits + mix.manual > 100) {
+                throw runtime_error("contention: mix has to add up to 100%");
+            }
+            int const clients { options.size() > 1 ? stoi(options[1]) :
+                max(1, static_cast<int>(thread::hardware_concurrency())) };
+            if (!contention(mix, clients)) {
+                throw runtime_error("contention: stale reports, lost updates "
+                        "or failed clients");
+            }
+            ran = true;
+        }
+
+        if (all || name == "allocations") {
+            if (!allocations()) {
+                throw runtime_error("allocation budget exceeded");
+            }
+            ran = true;
+        }
+
+        if (!ran) {
+            throw runtime_error("Unknown benchmark: " + name);
+        }
+    }
+}
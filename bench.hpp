@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace BENCH {
+
+    /* runs the named benchmark ("all" runs every one of them)
+     * benchmarks work on generated data and print their timings to stdout
+     * options are the remaining command line arguments, for the benchmarks
+     * that take some
+     */
+    void run(std::string const& name,
+            std::vector<std::string> const& options = {});
+
+    // percent of the operations of a contention client, the rest are stats
+    struct Mix
+    {
+        int commits { 70 };
+        int manual  { 20 };
+    };
+
+    void aggregation(void);
+    // false if open to menu takes longer than its budget
+    bool startup(void);
+    void segments(void);
+    void heatmap(void);
+    void storage(void);
+    void writer(void);
+
+    // false if a reader of the status segment saw a torn snapshot
+    bool status(void);
+
+    // false if the sql plan and the in memory predicate of a filter disagree
+    bool filter(void);
+
+    // false if a range total of the index differs from the scanned one
+    bool totals(void);
+
+    // false if the parallel range scans come to other numbers than one scan
+    bool partitions(void);
+
+    // false if the snapshot file streams other hours than the db
+    bool snapshot(void);
+
+    // false if the pipelined stats collect differs from the plain one
+    bool pipeline(void);
+
+    // false if a user's reports in a shared db differ from their rows
+    bool users(void);
+
+    /* false if a statement of the tracker's operations runs through
+     * history or activities to find its rows, or takes twice the VM steps
+     * it took in baseline (a file written by the first run)
+     */
+    bool plans(std::string const& baseline = "");
+
+    /* false if a report misses what another connection wrote meanwhile,
+     * an update is lost, an operation fails or a client crashes
+     */
+    bool contention(Mix const& mix, int const max_clients);
+
+    // false if an operation went over its allocation budget
+    bool allocations(void);
+}
@@ -1,2 +1,2 @@
 g++ -std=c++20 -Wall -Wpedantic -Werror -Wconversion \
-    *.cpp -o tracker -lfmt -lsoci_core -lsoci_sqlite3 -L/usr/local/lib
+    *.cpp -o tracker -lfmt -lsoci_core -lsoci_sqlite3 -lsqlite3 -L/usr/local/lib
@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./filter.hpp"
+#include "./time.hpp"
+
+using namespace std;
+
+namespace FILTER
+{
+    bool Filter::empty(void) const
+    {
+        return activities.empty() && groups.empty() && first.empty() &&
+            last.empty() && !per_day();
+    }
+
+    bool Filter::per_day(void) const
+    {
+        return weekdays != 0x7f || weeks != ~0ULL || min_hours > 0;
+    }
+
+    bool Filter::matches(int const day, int const activity, int const group,
+            double const hours) const
+    {
+        // cheapest checks first, most rows fail on the ids if any are set
+        if (!activities.empty() &&
+                !binary_search(activities.begin(), activities.end(), activity)) {
+            return false;
+        }
+        if (!groups.empty() &&
+                !binary_search(groups.begin(), groups.end(), group)) {
+            return false;
+        }
+        if (hours < min_hours) {
+            return false;
+        }
+        // epoch day 0 was a Thursday
+        if (!(weekdays >> ((day + 3) % 7) & 1U)) {
+            return false;
+        }
+        if (weeks != ~0ULL && !(weeks >> iso_week(day) & 1ULL)) {
+            return false;
+        }
+        return day >= first_day && day <= last_day;
+    }
+
+    int iso_week(int const day)
+    {
+        /* the week belongs to the year its Thursday is in, week 1 is the
+         * one with the first Thursday
+         */
+        int const thursday { day - (day + 3) % 7 + 3 };
+        chrono::sys_days const t { chrono::days { thursday } };
+        chrono::year_month_day const ymd { t };
+        chrono::sys_days const jan1 { ymd.year() / chrono::January / 1 };
+        return static_cast<int>((t - jan1).count() / 7 + 1);
+    }
+
+    string id_list(vector<int> const& ids)
+    {
+        string list { "[" };
+        for (int const id : ids) {
+            list += (list.size() > 1 ? "," : "") + to_string(id);
+        }
+        return list + "]";
+    }
+
+    static vector<string> split(string const& text, char const sep)
+    {
+        vector<string> parts;
+        string part;
+        istringstream in(text);
+        while (getline(in, part, sep)) {
+            parts.push_back(part);
+        }
+        return parts;
+    }
+
+    static int to_int(string const& term, string const& value)
+    {
+        size_t used {};
+        int n {};
+        try {
+            n = stoi(value, &used);
+        }
+        catch (exception const&) {
+            used = 0;
+        }
+        if (used == 0 || used != value.size()) {
+            throw runtime_error("Not a number in filter term " + term);
+        }
+        return n;
+    }
+
+    static int weekday(string const& term, string const& name)
+    {
+        static char const* const NAMES[] {
+            "mon", "tue", "wed", "thu", "fri", "sat", "sun" };
+        for (int d {}; d < 7; ++d) {
+            if (name == NAMES[d]) {
+                return d;
+            }
+        }
+        throw runtime_error("Unknown weekday in filter term " + term);
+    }
+
+    // "a-b" or "a", each of the comma separated values of a term
+    template<typename Parse, typename Add>
+    static void ranges(string const& term, string const& values,
+            Parse const& parse, Add const& add)
+    {
+        for (string const& value : split(values, ','))
+        {
+            size_t const dash { value.find('-') };
+            int const a { parse(term, value.substr(0, dash)) };
+            int const b { dash == string::npos ? a :
+                parse(term, value.substr(dash + 1)) };
+            if (b < a) {
+                throw runtime_error("Empty range in filter term " + term);
+            }
+            for (int v { a }; v <= b; ++v) {
+                add(v);
+            }
+        }
+    }
+
+    static void check_date(string const& term, string const& date)
+    {
+        if (date.size() != 10 || date[4] != '-' || date[7] != '-') {
+            throw runtime_error("Not a yyyy-mm-dd date in filter term " + term);
+        }
+    }
+
+    static Filter parse(string const& text)
+    {
+        Filter filter;
+        string term;
+        istringstream in(text);
+
+        while (in >> term)
+        {
+            size_t const colon { term.find(':') };
+            if (colon == string::npos || colon + 1 == term.size()) {
+                throw runtime_error("Filter terms are key:value, got " + term);
+            }
+            string const key   { term.substr(0, colon) };
+            string const value { term.substr(colon + 1) };
+
+            if (key == "activity" || key == "group")
+            {
+                vector<int>& ids {
+                    key == "activity" ? filter.activities : filter.groups };
+                ranges(term, value, to_int,
+                        [&ids](int const id) { ids.push_back(id); });
+                sort(ids.begin(), ids.end());
+                ids.erase(unique(ids.begin(), ids.end()), ids.end());
+            }
+            else if (key == "from" || key == "to")
+            {
+                check_date(term, value);
+                int const day { TIME::conv_date_to_epoch_day(value) };
+                if (key == "from") {
+                    filter.first     = value;
+                    filter.first_day = day;
+                }
+                else {
+                    filter.last     = value;
+                    filter.last_day = day;
+                }
+            }
+            else if (key == "weekday")
+            {
+                unsigned days {};
+                ranges(term, value, weekday,
+                        [&days](int const d) { days |= 1U << d; });
+                filter.weekdays = days;
+            }
+            else if (key == "week")
+            {
+                uint64_t weeks {};
+                ranges(term, value, to_int, [&](int const w) {
+                    if (w < 1 || w > 53) {
+                        throw runtime_error("Weeks go from 1 to 53 in " + term);
+                    }
+                    weeks |= 1ULL << w;
+                });
+                filter.weeks = weeks;
+            }
+            else if (key == "min")
+            {
+                try {
+                    filter.min_hours = stod(value);
+                }
+                catch (exception const&) {
+                    throw runtime_error("Not a number in filter term " + term);
+                }
+            }
+            else
+            {
+                throw runtime_error("Unknown filter term " + term);
+            }
+        }
+        return filter;
+    }
+
+    Filter const& compile(string const& text)
+    {
+        // few distinct filters get typed in a session, no need to evict
+        static unordered_map<string, Filter> compiled;
+
+        auto it = compiled.find(text);
+        if (it == compiled.end()) {
+            it = compiled.emplace(text, parse(text)).first;
+        }
+        return it->second;
+    }
+}
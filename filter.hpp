@@ -0,0 +1,48 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace FILTER {
+
+    /* which history rows a report looks at, parsed from a line like
+     *   activity:1,4 group:2 from:2024-01-01 to:2024-06-30
+     *   weekday:mon-fri week:1-10,52 min:0.5
+     * terms are and-ed, the values of one term are or-ed; a term that is
+     * left out doesn't restrict anything
+     */
+    struct Filter
+    {
+        std::vector<int> activities; // sorted, empty for all
+        std::vector<int> groups;     // sorted, empty for all
+        std::string   first;         // yyyy-mm-dd, empty for no bound
+        std::string   last;
+        int           first_day { INT_MIN }; // same bounds as epoch days
+        int           last_day  { INT_MAX };
+        unsigned      weekdays { 0x7f };    // bit 0 is Monday
+        std::uint64_t weeks    { ~0ULL };   // bit n is ISO week n
+        double        min_hours {};         // per activity and day
+
+        bool empty(void) const;
+
+        // weekday, week and min_hours only make sense for daily rows
+        bool per_day(void) const;
+
+        // the in memory form, day is an epoch day
+        bool matches(int const day, int const activity, int const group,
+                double const hours) const;
+    };
+
+    /* parses text, throws runtime_error on anything it doesn't understand
+     * filters are kept by their text, so each one is only parsed once
+     */
+    Filter const& compile(std::string const& text);
+
+    // "[1,4]" for { 1, 4 }, a json array the sql plan reads with json_each
+    std::string id_list(std::vector<int> const& ids);
+
+    // ISO 8601 week number of an epoch day
+    int iso_week(int const day);
+}
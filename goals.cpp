@@ -0,0 +1,208 @@
+#include <fmt/core.h>
+#include <string>
+#include <vector>
+
+#include "./goals.hpp"
+#include "./stats.hpp"
+#include "./storage.hpp"
+#include "./time.hpp"
+
+using namespace std;
+
+namespace GOALS
+{
+    string period_name(Period const period)
+    {
+        switch (period)
+        {
+            case Period::day:  return "day";
+            case Period::week: return "week";
+            default:           return "month";
+        }
+    }
+
+    int period_start(Period const period, int const day)
+    {
+        switch (period)
+        {
+            case Period::day:
+                return day;
+            case Period::week:
+                return STATS::block_start(day, 7);
+            default:
+            {
+                // yyyy-mm-dd -> yyyy-mm-01
+                string date { TIME::conv_epoch_day_to_date(day) };
+                return TIME::conv_date_to_epoch_day(date.substr(0, 8) + "01");
+            }
+        }
+    }
+
+    void Progress::rebuild(STORAGE::Backend& storage)
+    {
+        /* one pass over history from the oldest current period start
+         * (start of this month or of this week) to today
+         */
+        goals_ = storage.goals();
+        done_.assign(goals_.size(), 0.0);
+        group_of_.clear();
+        by_activity_.clear();
+        by_group_.clear();
+
+        for (SQL::Activity const& a : storage.activities()) {
+            group_of_[a.id] = a.group;
+        }
+        // a group goal counts its whole subtree, so it is filed under
+        // every group below it as well
+        unordered_map<int, vector<int>> subtree;
+        for (auto const& [ancestor, descendant] : storage.group_closure()) {
+            subtree[ancestor].push_back(descendant);
+        }
+        for (size_t g {}; g < goals_.size(); ++g)
+        {
+            int const target { goals_[g].target };
+            if (!goals_[g].group) {
+                by_activity_[target].push_back(g);
+            }
+            else if (subtree.count(target)) {
+                for (int const group : subtree[target]) {
+                    by_group_[group].push_back(g);
+                }
+            }
+            else {
+                by_group_[target].push_back(g);
+            }
+        }
+
+        today_ = TIME::conv_date_to_epoch_day(TIME::get_date_string());
+        int first { today_ };
+        for (Period const p : { Period::day, Period::week, Period::month })
+        {
+            start_[static_cast<int>(p)] = period_start(p, today_);
+            first = min(first, start_[static_cast<int>(p)]);
+        }
+
+        if (goals_.empty()) {
+            return;
+        }
+
+        storage.stream_days(TIME::conv_epoch_day_to_date(first),
+                TIME::conv_epoch_day_to_date(today_),
+                [this](SQL::HistoryColumns const& chunk)
+        {
+            for (size_t i {}; i < chunk.size(); ++i) {
+                add_day(chunk.activity[i], chunk.group[i], chunk.day[i],
+                        chunk.hours[i]);
+            }
+        });
+    }
+
+    void Progress::roll(int const day)
+    {
+        // a new day, periods that started over count from zero again
+        today_ = day;
+        int start[3] {};
+        for (Period const p : { Period::day, Period::week, Period::month }) {
+            start[static_cast<int>(p)] = period_start(p, day);
+        }
+        for (size_t g {}; g < goals_.size(); ++g)
+        {
+            int const p { static_cast<int>(goals_[g].period) };
+            if (start[p] != start_[p]) {
+                done_[g] = 0.0;
+            }
+        }
+        for (int p {}; p < 3; ++p) {
+            start_[p] = start[p];
+        }
+    }
+
+    void Progress::add_day(int const activity, int const group, int const day,
+            double const hours)
+    {
+        auto count = [&](unordered_map<int, vector<size_t>> const& index,
+                int const key)
+        {
+            auto it = index.find(key);
+            if (it == index.end()) {
+                return;
+            }
+            for (size_t const g : it->second)
+            {
+                // entries before the current period do not count
+                if (day >= start_[static_cast<int>(goals_[g].period)]) {
+                    done_[g] += hours;
+                }
+            }
+        };
+        count(by_activity_, activity);
+        count(by_group_, group);
+    }
+
+    void Progress::add(int const activity, string const& date,
+            double const hours)
+    {
+        if (goals_.empty()) {
+            return;
+        }
+        /* periods only move on with the clock, an entry dated after today
+         * (a typo in a manual date) belongs to no current period
+         */
+        int const now {
+            TIME::conv_date_to_epoch_day(TIME::get_date_string()) };
+        if (now > today_) {
+            roll(now);
+        }
+        int const day { TIME::conv_date_to_epoch_day(date) };
+        if (day > today_) {
+            return;
+        }
+        auto it = group_of_.find(activity);
+        add_day(activity, it == group_of_.end() ? -1 : it->second, day, hours);
+    }
+
+    string Progress::status(int const activity, double const extra) const
+    {
+        string text;
+        auto append = [&](unordered_map<int, vector<size_t>> const& index,
+                int const key)
+        {
+            auto it = index.find(key);
+            if (it == index.end()) {
+                return;
+            }
+            for (size_t const g : it->second)
+            {
+                if (!text.empty()) {
+                    text += "  ";
+                }
+                text += fmt::format("{}{} {:.1f}/{:.1f}h",
+                        goals_[g].group ? "group " : "",
+                        period_name(goals_[g].period), done_[g] + extra,
+                        goals_[g].hours);
+            }
+        };
+        append(by_activity_, activity);
+        auto it = group_of_.find(activity);
+        if (it != group_of_.end()) {
+            append(by_group_, it->second);
+        }
+        return text;
+    }
+
+    vector<Progress::Line> Progress::lines(void) const
+    {
+        vector<Line> out;
+        out.reserve(goals_.size());
+        for (size_t g {}; g < goals_.size(); ++g) {
+            out.push_back({ goals_[g], done_[g] });
+        }
+        return out;
+    }
+
+    Progress& progress(void)
+    {
+        static Progress p;
+        return p;
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace STORAGE { class Backend; }
+
+namespace GOALS {
+
+    enum class Period { day, week, month };
+
+    // target hours per period for one activity or one group
+    struct Goal
+    {
+        int    id;
+        bool   group;  // target is a group id, else an activity id
+        int    target;
+        Period period;
+        double hours;
+    };
+
+    // "day", "week", "month"
+    std::string period_name(Period const period);
+
+    // first epoch day of the period containing day (weeks start on Monday)
+    int period_start(Period const period, int const day);
+
+    /* hours done towards every goal in its current period
+     * rebuild() reads them from history once, after that every committed
+     * entry is added with add(), which only touches the goals of that
+     * activity and its group, so progress never needs a query
+     */
+    class Progress
+    {
+    public:
+        void rebuild(STORAGE::Backend& storage);
+
+        // moves on to today's periods first, days after today are left out
+        void add(int const activity, std::string const& date,
+                double const hours);
+
+        /* e.g. "day 1.5/4.0h  week 7.2/20.0h" for the goals of activity
+         * and its group, extra are hours not committed yet (running timer)
+         */
+        std::string status(int const activity, double const extra = 0) const;
+
+        struct Line
+        {
+            Goal   goal;
+            double done;
+        };
+        std::vector<Line> lines(void) const;
+
+    private:
+        void add_day(int const activity, int const group, int const day,
+                double const hours);
+        void roll(int const day);
+
+        std::vector<Goal>   goals_;
+        std::vector<double> done_;
+        std::unordered_map<int, int> group_of_; // activity id -> group id
+        std::unordered_map<int, std::vector<std::size_t>> by_activity_;
+        // group id -> goals of the group and of the groups above it
+        std::unordered_map<int, std::vector<std::size_t>> by_group_;
+        int today_ {};
+        int start_[3] {}; // current start day per Period
+    };
+
+    // process wide progress, kept up to date by the menus
+    Progress& progress(void);
+}
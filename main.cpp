@@ -4,9 +4,12 @@
 #include <soci/sqlite3/soci-sqlite3.h>
 
 // stdlib libraries
+#include <algorithm>
 #include <chrono>
+#include <filesystem>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -16,108 +19,256 @@
 
 // own header files
 #include "./sql.hpp"		// namespace: SQL
+#include "./stats.hpp"		// namespace: STATS
 #include "./tracker.hpp"	// namespace: TRACKER
 #include "./time.hpp"		// namespace: TIME
+#include "./bench.hpp"		// namespace: BENCH
+#include "./schema.hpp"		// namespace: SCHEMA
+#include "./sync.hpp"		// namespace: SYNC
+#include "./retention.hpp"	// namespace: RETENTION
+#include "./storage.hpp"	// namespace: STORAGE
+#include "./alloc.hpp"		// namespace: ALLOC
+#include "./goals.hpp"		// namespace: GOALS
+#include "./filter.hpp"		// namespace: FILTER
+#include "./writer.hpp"		// namespace: WRITER
+#include "./status.hpp"		// namespace: STATUS
+#include "./snapshot.hpp"	// namespace: SNAPSHOT
 
 // function prototypes
-void work(soci::session& sql);
-void stats(soci::session& sql);
-void configure(soci::session& sql);
-void manual(soci::session& sql);
+void menu(soci::session* sql, WRITER::Thread* db, STORAGE::Backend& storage);
+void work(STORAGE::Backend& storage);
+void stats(STORAGE::Backend& storage);
+void heatmap(STORAGE::Backend& storage);
+void configure(soci::session* sql, WRITER::Thread* db,
+		STORAGE::Backend& storage);
+void manual(STORAGE::Backend& storage);
+void goals(STORAGE::Backend& storage);
+void status(void);
+void failed_writes(WRITER::Thread* db);
 
 using namespace std;
 
 // global constants
 const string VERSION { "1.20" };
 const string DB_NAME { "productivity.db" };
+const string SNAPSHOT_NAME { "productivity.snap" };
+const chrono::milliseconds RETENTION_SLICE { 20 };
 
-int main(void)
+int main(int argc, char* argv[])
 {
 	try
 	{
-		// creates db if it doesn't exist
-		soci::session sql("sqlite3", "db=" + DB_NAME);
+		// command line: `tracker bench [name] [options]` runs benchmarks
+		// and exits
+		vector<string> args(argv + 1, argv + argc);
+
+		// `--alloc-report` (anywhere): allocations per operation on quit
+		auto report = find(args.begin(), args.end(), "--alloc-report");
+		if (report != args.end()) {
+			ALLOC::enable();
+			args.erase(report);
+		}
 
-		int tableCount {};
-		sql << "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table'",
-			soci::into(tableCount);
+		// `--user name[,name..]` (anywhere): only their activities and
+		// history, added to the db on first use
+		vector<string> user_names;
+		auto user = find(args.begin(), args.end(), "--user");
+		if (user != args.end()) {
+			if (user + 1 == args.end()) {
+				throw runtime_error("usage: --user <name[,name..]>");
+			}
+			stringstream names(*(user + 1));
+			string name;
+			while (getline(names, name, ',')) {
+				if (!name.empty()) {
+					user_names.push_back(name);
+				}
+			}
+			args.erase(user, user + 2);
+		}
 
-		if (tableCount == 0) {
-			cout << "Initializing db w/ needed tables" << endl;
-			SQL::bootup(sql);
+		if (!args.empty() && args[0] == "bench") {
+			BENCH::run(args.size() > 1 ? args[1] : "all",
+					vector<string>(args.begin() + min<size_t>(2, args.size()),
+						args.end()));
+			return 0;
 		}
-		else if (tableCount == 2)
-		{
-			cout << "db exists, has right table count" << endl;
-			cout << "(this is the extent of checking db integrity)" << endl;
+
+		// `tracker status`: what a running tracker is doing, the db isn't
+		// even opened
+		if (!args.empty() && args[0] == "status") {
+			status();
+			return 0;
 		}
-		else {
-			throw runtime_error("db has wrong tableCount");
+
+		// `tracker --ephemeral`: nothing is read from or written to disk
+		if (!args.empty() && args[0] == "--ephemeral") {
+			STORAGE::Memory storage;
+			cout << "Ephemeral session, nothing will be saved!" << endl;
+			SQL::bootup(storage);
+			menu(nullptr, nullptr, storage);
+			return 0;
 		}
 
-		cout <<
-			"Productivity tracker" << endl << 
-			"Version: " << VERSION << endl << endl;
+		// creates db if it doesn't exist
+		soci::session sql("sqlite3", "db=" + DB_NAME);
 
-		while (1)
-		{
-			cout <<
-				"Available options:\n"
-				"(w)ork\n"
-				"(s)tats\n"
-				"(c)onfigure\n"
-				"(m)anual\n"
-				"(q)uit\n\n";
-
-			cout << "Enter option: ";
-			char option;
-			cin >> option;
-
-			switch (option) {
-				case 'w':
-					work(sql);
-					break;
-				case 's':
-					stats(sql);
-					break;
-				case 'c':
-					configure(sql);
-					break;
-				case 'm':
-					manual(sql);
-					break;
-				case 'q':
-					exit(0);
-				default:
-					cout << "Invalid option, enter valid option key!"
-						<< endl << endl;
+		// pragmas, migrations up to SCHEMA::VERSION and a quick sanity check
+		int const version { SCHEMA::open(sql) };
+
+		// `tracker sync <other.db>` / `tracker sync --fork`, then exit
+		// (a new db gets its activities from the other one, no bootup)
+		if (!args.empty() && args[0] == "sync") {
+			if (args.size() < 2) {
+				throw runtime_error("usage: tracker sync <other.db|--fork>");
+			}
+			if (args[1] == "--fork") {
+				SYNC::fork(sql);
+			}
+			else {
+				SYNC::sync(sql, args[1]);
+			}
+			return 0;
+		}
+
+		// `tracker snapshot`: closed days to SNAPSHOT_NAME, then exit
+		if (!args.empty() && args[0] == "snapshot") {
+			SNAPSHOT::Written const w { SNAPSHOT::write(sql, SNAPSHOT_NAME) };
+			// read back in full here, startup only looks at the header
+			if (!SNAPSHOT::File(SNAPSHOT_NAME).intact()) {
+				throw runtime_error(SNAPSHOT_NAME + " is damaged (checksum)");
 			}
+			cout << fmt::format("Wrote {} history rows up to {} to {} "
+					"({} KiB)\n", w.records,
+					TIME::conv_epoch_day_to_date(w.through), SNAPSHOT_NAME,
+					w.bytes / 1024);
+			return 0;
+		}
+
+		vector<int> users;
+		for (string const& name : user_names) {
+			users.push_back(SQL::ensure_user(sql, name));
+		}
+		STORAGE::Sqlite sqlite(sql, users);
+
+		// reports read the closed days from the snapshot, if there is one
+		// (it has everyone's days, a user's reports don't)
+		if (users.empty() && filesystem::exists(SNAPSHOT_NAME)) {
+			try {
+				sqlite.attach_snapshot(
+						make_shared<SNAPSHOT::File const>(SNAPSHOT_NAME));
+			}
+			catch (const exception& e) {
+				cerr << "Ignoring " << e.what() << endl;
+			}
+		}
+
+		// a user seen for the first time starts like a new db
+		if (version == 0 || (!users.empty() && sqlite.activities().empty())) {
+			SQL::bootup(sqlite);
 		}
+
+		// from here on only the db thread uses the session, the menus go
+		// through storage (commits don't wait for the disk)
+		WRITER::Thread db;
+		WRITER::Queued storage(sqlite, db);
+
+		menu(&sql, &db, storage);
 	}
 	catch (const soci::sqlite3_soci_error& e)
 	{
 		cerr << "SQLite3 Error: " << e.what() << endl;
+		return 1;
 	}
 	catch (const exception &e)
 	{
 		cerr << "Error: " << e.what() << endl;
+		return 1;
 	}
 }
 
-void work(soci::session& sql)
+void menu(soci::session* sql, WRITER::Thread* db, STORAGE::Backend& storage)
 {
-	/* work timer function
-	 * user enters activity id, timer starts
-	 * can switch back and forth between work phase and break
+	/* main menu loop; sql is the db behind storage, for the things only
+	 * the db has (retention), and db the thread it has to be used on;
+	 * both nullptr when running ephemeral
 	 */
+	cout <<
+		"Productivity tracker" << endl << 
+		"Version: " << VERSION << endl << endl;
+
+	// goal progress of the current day, week and month, from history once
+	GOALS::progress().rebuild(storage);
+
+	while (1)
+	{
+		// commits and manual entries don't wait, their errors show up here
+		failed_writes(db);
+
+		// a slice of history compaction (if retention is set) per prompt
+		if (sql) {
+			RETENTION::Step done { db->call([sql]() {
+				return RETENTION::step(*sql, RETENTION_SLICE);
+			}).get() };
+			// folded months moved their hours to the first of the month
+			if (done.months > 0) {
+				STATS::totals().clear();
+			}
+			if (done.months > 0 || done.reclaimed > 0) {
+				cout << fmt::format(
+						"Compacted {} months ({} daily rows) of old history, "
+						"reclaimed {} KiB\n\n",
+						done.months, done.rows, done.reclaimed / 1024);
+			}
+		}
 
-	soci::rowset<soci::row> activities =
-		sql.prepare << "SELECT * FROM activities";
+		// goals and range totals take in what got stored since last time
+		STORAGE::catch_up(storage);
+
+		{
+			ALLOC::Scope scope("menu render");
+			TRACKER::print_menu();
+		}
+
+		char option;
+		cin >> option;
+
+		switch (option) {
+			case 'w':
+				work(storage);
+				break;
+			case 's':
+				stats(storage);
+				break;
+			case 'h':
+				heatmap(storage);
+				break;
+			case 'c':
+				configure(sql, db, storage);
+				break;
+			case 'm':
+				manual(storage);
+				break;
+			case 'q':
+				// exit() skips destructors, so the queue is drained here
+				storage.flush();
+				failed_writes(db);
+				if (ALLOC::enabled()) {
+					ALLOC::report(cout);
+				}
+				exit(0);
+			default:
+				cout << "Invalid option, enter valid option key!"
+					<< endl << endl;
+		}
+	}
+}
 
-	/* activities table:
-	 * +----+----------+------+------------+--------------+-------------+
-	 * | id | group_id | name | added_when | is_activated | hours_total |
-	 * +----+----------+------+------------+--------------+-------------+
+void work(STORAGE::Backend& storage)
+{
+	/* work timer function
+	 * user enters activity id, timer starts
+	 * can switch back and forth between work phase and break
 	 */
 
 	vector<int> actids;
@@ -125,9 +276,9 @@ void work(soci::session& sql)
 
 	// iterate over retrieved data, populate actids and atnms vectors
 	// and print info while we're at it
-	for (soci::row const& row : activities) {
-		int 		id = row.get<int>("id");
-		string nm = row.get<string>("name");
+	for (SQL::Activity const& act : storage.activities()) {
+		int 		id = act.id;
+		string nm = act.name;
 		actids.push_back(id);
 		actnms.push_back(nm);
 		cout << "ID - Name: " << id << " - "<< nm << endl;
@@ -172,6 +323,19 @@ void work(soci::session& sql)
 	// clear buffer just in case (since timeloop uses getline)
 	cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
+	// live status for `tracker status`, today's hours are read once here
+	// and then counted along
+	STATUS::Snapshot live {};
+	live.activity = actid;
+	string const name {
+		actnms[static_cast<size_t>(find(actids.begin(), actids.end(), actid) -
+				actids.begin())] };
+	name.copy(live.name, sizeof(live.name) - 1);
+	string const today { TIME::get_date_string() };
+	storage.stream_days(today, today, [&live](SQL::HistoryColumns const& c) {
+		live.today_hours += STATS::sum(c.hours.data(), c.size());
+	});
+
 	// these variables are simply for showing prompt at the end
 	unsigned int work  {};
 	unsigned int pause {};
@@ -185,27 +349,40 @@ void work(soci::session& sql)
 
 	while (1)
 	{
+		// the last phase counts towards the goals shown by the timer
+		STORAGE::catch_up(storage);
+
 		cout << "Started work timer!" << endl;
 		br = false;
+		live.on_break    = 0;
+		live.phase_start = time(nullptr);
+		STATUS::publisher().publish(live);
 
 		// start
 		smap = TIME::get_datetime_map();
 
 		// work time clock cycle (s start, e end)
 		auto s = chrono::steady_clock::now();
-		timeloopreturn = TRACKER::timeloop(countdown, countdown_seconds, br);
+		timeloopreturn = TRACKER::timeloop(countdown, countdown_seconds, br,
+				actid);
 		auto e = chrono::steady_clock::now();
 		auto duration = chrono::duration_cast<chrono::seconds>(e-s);
 
-		// end
-		emap = TIME::get_datetime_map();
+		{
+			ALLOC::Scope scope("work phase commit");
 
-		// record worked time to database
-		TRACKER::update_work_time(sql, to_string(actid), smap, emap,
-				static_cast<unsigned int>(duration.count()));
+			// end
+			emap = TIME::get_datetime_map();
+
+			// record worked time to database
+			TRACKER::update_work_time(storage, to_string(actid), smap, emap,
+					static_cast<unsigned int>(duration.count()));
+		}
 
 		// add to total work time
 		work += static_cast<unsigned int>(duration.count());
+		live.today_hours += TIME::conv_seconds_to_hours(
+				static_cast<unsigned int>(duration.count()));
 
 		// output worked time (in total) thus far
 		cout << fmt::format("Worked for {:02} minutes and {:02} seconds",
@@ -215,10 +392,14 @@ void work(soci::session& sql)
 
 		cout << "Started break timer!" << endl;
 		br = true;
+		live.on_break    = 1;
+		live.phase_start = time(nullptr);
+		STATUS::publisher().publish(live);
 
 		// break time clock cycle (s start, e end)
 		s = chrono::steady_clock::now();
-		timeloopreturn = TRACKER::timeloop(countdown, countdown_seconds, br);
+		timeloopreturn = TRACKER::timeloop(countdown, countdown_seconds, br,
+				actid);
 		e = chrono::steady_clock::now();
 		duration = chrono::duration_cast<chrono::seconds>(e-s);
 
@@ -231,6 +412,13 @@ void work(soci::session& sql)
 
 		if (timeloopreturn == "q") break;
 	}
+
+	// every phase of this session is stored before the summary
+	storage.flush();
+
+	live.activity = 0;
+	STATUS::publisher().publish(live);
+
 	double hours_worked { TIME::conv_seconds_to_hours(work) };
 	double hours_paused { TIME::conv_seconds_to_hours(pause) };
 
@@ -243,7 +431,7 @@ void work(soci::session& sql)
 
 }
 
-void stats(soci::session& sql)
+void stats(STORAGE::Backend& storage)
 {
 	/* prompts user for days X into the past stats should be shown for
 	 * bit complicated:
@@ -263,6 +451,20 @@ void stats(soci::session& sql)
 	int no_of_days;
 	cin >> no_of_days;
 
+	// e.g. "group:2 weekday:mon-fri min:1", see FILTER::Filter
+	cout << "Filter (enter for none): ";
+	string filter_text;
+	cin.ignore(numeric_limits<streamsize>::max(), '\n');
+	getline(cin, filter_text);
+	FILTER::Filter filter;
+	try {
+		filter = FILTER::compile(filter_text);
+	}
+	catch (runtime_error const& e) {
+		cout << e.what() << ", back to menu!" << endl << endl;
+		return;
+	}
+
 	vector<string> dates;
 
 	auto tp_date = chrono::system_clock::now();					// current date
@@ -279,8 +481,7 @@ void stats(soci::session& sql)
 	local_time->tm_mday = dd;
 	local_time->tm_mday -= 1; // start from yesterday
 
-	string oldestdatefromdb;
-	sql << "SELECT MIN(date) FROM history", soci::into(oldestdatefromdb);
+	string oldestdatefromdb { storage.oldest_date() };
 
 	for (int i = 0; i < no_of_days; ++i) {
 
@@ -304,25 +505,62 @@ void stats(soci::session& sql)
 
 	cout << endl;
 
-	SQL::print_stats(sql, SQL::get_dates_data(sql, dates), no_of_days);
+	// dates run backwards from yesterday, so the range is back() to front()
+	if (!dates.empty()) {
+		ALLOC::Scope scope("stats report");
+		SQL::print_stats(storage, dates.back(), dates.front(), filter);
+	}
+
+	return;
+}
+
+void heatmap(STORAGE::Backend& storage)
+{
+	/* prompts for a range of years and shows when in the week time was
+	 * tracked in those years (from the recorded work phases), plus the daily
+	 * totals of the last year of the range
+	 */
+	int this_year = stoi(TIME::get_datetime_map()["year"]);
+
+	cout << "Heatmap from year (yyyy): ";
+	int first_year;
+	cin >> first_year;
+
+	cout << "to year (yyyy, 0 for this year): ";
+	int last_year;
+	cin >> last_year;
+
+	if (last_year == 0) {
+		last_year = this_year;
+	}
+	if (first_year > last_year) {
+		swap(first_year, last_year);
+	}
+
+	SQL::print_heatmap(storage, first_year, last_year);
 
 	return;
 }
 
-void configure(soci::session& sql)
+void configure(soci::session* sql, WRITER::Thread* db,
+		STORAGE::Backend& storage)
 {
 	/* let's user add, deactivte, reactivate (already deactiviated) activities
 	 * `is_activated` is a column in the activities table (int) to represent
 	 * the activation status
 	 */
 
-	SQL::print_activities(sql, true);
+	SQL::print_activities(storage, true);
 
 	cout << 
 		"Options: \n"
 		"(a)dd new\n"
 		"(d)eactivate\n"
 		"(r)eactivate\n"
+		"(n)ew group\n"
+		"(m)ove group\n"
+		"(g)oals\n"
+		"(k)eep daily history for N years\n"
 		"(q)uit\n";
 
 	cout << "Choose: ";
@@ -339,13 +577,10 @@ void configure(soci::session& sql)
 		cin >> group;
 
 		string date = TIME::get_date_string();
-		sql <<
-			"INSERT INTO activities "
-			"(name, group_id, added_when) "
-			"VALUES (:name, :groupid, :added)",
-			soci::use(name),
-			soci::use(group),
-			soci::use(date);
+		storage.add_activity(name, stoi(group), date);
+
+		// so goals of its group count it
+		GOALS::progress().rebuild(storage);
 	}
 	else if (choice == "d")
 	{
@@ -353,9 +588,7 @@ void configure(soci::session& sql)
 		string id;
 		cin >> id;
 
-		sql <<
-			"UPDATE activities SET is_activated = 0 WHERE id = :id",
-			soci::use(id);
+		storage.set_activated(stoi(id), false);
 	}
 	else if (choice == "r")
 	{
@@ -363,9 +596,54 @@ void configure(soci::session& sql)
 		string id;
 		cin >> id;
 
-		sql <<
-			"UPDATE activites SET is_activated = 1 WHERE id = :id",
-			soci::use(id);
+		storage.set_activated(stoi(id), true);
+	}
+	else if (choice == "n" || choice == "m")
+	{
+		SQL::print_groups(storage);
+
+		string name;
+		int id {};
+		if (choice == "n") {
+			cout << "Enter group name: ";
+			cin >> name;
+		}
+		else {
+			cout << "Enter group id: ";
+			cin >> id;
+		}
+		cout << "Enter parent group id (0 for none): ";
+		int parent;
+		cin >> parent;
+
+		// a wrong parent (unknown or inside the moved subtree) is refused
+		try {
+			if (choice == "n") {
+				storage.add_group(name, parent);
+			}
+			else {
+				storage.move_group(id, parent);
+			}
+		}
+		catch (runtime_error const& e) {
+			cout << e.what() << endl;
+		}
+	}
+	else if (choice == "g")
+	{
+		goals(storage);
+	}
+	else if (choice == "k" && sql)
+	{
+		cout << fmt::format(
+				"Daily history kept for {} years (0 is forever)\n"
+				"Enter years: ",
+				db->call([sql]() { return RETENTION::get_years(*sql); }).get());
+		int years;
+		cin >> years;
+
+		// older days get folded into monthly sums bit by bit in the background
+		db->call([sql, years]() { RETENTION::set_years(*sql, years); }).get();
 	}
 	else if (choice == "q")
 	{
@@ -378,9 +656,9 @@ void configure(soci::session& sql)
 	return;
 }
 
-void manual(soci::session& sql)
+void manual(STORAGE::Backend& storage)
 {
-	SQL::print_activities(sql, false);
+	SQL::print_activities(storage, false);
 
 	cout << "For which activity id do you want to enter a time: ";
 	string id;
@@ -394,7 +672,128 @@ void manual(soci::session& sql)
 	double hours;
 	cin >> hours;
 
-	SQL::enter_work_time(sql, id, date, hours);
+	// goals and range totals count it once it's stored, at the next prompt
+	storage.add_hours(stoi(id), date, hours);
+
+	return;
+}
+
+void goals(STORAGE::Backend& storage)
+{
+	/* lists the goals with their progress in the current period, then lets
+	 * the user set (add or change) or remove one
+	 */
+	for (GOALS::Progress::Line const& line : GOALS::progress().lines()) {
+		cout << fmt::format("ID {}: {} {} per {}: {:.1f} of {:.1f} hours\n",
+				line.goal.id, line.goal.group ? "group" : "activity",
+				line.goal.target, GOALS::period_name(line.goal.period),
+				line.done, line.goal.hours);
+	}
+
+	cout <<
+		"Options: \n"
+		"(s)et goal\n"
+		"(r)emove goal\n"
+		"(q)uit\n"
+		"Choose: ";
+	string choice;
+	cin >> choice;
+
+	if (choice == "s")
+	{
+		GOALS::Goal goal {};
+		string scope, period;
+
+		cout << "For an (a)ctivity or a (g)roup: ";
+		cin >> scope;
+		goal.group = scope == "g";
+
+		cout << (goal.group ? "Enter group: " : "Enter activity id: ");
+		cin >> goal.target;
 
+		cout << "Per (d)ay, (w)eek or (m)onth: ";
+		cin >> period;
+		goal.period =
+			period == "d" ? GOALS::Period::day :
+			period == "w" ? GOALS::Period::week : GOALS::Period::month;
+
+		cout << "Enter hours (double): ";
+		cin >> goal.hours;
+
+		// another user's activity is refused
+		try {
+			storage.set_goal(goal);
+		}
+		catch (runtime_error const& e) {
+			cout << e.what() << endl;
+			return;
+		}
+	}
+	else if (choice == "r")
+	{
+		cout << "Enter goal id: ";
+		int id;
+		cin >> id;
+
+		// so is another user's goal
+		try {
+			storage.remove_goal(id);
+		}
+		catch (runtime_error const& e) {
+			cout << e.what() << endl;
+			return;
+		}
+	}
+	else
+	{
+		return;
+	}
+
+	GOALS::progress().rebuild(storage);
 	return;
 }
+
+void status(void)
+{
+	/* one line for status bars and prompts, from the segment the timer of
+	 * a running tracker publishes (see STATUS)
+	 */
+	STATUS::Reader reader;
+	STATUS::Snapshot s;
+	long long const now { time(nullptr) };
+
+	if (!reader.read(s) || s.activity == 0 ||
+			now - s.heartbeat > STATUS::STALE_AFTER) {
+		cout << "not tracking" << endl;
+		return;
+	}
+
+	long long const elapsed { max(0LL, now - s.phase_start) };
+	double today { s.today_hours };
+	if (!s.on_break) {
+		today += static_cast<double>(elapsed) / 3600;
+	}
+
+	cout << fmt::format("{} {:02}:{:02}:{:02} (today {})\n",
+			s.on_break ? "break" : s.name, elapsed / 3600,
+			(elapsed % 3600) / 60, elapsed % 60,
+			TIME::conv_hours_to_timestring(today));
+}
+
+void failed_writes(WRITER::Thread* db)
+{
+	/* prints what went wrong with writes handed to the db thread since the
+	 * last prompt; each of them was rolled back, the session goes on
+	 */
+	if (!db) {
+		return;
+	}
+	for (exception_ptr const& failure : db->take_failures()) {
+		try {
+			rethrow_exception(failure);
+		}
+		catch (const exception& e) {
+			cout << "Not stored: " << e.what() << endl << endl;
+		}
+	}
+}
@@ -0,0 +1,236 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <soci/soci.h>
+#include <fmt/core.h>
+
+#include "./retention.hpp"
+#include "./schema.hpp"
+#include "./sql.hpp"
+#include "./time.hpp"
+
+using namespace std;
+
+namespace RETENTION
+{
+    // free pages handed back per incremental_vacuum statement
+    static constexpr int VACUUM_PAGES { 256 };
+
+    string compacted_before(soci::session& sql)
+    {
+        string date;
+        sql << "SELECT value FROM meta WHERE key = 'compacted_before'",
+            soci::into(date);
+        return date;
+    }
+
+    string next_month(string const& month)
+    {
+        // "yyyy-mm" -> first day of the following month
+        int y { stoi(month.substr(0, 4)) };
+        int m { stoi(month.substr(5, 2)) + 1 };
+        if (m == 13) {
+            m = 1;
+            ++y;
+        }
+        return fmt::format("{:04}-{:02}-01", y, m);
+    }
+
+    static long long pragma(soci::session& sql, string const& name)
+    {
+        long long value {};
+        sql << "PRAGMA " + name, soci::into(value);
+        return value;
+    }
+
+    int get_years(soci::session& sql)
+    {
+        int years {};
+        sql << "SELECT value FROM meta WHERE key = 'retention_years'",
+            soci::into(years);
+        return years;
+    }
+
+    void set_years(soci::session& sql, int const years)
+    {
+        if (years < 0) {
+            throw runtime_error("retention can't be negative");
+        }
+
+        // 2 is INCREMENTAL; switching an existing file needs a full VACUUM
+        if (years > 0 && pragma(sql, "auto_vacuum") != 2)
+        {
+            cout << "Preparing db for incremental vacuum (one time)..." << endl;
+            sql << "PRAGMA auto_vacuum = INCREMENTAL";
+            sql << "VACUUM";
+        }
+
+        sql << "UPDATE meta SET value = :years WHERE key = 'retention_years'",
+            soci::use(years);
+    }
+
+    static size_t fold_month(soci::session& sql, string const& first)
+    {
+        /* moves the daily rows of the month starting at first into one row
+         * per activity; sums move as they are, so activities.hours_total
+         * stays exact, and no history trigger fires (rows are only deleted)
+         * the change log of SYNC gets folded the same way and the month's
+         * segments are dropped, so no table keeps a row per day
+         */
+        string const month { first.substr(0, 7) };
+        string const next { next_month(month) };
+        // deletes get through a sealed partition, only its rows can't change
+        string const table {
+            SCHEMA::partition_table(stoi(month.substr(0, 4))) };
+
+        soci::transaction tr(sql);
+
+        int rows {};
+        sql <<
+            "SELECT COUNT(*) FROM " + table + " "
+            "WHERE date >= :first AND date < :next",
+            soci::use(first), soci::use(next), soci::into(rows);
+
+        sql <<
+            "INSERT INTO history_monthly "
+            "(date, id_activity, hours_on_month, active_days, user_id) "
+            "SELECT :first, id_activity, SUM(hours_on_day), "
+            "SUM(hours_on_day > 0), "
+            "(SELECT user_id FROM activities WHERE id = id_activity) "
+            "FROM " + table + " "
+            "WHERE date >= :first2 AND date < :next "
+            "GROUP BY id_activity "
+            "ON CONFLICT (date, id_activity) DO UPDATE SET "
+            "hours_on_month = hours_on_month + excluded.hours_on_month, "
+            "active_days = active_days + excluded.active_days",
+            soci::use(first), soci::use(first), soci::use(next);
+
+        sql <<
+            "DELETE FROM " + table + " "
+            "WHERE date >= :first AND date < :next",
+            soci::use(first), soci::use(next);
+
+        // one contribution per replica and activity, keyed "yyyy-mm"
+        // (sorts before the month's days, see SYNC); a pull only needs
+        // the folded row if it hasn't seen all of the days, so it keeps
+        // their newest seq
+        sql <<
+            "INSERT INTO contributions "
+            "(origin, activity_uuid, date, hours, seq) "
+            "SELECT origin, activity_uuid, :month, SUM(hours), MAX(seq) "
+            "FROM contributions WHERE date >= :first AND date < :next "
+            "GROUP BY origin, activity_uuid "
+            "ON CONFLICT (origin, activity_uuid, date) DO UPDATE SET "
+            "hours = hours + excluded.hours, seq = MAX(seq, excluded.seq)",
+            soci::use(month), soci::use(first), soci::use(next);
+
+        sql <<
+            "DELETE FROM contributions WHERE date >= :first AND date < :next",
+            soci::use(first), soci::use(next);
+
+        long long const from { TIME::conv_datetime_to_epoch(first,
+                "00:00:00") };
+        long long const to { TIME::conv_datetime_to_epoch(next, "00:00:00") };
+        sql << "DELETE FROM segments WHERE start >= :from AND start < :to",
+            soci::use(from), soci::use(to);
+
+        sql <<
+            "UPDATE meta SET value = :next "
+            "WHERE key = 'compacted_before' AND value < :next2",
+            soci::use(next), soci::use(next);
+
+        // the month's days now all sit on its first day
+        SQL::invalidate_stats(sql, first, TIME::conv_epoch_day_to_date(
+                    TIME::conv_date_to_epoch_day(next) - 1));
+
+        tr.commit();
+
+        return static_cast<size_t>(rows);
+    }
+
+    Step step(soci::session& sql, chrono::milliseconds const budget)
+    {
+        auto const start { chrono::steady_clock::now() };
+        auto const in_budget = [&start, &budget]() {
+            return chrono::steady_clock::now() - start < budget;
+        };
+
+        Step result;
+
+        int const years { get_years(sql) };
+        if (years == 0) {
+            result.done = true;
+            return result;
+        }
+
+        unordered_map<string, string> now { TIME::get_datetime_map() };
+        string const cutoff { fmt::format("{:04}-{}-01",
+                stoi(now["year"]) - years, now["month"]) };
+
+        // 2 is INCREMENTAL, other dbs keep their free pages for reuse
+        bool const vacuum { pragma(sql, "auto_vacuum") == 2 };
+        long long const page_size { pragma(sql, "page_size") };
+
+        while (in_budget())
+        {
+            // pages freed by the last fold go back first, a slice at a time
+            long long const free_pages {
+                vacuum ? pragma(sql, "freelist_count") : 0 };
+
+            if (free_pages > 0)
+            {
+                sql << "PRAGMA incremental_vacuum(" +
+                    to_string(VACUUM_PAGES) + ")";
+
+                long long const left { pragma(sql, "freelist_count") };
+                result.reclaimed += (free_pages - left) * page_size;
+                if (left >= free_pages) {
+                    break;
+                }
+                continue;
+            }
+
+            string const oldest { SQL::oldest_day(sql) };
+
+            if (oldest.empty() || oldest >= cutoff) {
+                result.done = true;
+                break;
+            }
+
+            result.rows += fold_month(sql, oldest.substr(0, 7) + "-01");
+            ++result.months;
+        }
+
+        return result;
+    }
+
+    bool is_compacted(soci::session& sql, string const& date)
+    {
+        return date < compacted_before(sql);
+    }
+
+    bool add_to_month(
+            soci::session& sql,
+            int const id,
+            string const& date,
+            double const hours)
+    {
+        if (!is_compacted(sql, date)) {
+            return false;
+        }
+
+        string const first { date.substr(0, 7) + "-01" };
+        sql <<
+            "INSERT INTO history_monthly "
+            "(date, id_activity, hours_on_month, active_days, user_id) "
+            "VALUES (:first, :id, :hours, 1, "
+            "(SELECT user_id FROM activities WHERE id = :id)) "
+            "ON CONFLICT (date, id_activity) DO UPDATE SET "
+            "hours_on_month = hours_on_month + excluded.hours_on_month",
+            soci::use(first), soci::use(id), soci::use(hours);
+
+        SQL::invalidate_stats(sql, first);
+        return true;
+    }
+}
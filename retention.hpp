@@ -0,0 +1,54 @@
+#pragma once
+#include <soci/soci.h>
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace RETENTION {
+
+    // what one call of step() got done
+    struct Step
+    {
+        std::size_t months      {}; // months folded into history_monthly
+        std::size_t rows        {}; // daily rows they had
+        long long   reclaimed   {}; // bytes given back to the file system
+        bool        done        {}; // nothing left to do for now
+    };
+
+    // years of daily history kept, 0 means forever
+    int  get_years(soci::session& sql);
+
+    /* sets the retention window; the first time retention gets enabled on a
+     * db created without incremental auto vacuum, the file is vacuumed once
+     */
+    void set_years(soci::session& sql, int const years);
+
+    /* folds the oldest month that's outside the retention window into
+     * history_monthly, month after month, each followed by an incremental
+     * vacuum of the pages it freed, returns once budget is used up
+     * meant to be called often (e.g. before every menu prompt): a month is
+     * one short transaction, so a call never runs much longer than budget
+     */
+    Step step(soci::session& sql, std::chrono::milliseconds const budget);
+
+    /* first day of the oldest month still kept day by day, empty if
+     * nothing was compacted
+     */
+    std::string compacted_before(soci::session& sql);
+
+    // "yyyy-mm" -> first day of the following month
+    std::string next_month(std::string const& month);
+
+    // true if date lies in a month that only exists in history_monthly
+    bool is_compacted(soci::session& sql, std::string const& date);
+
+    /* adds hours of date to its month in history_monthly if date is
+     * compacted, returns false (and writes nothing) otherwise
+     */
+    bool add_to_month(
+            soci::session& sql,
+            int const id,
+            std::string const& date,
+            double const hours);
+}
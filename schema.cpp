@@ -0,0 +1,765 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <soci/soci.h>
+
+#include "./schema.hpp"
+#include "./time.hpp"
+
+using namespace std;
+
+namespace SCHEMA
+{
+    /* ordered list of migrations, migration N takes the db from version N-1
+     * to N; never edit one that shipped, append a new one instead
+     */
+    struct Migration
+    {
+        int version;
+        char const* description;
+        void (*apply)(soci::session& sql);
+    };
+
+    static void create_tables(soci::session& sql)
+    {
+        // create activities table
+        sql <<
+            "CREATE TABLE activities ("
+            "id INTEGER PRIMARY KEY, " // PRIMARY implies NOT NULL and UNIQUE
+            "group_id INTEGER NOT NULL, "
+            "name TEXT NOT NULL, "
+            "added_when TEXT NOT NULL, "
+            "is_activated INTEGER NOT NULL DEFAULT 1, "
+            "hours_total NUMERIC NOT NULL DEFAULT 0.0"
+            ");";
+
+        // create history table
+        sql << 
+            "CREATE TABLE history ("
+            "id_activity INTEGER NOT NULL, "
+            "year INTEGER NOT NULL, "
+            "month INTEGER NOT NULL, "
+            "day INTEGER NOT NULL, "
+            "weeknumber INTEGER NOT NULL, "
+            "hours_on_day NUMERIC NOT NULL DEFAULT 0.0, "
+            "date TEXT NOT NULL, " // simplifies some SQL queries
+            "FOREIGN KEY (id_activity) REFERENCES activities(id)"
+            ");";
+    }
+
+    static void create_history_indexes(soci::session& sql)
+    {
+        // stats range scans: covering, the table itself is never touched
+        sql <<
+            "CREATE INDEX IF NOT EXISTS history_date "
+            "ON history (date, id_activity, hours_on_day)";
+
+        // lookup of an activity's row for a day when time gets committed
+        sql <<
+            "CREATE INDEX IF NOT EXISTS history_activity_date "
+            "ON history (id_activity, date)";
+    }
+
+    static void create_segments(soci::session& sql)
+    {
+        /* raw work phases next to the daily sums in history
+         * start is unix time in seconds; a phase running past midnight is
+         * stored as two segments, so no segment is longer than a day
+         * WITHOUT ROWID + primary key on time keeps rows clustered by start,
+         * range scans read the table b-tree directly (covering by design)
+         */
+        sql <<
+            "CREATE TABLE segments ("
+            "start INTEGER NOT NULL, "
+            "id_activity INTEGER NOT NULL, "
+            "duration INTEGER NOT NULL, "
+            "PRIMARY KEY (start, id_activity), "
+            "FOREIGN KEY (id_activity) REFERENCES activities(id)"
+            ") WITHOUT ROWID";
+    }
+
+    static void log_history(soci::session& sql, string const& table)
+    {
+        // history triggers add the change in hours to this replica's share
+        for (auto const& [name, event, delta] : {
+                tuple<string, string, string> { table + "_log_insert",
+                    "INSERT", "NEW.hours_on_day" },
+                tuple<string, string, string> { table + "_log_update",
+                    "UPDATE OF hours_on_day",
+                    "NEW.hours_on_day - OLD.hours_on_day" } })
+        {
+            sql <<
+                "CREATE TRIGGER " + name + " AFTER " + event + " ON " +
+                table + " "
+                "WHEN (SELECT value FROM meta WHERE key = 'applying_sync') = 0 "
+                "BEGIN "
+                "UPDATE meta SET value = value + 1 WHERE key = 'seq'; "
+                "INSERT INTO contributions "
+                "(origin, activity_uuid, date, hours, seq) VALUES ("
+                "(SELECT value FROM meta WHERE key = 'replica_id'), "
+                "(SELECT uuid FROM activities WHERE id = NEW.id_activity), "
+                "NEW.date, " + delta + ", "
+                "(SELECT value FROM meta WHERE key = 'seq')) "
+                "ON CONFLICT (origin, activity_uuid, date) DO UPDATE SET "
+                "hours = hours + excluded.hours, seq = excluded.seq; "
+                "END";
+        }
+    }
+
+    static void create_change_log(soci::session& sql)
+    {
+        /* bookkeeping for SYNC, see sync.cpp for how it's used
+         * -) meta: this db's replica id, the change sequence counter and a
+         *    flag set while SYNC applies remote changes
+         * -) activities get a stable uuid plus the seq/time of their last
+         *    change
+         * -) contributions: hours each replica (origin) added per activity
+         *    and day, history.hours_on_day is their sum; seq is the local
+         *    change sequence number of the row's last change
+         * -) sync_peers: last seq of each peer that has been pulled
+         * triggers keep all of it up to date for every write to activities
+         * and history, whichever code (or hand written SQL) does it
+         */
+        sql <<
+            "CREATE TABLE meta ("
+            "key TEXT PRIMARY KEY, "
+            "value NOT NULL"
+            ")";
+        sql <<
+            "INSERT INTO meta (key, value) VALUES "
+            "('replica_id', lower(hex(randomblob(16)))), "
+            "('seq', 1), "
+            "('applying_sync', 0)";
+
+        sql << "ALTER TABLE activities ADD COLUMN uuid TEXT";
+        sql << "ALTER TABLE activities ADD COLUMN seq INTEGER NOT NULL "
+               "DEFAULT 0";
+        sql << "ALTER TABLE activities ADD COLUMN changed_at INTEGER NOT NULL "
+               "DEFAULT 0";
+        sql <<
+            "UPDATE activities SET uuid = lower(hex(randomblob(16))), seq = 1, "
+            "changed_at = CAST(strftime('%s', 'now') AS INTEGER)";
+        sql << "CREATE UNIQUE INDEX activities_uuid ON activities (uuid)";
+        sql << "CREATE INDEX activities_seq ON activities (seq)";
+
+        sql <<
+            "CREATE TABLE contributions ("
+            "origin TEXT NOT NULL, "
+            "activity_uuid TEXT NOT NULL, "
+            "date TEXT NOT NULL, "
+            "hours REAL NOT NULL, "
+            "seq INTEGER NOT NULL, "
+            "PRIMARY KEY (origin, activity_uuid, date)"
+            ") WITHOUT ROWID";
+        sql << "CREATE INDEX contributions_seq ON contributions (seq)";
+
+        // everything tracked so far was tracked here
+        sql <<
+            "INSERT INTO contributions "
+            "(origin, activity_uuid, date, hours, seq) "
+            "SELECT (SELECT value FROM meta WHERE key = 'replica_id'), "
+            "activities.uuid, history.date, SUM(history.hours_on_day), 1 "
+            "FROM history INNER JOIN activities "
+            "ON activities.id = history.id_activity "
+            "GROUP BY activities.uuid, history.date";
+
+        sql <<
+            "CREATE TABLE sync_peers ("
+            "replica TEXT PRIMARY KEY, "
+            "pulled_seq INTEGER NOT NULL"
+            ")";
+
+        sql <<
+            "CREATE TRIGGER activities_log_insert AFTER INSERT ON activities "
+            "WHEN (SELECT value FROM meta WHERE key = 'applying_sync') = 0 "
+            "BEGIN "
+            "UPDATE meta SET value = value + 1 WHERE key = 'seq'; "
+            "UPDATE activities SET "
+            "uuid = COALESCE(NEW.uuid, lower(hex(randomblob(16)))), "
+            "seq = (SELECT value FROM meta WHERE key = 'seq'), "
+            "changed_at = CAST(strftime('%s', 'now') AS INTEGER) "
+            "WHERE id = NEW.id; "
+            "END";
+        sql <<
+            "CREATE TRIGGER activities_log_update "
+            "AFTER UPDATE OF group_id, name, is_activated ON activities "
+            "WHEN (SELECT value FROM meta WHERE key = 'applying_sync') = 0 "
+            "BEGIN "
+            "UPDATE meta SET value = value + 1 WHERE key = 'seq'; "
+            "UPDATE activities SET "
+            "seq = (SELECT value FROM meta WHERE key = 'seq'), "
+            "changed_at = CAST(strftime('%s', 'now') AS INTEGER) "
+            "WHERE id = NEW.id; "
+            "END";
+
+        log_history(sql, "history");
+    }
+
+    static void create_history_monthly(soci::session& sql)
+    {
+        /* daily history rows older than the retention window get folded into
+         * one row per activity and month (date is the first of the month),
+         * see RETENTION::step
+         */
+        sql <<
+            "CREATE TABLE history_monthly ("
+            "date TEXT NOT NULL, "
+            "id_activity INTEGER NOT NULL, "
+            "hours_on_month NUMERIC NOT NULL DEFAULT 0.0, "
+            "active_days INTEGER NOT NULL DEFAULT 0, "
+            "PRIMARY KEY (date, id_activity)"
+            ") WITHOUT ROWID";
+
+        // 0 keeps daily rows forever; months before compacted_before are
+        // only in history_monthly
+        sql <<
+            "INSERT INTO meta (key, value) VALUES "
+            "('retention_years', 0), "
+            "('compacted_before', '')";
+    }
+
+    static void create_goals(soci::session& sql)
+    {
+        /* target hours per day, week or month for one activity or one
+         * group, see GOALS::Progress
+         */
+        sql <<
+            "CREATE TABLE goals ("
+            "id INTEGER PRIMARY KEY, "
+            "scope TEXT NOT NULL CHECK (scope IN ('activity', 'group')), "
+            "target_id INTEGER NOT NULL, "
+            "period TEXT NOT NULL CHECK (period IN ('day', 'week', 'month')), "
+            "hours REAL NOT NULL, "
+            "UNIQUE (scope, target_id, period)"
+            ")";
+    }
+
+    static void cover_weeknumber(soci::session& sql)
+    {
+        // filtered stats scans (FILTER) also read weeknumber, keep them
+        // on the covering index
+        sql << "DROP INDEX IF EXISTS history_date";
+        sql <<
+            "CREATE INDEX history_date "
+            "ON history (date, id_activity, hours_on_day, weeknumber)";
+    }
+
+    static void create_group_tree(soci::session& sql)
+    {
+        /* groups nest (client -> project -> task); group_closure has a row
+         * for every (ancestor, descendant) pair, a group being its own
+         * ancestor at depth 0, so a subtree is one indexed lookup
+         * hours_total of a group is the rollup of its whole subtree, kept
+         * up to date by the triggers below whenever an activity's total
+         * changes, whichever way it gets written (commits, manual entries,
+         * sync)
+         */
+        sql <<
+            "CREATE TABLE activity_groups ("
+            "id INTEGER PRIMARY KEY, "
+            "name TEXT NOT NULL, "
+            "parent_id INTEGER REFERENCES activity_groups (id), "
+            "hours_total REAL NOT NULL DEFAULT 0"
+            ")";
+        sql <<
+            "CREATE TABLE group_closure ("
+            "ancestor INTEGER NOT NULL, "
+            "descendant INTEGER NOT NULL, "
+            "depth INTEGER NOT NULL, "
+            "PRIMARY KEY (ancestor, descendant)"
+            ") WITHOUT ROWID";
+        sql <<
+            "CREATE INDEX group_closure_descendant "
+            "ON group_closure (descendant, ancestor)";
+
+        sql <<
+            "CREATE TRIGGER group_closure_insert AFTER INSERT ON activity_groups "
+            "BEGIN "
+            "INSERT INTO group_closure (ancestor, descendant, depth) "
+            "SELECT NEW.id, NEW.id, 0 "
+            "UNION ALL "
+            "SELECT ancestor, NEW.id, depth + 1 FROM group_closure "
+            "WHERE descendant = NEW.parent_id; "
+            "END";
+
+        // moving a subtree: its totals leave the old ancestors (those of the
+        // old parent, the subtree's own paths are kept) and go to the new
+        sql <<
+            "CREATE TRIGGER group_closure_cycle "
+            "BEFORE UPDATE OF parent_id ON activity_groups "
+            "WHEN NEW.parent_id IN "
+            "(SELECT descendant FROM group_closure WHERE ancestor = NEW.id) "
+            "BEGIN "
+            "SELECT RAISE(ABORT, 'a group can not be moved into its own "
+            "subtree'); "
+            "END";
+        sql <<
+            "CREATE TRIGGER group_closure_move "
+            "AFTER UPDATE OF parent_id ON activity_groups "
+            "BEGIN "
+            "UPDATE activity_groups SET hours_total = "
+            "hours_total - NEW.hours_total WHERE id IN "
+            "(SELECT ancestor FROM group_closure "
+            "WHERE descendant = OLD.parent_id); "
+            "DELETE FROM group_closure WHERE descendant IN "
+            "(SELECT descendant FROM group_closure WHERE ancestor = NEW.id) "
+            "AND ancestor NOT IN "
+            "(SELECT descendant FROM group_closure WHERE ancestor = NEW.id); "
+            "INSERT INTO group_closure (ancestor, descendant, depth) "
+            "SELECT p.ancestor, s.descendant, p.depth + s.depth + 1 "
+            "FROM group_closure AS p, group_closure AS s "
+            "WHERE p.descendant = NEW.parent_id AND s.ancestor = NEW.id; "
+            "UPDATE activity_groups SET hours_total = "
+            "hours_total + NEW.hours_total WHERE id IN "
+            "(SELECT ancestor FROM group_closure "
+            "WHERE descendant = NEW.parent_id); "
+            "END";
+
+        // an activity's group comes into being with it, as a root
+        sql <<
+            "CREATE TRIGGER activities_rollup_insert AFTER INSERT ON activities "
+            "BEGIN "
+            "INSERT OR IGNORE INTO activity_groups (id, name) "
+            "VALUES (NEW.group_id, 'Group ' || NEW.group_id); "
+            "UPDATE activity_groups SET hours_total = "
+            "hours_total + NEW.hours_total WHERE id IN "
+            "(SELECT ancestor FROM group_closure "
+            "WHERE descendant = NEW.group_id); "
+            "END";
+        sql <<
+            "CREATE TRIGGER activities_rollup_update "
+            "AFTER UPDATE OF hours_total, group_id ON activities "
+            "BEGIN "
+            "INSERT OR IGNORE INTO activity_groups (id, name) "
+            "VALUES (NEW.group_id, 'Group ' || NEW.group_id); "
+            "UPDATE activity_groups SET hours_total = "
+            "hours_total - OLD.hours_total WHERE id IN "
+            "(SELECT ancestor FROM group_closure "
+            "WHERE descendant = OLD.group_id); "
+            "UPDATE activity_groups SET hours_total = "
+            "hours_total + NEW.hours_total WHERE id IN "
+            "(SELECT ancestor FROM group_closure "
+            "WHERE descendant = NEW.group_id); "
+            "END";
+
+        // the flat groups so far become roots
+        sql <<
+            "INSERT INTO activity_groups (id, name, hours_total) "
+            "SELECT group_id, 'Group ' || group_id, SUM(hours_total) "
+            "FROM activities GROUP BY group_id";
+    }
+
+    static void create_users(soci::session& sql)
+    {
+        /* several people in one db: activities belong to a user, history
+         * rows carry the user of their activity so a user's range scan
+         * stays within that user's part of history_user_date
+         * everything tracked so far belongs to user 1
+         */
+        sql <<
+            "CREATE TABLE users ("
+            "id INTEGER PRIMARY KEY, "
+            "name TEXT NOT NULL UNIQUE"
+            ")";
+        sql << "INSERT INTO users (id, name) VALUES (1, 'default')";
+
+        sql << "ALTER TABLE activities ADD COLUMN user_id INTEGER NOT NULL "
+               "DEFAULT 1";
+        sql << "CREATE INDEX activities_user ON activities (user_id)";
+
+        sql << "ALTER TABLE history ADD COLUMN user_id INTEGER";
+        sql << "UPDATE history SET user_id = 1";
+        sql <<
+            "CREATE INDEX history_user_date "
+            "ON history (user_id, date, id_activity, hours_on_day, "
+            "weeknumber)";
+
+        // whoever inserts a day doesn't have to know about users
+        sql <<
+            "CREATE TRIGGER history_user AFTER INSERT ON history "
+            "WHEN NEW.user_id IS NULL "
+            "BEGIN "
+            "UPDATE history SET user_id = "
+            "(SELECT user_id FROM activities WHERE id = NEW.id_activity) "
+            "WHERE rowid = NEW.rowid; "
+            "END";
+    }
+
+    static void scope_goals(soci::session& sql)
+    {
+        /* goals belong to a user like activities do (those so far to user
+         * 1), each user has their own per target and period
+         * history inserts set user_id themselves, the trigger of version 9
+         * cost every new day an UPDATE of the row just inserted
+         */
+        sql << "DROP TRIGGER IF EXISTS history_user";
+
+        sql << "ALTER TABLE goals RENAME TO goals_shared";
+        sql <<
+            "CREATE TABLE goals ("
+            "id INTEGER PRIMARY KEY, "
+            "user_id INTEGER NOT NULL DEFAULT 1, "
+            "scope TEXT NOT NULL CHECK (scope IN ('activity', 'group')), "
+            "target_id INTEGER NOT NULL, "
+            "period TEXT NOT NULL CHECK (period IN ('day', 'week', 'month')), "
+            "hours REAL NOT NULL, "
+            "UNIQUE (user_id, scope, target_id, period)"
+            ")";
+        sql <<
+            "INSERT INTO goals (id, scope, target_id, period, hours) "
+            "SELECT id, scope, target_id, period, hours FROM goals_shared";
+        sql << "DROP TABLE goals_shared";
+    }
+
+    static void user_monthly(soci::session& sql)
+    {
+        /* folded months carry the user of their activity like daily rows
+         * do, so a user's scan of them stays within that user's part of
+         * history_monthly_user_date instead of joining every user's months
+         */
+        sql << "ALTER TABLE history_monthly RENAME TO history_monthly_shared";
+        sql <<
+            "CREATE TABLE history_monthly ("
+            "date TEXT NOT NULL, "
+            "id_activity INTEGER NOT NULL, "
+            "hours_on_month NUMERIC NOT NULL DEFAULT 0.0, "
+            "active_days INTEGER NOT NULL DEFAULT 0, "
+            "user_id INTEGER NOT NULL DEFAULT 1, "
+            "PRIMARY KEY (date, id_activity)"
+            ") WITHOUT ROWID";
+        sql <<
+            "INSERT INTO history_monthly "
+            "(date, id_activity, hours_on_month, active_days, user_id) "
+            "SELECT m.date, m.id_activity, m.hours_on_month, m.active_days, "
+            "COALESCE(a.user_id, 1) FROM history_monthly_shared AS m "
+            "LEFT JOIN activities AS a ON a.id = m.id_activity";
+        sql << "DROP TABLE history_monthly_shared";
+        sql <<
+            "CREATE INDEX history_monthly_user_date "
+            "ON history_monthly (user_id, date, id_activity, hours_on_month)";
+    }
+
+    static void fold_change_log(soci::session& sql)
+    {
+        /* months folded before version 12 kept their daily contributions
+         * and segments, RETENTION now folds those along (contributions into
+         * one row per replica, activity and "yyyy-mm"), catch up on them
+         * folding a month reads its contributions by date, which the key
+         * (replica first) can't find without a scan of the table
+         */
+        sql << "CREATE INDEX contributions_date ON contributions (date)";
+
+        string compacted;
+        sql << "SELECT value FROM meta WHERE key = 'compacted_before'",
+            soci::into(compacted);
+        if (compacted.empty()) {
+            return;
+        }
+
+        sql <<
+            "INSERT INTO contributions "
+            "(origin, activity_uuid, date, hours, seq) "
+            "SELECT origin, activity_uuid, substr(date, 1, 7), SUM(hours), "
+            "MAX(seq) FROM contributions "
+            "WHERE date < :compacted AND length(date) = 10 "
+            "GROUP BY origin, activity_uuid, substr(date, 1, 7) "
+            "ON CONFLICT (origin, activity_uuid, date) DO UPDATE SET "
+            "hours = hours + excluded.hours, seq = MAX(seq, excluded.seq)",
+            soci::use(compacted);
+        sql <<
+            "DELETE FROM contributions "
+            "WHERE date < :compacted AND length(date) = 10",
+            soci::use(compacted);
+
+        long long const before { TIME::conv_datetime_to_epoch(compacted,
+                "00:00:00") };
+        sql << "DELETE FROM segments WHERE start < :before",
+            soci::use(before);
+    }
+
+    static void create_partition_table(soci::session& sql,
+            string const& table)
+    {
+        /* history's columns and indexes as of version 12, less
+         * history_activity_date: the lookup of an activity's day is one
+         * of history_date as well (date first), and every index, trigger
+         * and table is parsed again by every new connection
+         */
+        sql <<
+            "CREATE TABLE " + table + " ("
+            "id_activity INTEGER NOT NULL, "
+            "year INTEGER NOT NULL, "
+            "month INTEGER NOT NULL, "
+            "day INTEGER NOT NULL, "
+            "weeknumber INTEGER NOT NULL, "
+            "hours_on_day NUMERIC NOT NULL DEFAULT 0.0, "
+            "date TEXT NOT NULL, "
+            "user_id INTEGER, "
+            "FOREIGN KEY (id_activity) REFERENCES activities(id)"
+            ")";
+        sql <<
+            "CREATE INDEX " + table + "_date "
+            "ON " + table + " (date, id_activity, hours_on_day, weeknumber)";
+        sql <<
+            "CREATE INDEX " + table + "_user_date "
+            "ON " + table + " (user_id, date, id_activity, hours_on_day, "
+            "weeknumber)";
+    }
+
+    static void create_history_view(soci::session& sql)
+    {
+        // history is all partitions one after the other, oldest first
+        string select;
+        for (int const year : partition_years(sql)) {
+            select += string(select.empty() ? "" : " UNION ALL ") +
+                "SELECT * FROM " + partition_table(year);
+        }
+        sql << "DROP VIEW IF EXISTS history";
+        sql << "CREATE VIEW history AS " + select;
+    }
+
+    static void partition_history(soci::session& sql)
+    {
+        /* daily history moves into one table per year, history_yyyy, and
+         * history becomes a view over them for the queries that don't care
+         * about years: a write only touches the b-tree of its year, old
+         * years get sealed (see seal_partitions) and long reports scan
+         * years side by side, one reader each (STATS::collect)
+         * rows are copied before the change log triggers exist, they were
+         * logged when they got written the first time
+         */
+        vector<int> years;
+        soci::rowset<soci::row> rows = (sql.prepare <<
+            "SELECT DISTINCT CAST(substr(date, 1, 4) AS INTEGER) AS year "
+            "FROM history ORDER BY 1");
+        for (soci::row const& row : rows) {
+            years.push_back(row.get<int>("year"));
+        }
+        int const current { stoi(TIME::get_date_string().substr(0, 4)) };
+        if (years.empty() || years.back() < current) {
+            years.push_back(current);
+        }
+
+        for (int const year : years)
+        {
+            string const table { partition_table(year) };
+            string const first { to_string(year) + "-01-01" };
+            string const next  { to_string(year + 1) + "-01-01" };
+            create_partition_table(sql, table);
+            sql <<
+                "INSERT INTO " + table + " "
+                "SELECT id_activity, year, month, day, weeknumber, "
+                "hours_on_day, date, user_id FROM history "
+                "WHERE date >= :first AND date < :next",
+                soci::use(first), soci::use(next);
+            log_history(sql, table);
+        }
+
+        sql << "DROP TABLE history";
+        create_history_view(sql);
+    }
+
+    static Migration const MIGRATIONS[] {
+        { 1, "activities and history tables", create_tables },
+        { 2, "history indexes",               create_history_indexes },
+        { 3, "work phase segments",           create_segments },
+        { 4, "change log for sync",           create_change_log },
+        { 5, "monthly history",               create_history_monthly },
+        { 6, "goals",                         create_goals },
+        { 7, "weeknumber in history index",   cover_weeknumber },
+        { 8, "group tree",                    create_group_tree },
+        { 9, "users",                         create_users },
+        { 10, "goals per user",              scope_goals },
+        { 11, "monthly history per user",    user_monthly },
+        { 12, "monthly change log",          fold_change_log },
+        { 13, "history per year",            partition_history },
+    };
+
+    void apply_pragmas(soci::session& sql)
+    {
+        /* WAL lets readers run during a commit and with synchronous NORMAL
+         * only a checkpoint fsyncs, which is what makes commits cheap;
+         * journal_mode is stored in the file, the rest is per connection
+         */
+        string mode;
+        sql << "PRAGMA journal_mode = WAL", soci::into(mode);
+
+        sql << "PRAGMA synchronous = NORMAL";
+        sql << "PRAGMA foreign_keys = ON";
+        sql << "PRAGMA temp_store = MEMORY";
+        sql << "PRAGMA cache_size = -8192";       // KiB, so 8 MiB
+        sql << "PRAGMA mmap_size = 268435456";    // 256 MiB
+        sql << "PRAGMA busy_timeout = 5000";      // ms
+    }
+
+    int get_version(soci::session& sql)
+    {
+        int version {};
+        sql << "PRAGMA user_version", soci::into(version);
+        return version;
+    }
+
+    bool has_table(soci::session& sql, string const& name)
+    {
+        int count {};
+        sql <<
+            "SELECT COUNT(*) FROM sqlite_master "
+            "WHERE type = 'table' AND name = :name",
+            soci::use(name), soci::into(count);
+        return count == 1;
+    }
+
+    int open(soci::session& sql)
+    {
+        // only takes effect on a new file, before anything (even the WAL
+        // switch) writes to it; older dbs are converted once retention gets
+        // enabled (RETENTION::set_years)
+        if (get_version(sql) == 0 && !has_table(sql, "activities")) {
+            sql << "PRAGMA auto_vacuum = INCREMENTAL";
+        }
+
+        apply_pragmas(sql);
+
+        int version { get_version(sql) };
+
+        if (version > VERSION) {
+            throw runtime_error("db schema version " + to_string(version) +
+                    " is newer than this tracker supports (" +
+                    to_string(VERSION) + ")");
+        }
+
+        // dbs created before versioning have no user_version but do have
+        // the tables of migration 1
+        if (version == 0 && has_table(sql, "activities")) {
+            version = 1;
+        }
+        int const found { version };
+
+        for (Migration const& m : MIGRATIONS)
+        {
+            if (m.version <= version) {
+                continue;
+            }
+
+            cout << "Migrating db to version " << m.version
+                 << " (" << m.description << ")" << endl;
+
+            soci::transaction tr(sql);
+            m.apply(sql);
+            sql << "PRAGMA user_version = " + to_string(m.version);
+            tr.commit();
+
+            version = m.version;
+        }
+
+        // cheap sanity check instead of a full integrity check: only looks
+        // at sqlite_master, which is tiny and already in memory
+        if (!has_table(sql, "activities") || partition_years(sql).empty()) {
+            throw runtime_error("db is missing the activities/history tables");
+        }
+
+        seal_partitions(sql);
+
+        return found;
+    }
+
+    string partition_table(int const year)
+    {
+        return "history_" + to_string(year);
+    }
+
+    vector<int> partition_years(soci::session& sql)
+    {
+        // names sort like their years (four digits each)
+        vector<int> years;
+        soci::rowset<soci::row> rows = (sql.prepare <<
+            "SELECT name FROM sqlite_master WHERE type = 'table' "
+            "AND name GLOB 'history_[0-9][0-9][0-9][0-9]' ORDER BY name");
+        for (soci::row const& row : rows) {
+            years.push_back(stoi(row.get<string>("name").substr(8)));
+        }
+        return years;
+    }
+
+    bool ensure_partition(soci::session& sql, int const year)
+    {
+        string const table { partition_table(year) };
+        if (has_table(sql, table)) {
+            return false;
+        }
+        create_partition_table(sql, table);
+        log_history(sql, table);
+        create_history_view(sql);
+        return true;
+    }
+
+    int sealed_before(void)
+    {
+        // last year stays open for late entries (December, in January)
+        return stoi(TIME::get_date_string().substr(0, 4)) - 1;
+    }
+
+    void seal_partitions(soci::session& sql)
+    {
+        /* partitions of years before sealed_before() refuse inserts and
+         * updates (deletes stay allowed, RETENTION folds rows away); sync
+         * still gets through, a peer may have written there before the
+         * year got sealed on its side
+         * the change log triggers go, sync writes with them switched off
+         * and nothing else writes there anymore
+         * usually nothing to do: the lookup only reads sqlite_master
+         */
+        string const before { partition_table(sealed_before()) };
+        vector<string> open;
+        soci::rowset<soci::row> rows = (sql.prepare <<
+            "SELECT name FROM sqlite_master WHERE type = 'table' "
+            "AND name GLOB 'history_[0-9][0-9][0-9][0-9]' AND name < :before "
+            "AND name || '_sealed_insert' NOT IN "
+            "(SELECT name FROM sqlite_master WHERE type = 'trigger')",
+            soci::use(before));
+        for (soci::row const& row : rows) {
+            open.push_back(row.get<string>("name"));
+        }
+        if (open.empty()) {
+            return;
+        }
+
+        soci::transaction tr(sql);
+        for (string const& table : open)
+        {
+            sql << "DROP TRIGGER IF EXISTS " + table + "_log_insert";
+            sql << "DROP TRIGGER IF EXISTS " + table + "_log_update";
+            for (string const event : { "insert", "update" })
+            {
+                sql <<
+                    "CREATE TRIGGER IF NOT EXISTS " + table + "_sealed_" +
+                    event + " BEFORE " + event + " ON " + table + " "
+                    "WHEN (SELECT value FROM meta "
+                    "WHERE key = 'applying_sync') = 0 "
+                    "BEGIN "
+                    "SELECT RAISE(ABORT, '" + table + " is sealed'); "
+                    "END";
+            }
+        }
+        tr.commit();
+    }
+
+    void ensure_stats_cache(soci::session& sql)
+    {
+        /* persisted blocks of STATS::cache(), see
+         * STORAGE::Sqlite::stats_backing
+         * only derived data, dropping the table is always safe
+         */
+        sql <<
+            "CREATE TABLE IF NOT EXISTS stats_cache ("
+            "granularity INTEGER NOT NULL, "
+            "first_day INTEGER NOT NULL, "
+            "last_day INTEGER NOT NULL, "
+            "shape TEXT NOT NULL, "     // activity and group ids it was built for
+            "data TEXT NOT NULL, "
+            "PRIMARY KEY (granularity, first_day, last_day)"
+            ")";
+    }
+}
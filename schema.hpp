@@ -0,0 +1,45 @@
+#pragma once
+#include <soci/soci.h>
+
+#include <string>
+#include <vector>
+
+namespace SCHEMA {
+
+    // schema version this binary creates and expects (PRAGMA user_version)
+    constexpr int VERSION { 13 };
+
+    /* connection setup done once at startup:
+     * -) applies the pragma profile
+     * -) brings the schema up to VERSION by running the missing migrations
+     * -) checks the required tables are there
+     * -) seals the history partitions of years that got old enough
+     * returns the version the db had when opened (0 for a new, empty db,
+     * 1 for one created before versioning)
+     */
+    int open(soci::session& sql);
+
+    void apply_pragmas(soci::session& sql);
+    int  get_version(soci::session& sql);
+    bool has_table(soci::session& sql, std::string const& name);
+
+    // side tables that only hold derived data are created on first use
+    void ensure_stats_cache(soci::session& sql);
+
+    /* daily history is one table per year, history_yyyy, with history a
+     * view over all of them for queries that don't care about years
+     * writes go through SQL::partition, which creates a year's table the
+     * first time one of its days gets written
+     */
+    std::string partition_table(int const year);
+
+    // years that have a partition, oldest first
+    std::vector<int> partition_years(soci::session& sql);
+
+    // creates history_yyyy (indexes, triggers) unless it's there already
+    bool ensure_partition(soci::session& sql, int const year);
+
+    // partitions of years before this one are sealed (read-only)
+    int  sealed_before(void);
+    void seal_partitions(soci::session& sql);
+}
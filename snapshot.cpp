@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <soci/soci.h>
+#include <fmt/core.h>
+
+#include "./snapshot.hpp"
+#include "./sql.hpp"
+#include "./time.hpp"
+
+using namespace std;
+
+namespace SNAPSHOT
+{
+    static char const MAGIC[8] { "TRKSNAP" };
+
+    static uint64_t fnv1a(char const* data, size_t const size)
+    {
+        uint64_t hash { 14695981039346656037ULL };
+        for (size_t i {}; i < size; ++i)
+        {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    template <typename T>
+    static void append(string& body, T const* items, size_t const n)
+    {
+        body.append(reinterpret_cast<char const*>(items), n * sizeof(T));
+    }
+
+    Written write(soci::session& sql, string const& path)
+    {
+        /* everything is read in one transaction, so the rows and the seq
+         * and monthly row count stored with them belong together
+         */
+        soci::transaction tr(sql);
+
+        Header header {};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.format  = FORMAT;
+        header.through = TIME::conv_date_to_epoch_day(
+                TIME::get_date_string()) - 1;
+
+        long long seq {};
+        long long monthly {};
+        sql << "SELECT value FROM meta WHERE key = 'seq'", soci::into(seq);
+        sql << "SELECT COUNT(*) FROM history_monthly", soci::into(monthly);
+        header.seq          = seq;
+        header.monthly_rows = static_cast<uint64_t>(monthly);
+
+        vector<Entry> entries;
+        for (SQL::Activity const& a : SQL::get_activities(sql)) {
+            entries.push_back({ a.id, a.group });
+        }
+
+        // months folded by retention are older than any daily row
+        string oldest;
+        soci::indicator ind { soci::i_null };
+        sql << "SELECT MIN(date) FROM history_monthly",
+            soci::into(oldest, ind);
+        if (ind != soci::i_ok) {
+            oldest = SQL::oldest_day(sql);
+        }
+
+        string const through { TIME::conv_epoch_day_to_date(header.through) };
+        vector<Record> records;
+        if (!oldest.empty() && oldest <= through)
+        {
+            SQL::stream_dates_data(sql, oldest, through,
+                    [&records](SQL::HistoryColumns const& c) {
+                for (size_t i {}; i < c.size(); ++i) {
+                    records.push_back({ c.day[i], c.activity[i],
+                            static_cast<int32_t>(llround(c.hours[i] * 3600)) });
+                }
+            });
+        }
+        tr.commit();
+
+        sort(records.begin(), records.end(),
+                [](Record const& a, Record const& b) {
+                    return a.day != b.day ? a.day < b.day :
+                        a.activity < b.activity;
+                });
+
+        vector<Block> blocks;
+        for (size_t i {}; i < records.size(); i += BLOCK_RECORDS)
+        {
+            size_t const last { min(records.size(), i + BLOCK_RECORDS) - 1 };
+            blocks.push_back({ records[i].day, records[last].day, i });
+        }
+
+        header.activities = static_cast<uint32_t>(entries.size());
+        header.records    = records.size();
+        header.blocks     = static_cast<uint32_t>(blocks.size());
+
+        string body;
+        append(body, entries.data(), entries.size());
+        append(body, blocks.data(), blocks.size());
+        append(body, records.data(), records.size());
+        header.checksum = fnv1a(body.data(), body.size());
+
+        string const tmp { path + ".tmp" };
+        {
+            ofstream out(tmp, ios::binary | ios::trunc);
+            out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+            out.write(body.data(), static_cast<streamsize>(body.size()));
+            if (!out) {
+                throw runtime_error(fmt::format("snapshot: can't write {}",
+                            tmp));
+            }
+        }
+        filesystem::rename(tmp, path);
+
+        return { records.size(), sizeof(header) + body.size(),
+            header.through };
+    }
+
+    File::File(string const& path)
+    {
+        int const fd { ::open(path.c_str(), O_RDONLY) };
+        if (fd < 0) {
+            throw runtime_error(fmt::format("snapshot: can't open {}", path));
+        }
+        struct stat st {};
+        if (fstat(fd, &st) != 0 ||
+                static_cast<size_t>(st.st_size) < sizeof(Header))
+        {
+            close(fd);
+            throw runtime_error(fmt::format("snapshot: {} is too short",
+                        path));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        map_  = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map_ == MAP_FAILED) {
+            throw runtime_error(fmt::format("snapshot: can't map {}", path));
+        }
+
+        auto fail = [&](string const& why) {
+            munmap(const_cast<void*>(map_), size_);
+            throw runtime_error(fmt::format("snapshot: {} {}", path, why));
+        };
+
+        char const* bytes { static_cast<char const*>(map_) };
+        header_ = reinterpret_cast<Header const*>(bytes);
+        if (memcmp(header_->magic, MAGIC, sizeof(MAGIC)) != 0) {
+            fail("is no snapshot");
+        }
+        if (header_->format != FORMAT) {
+            fail(fmt::format("has format {}, expected {}", header_->format,
+                        FORMAT));
+        }
+        size_t const expected { sizeof(Header) +
+            header_->activities * sizeof(Entry) +
+            header_->blocks * sizeof(Block) +
+            header_->records * sizeof(Record) };
+        if (size_ != expected) {
+            fail("has the wrong size");
+        }
+
+        Entry const* entries {
+            reinterpret_cast<Entry const*>(bytes + sizeof(Header)) };
+        blocks_ = reinterpret_cast<Block const*>(entries +
+                header_->activities);
+        records_ = reinterpret_cast<Record const*>(blocks_ + header_->blocks);
+
+        for (size_t i {}; i < header_->activities; ++i)
+        {
+            size_t const id { static_cast<size_t>(max(entries[i].id, 0)) };
+            if (id >= group_of_.size()) {
+                group_of_.resize(id + 1, -1);
+            }
+            group_of_[id] = entries[i].group;
+        }
+    }
+
+    File::~File()
+    {
+        munmap(const_cast<void*>(map_), size_);
+    }
+
+    int File::group(int const activity) const
+    {
+        size_t const id { static_cast<size_t>(activity) };
+        return activity >= 0 && id < group_of_.size() ? group_of_[id] : -1;
+    }
+
+    void File::stream(int const first_day, int const last_day,
+            function<void(SQL::HistoryColumns const&)> const& consume) const
+    {
+        /* blocks ending before first are skipped by a binary search, and
+         * in the first block the records before first as well; from there
+         * it's one pass until a record past last
+         */
+        if (last_day < first_day) {
+            return;
+        }
+
+        Block const* const end { blocks_ + header_->blocks };
+        Block const* b { partition_point(blocks_, end,
+                [first_day](Block const& x) {
+                    return x.last_day < first_day;
+                }) };
+
+        SQL::HistoryColumns chunk;
+        chunk.day.reserve(SQL::FETCH_CHUNK);
+        chunk.activity.reserve(SQL::FETCH_CHUNK);
+        chunk.group.reserve(SQL::FETCH_CHUNK);
+        chunk.hours.reserve(SQL::FETCH_CHUNK);
+
+        auto flush = [&]() {
+            consume(chunk);
+            chunk.day.clear();
+            chunk.activity.clear();
+            chunk.group.clear();
+            chunk.hours.clear();
+        };
+
+        for (; b != end && b->first_day <= last_day; ++b)
+        {
+            Record const* r { records_ + b->first };
+            Record const* const stop { records_ +
+                min<uint64_t>(b->first + BLOCK_RECORDS, header_->records) };
+            r = partition_point(r, stop, [first_day](Record const& x) {
+                return x.day < first_day;
+            });
+            for (; r != stop && r->day <= last_day; ++r)
+            {
+                chunk.day.push_back(r->day);
+                chunk.activity.push_back(r->activity);
+                chunk.group.push_back(group(r->activity));
+                chunk.hours.push_back(static_cast<double>(r->seconds) / 3600);
+                if (chunk.size() == SQL::FETCH_CHUNK) {
+                    flush();
+                }
+            }
+        }
+        if (!chunk.empty()) {
+            flush();
+        }
+    }
+
+    bool File::intact() const
+    {
+        call_once(checked_, [this]() {
+            char const* bytes { static_cast<char const*>(map_) };
+            intact_ = fnv1a(bytes + sizeof(Header), size_ - sizeof(Header)) ==
+                header_->checksum;
+        });
+        return intact_;
+    }
+
+    bool File::matches(soci::session& sql) const
+    {
+        /* every write to history logs its day with the next seq in
+         * contributions (see SCHEMA), so a change to a day in the file
+         * shows as a row with a later seq on or before through; folding
+         * old months deletes days without logging, but adds monthly rows
+         */
+        long long const seq { header_->seq };
+        string const through {
+            TIME::conv_epoch_day_to_date(header_->through) };
+
+        long long changed {};
+        sql <<
+            "SELECT COUNT(*) FROM contributions "
+            "WHERE seq > :seq AND date <= :through",
+            soci::use(seq), soci::use(through), soci::into(changed);
+        if (changed > 0) {
+            return false;
+        }
+
+        long long monthly {};
+        sql << "SELECT COUNT(*) FROM history_monthly", soci::into(monthly);
+        if (static_cast<uint64_t>(monthly) != header_->monthly_rows) {
+            return false;
+        }
+
+        // activities changed since (usually none): same group as before?
+        vector<int> ids(64);
+        vector<int> groups(64);
+        soci::statement st = (sql.prepare <<
+            "SELECT id, group_id FROM activities WHERE seq > :seq",
+            soci::use(seq), soci::into(ids), soci::into(groups));
+        st.execute();
+        while (st.fetch())
+        {
+            for (size_t i {}; i < ids.size(); ++i)
+            {
+                int const before { group(ids[i]) };
+                if (before != -1 && before != groups[i]) {
+                    return false;
+                }
+            }
+            ids.resize(64);
+            groups.resize(64);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <soci/soci.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "./sql.hpp"
+
+namespace SNAPSHOT {
+
+    /* history of the closed days (up to yesterday) in a flat binary file
+     * -) Header
+     * -) Entry per activity: the activity dictionary (id and group)
+     * -) Block per BLOCK_RECORDS records: first and last day, for skipping
+     * -) Record per activity and day, sorted by day, then activity
+     * all of it native endian and fixed width, so a mapped file is read in
+     * place; the checksum covers everything after the header
+     */
+
+    // bumped whenever the layout changes, older files are ignored
+    constexpr std::uint32_t FORMAT { 1 };
+
+    constexpr std::size_t BLOCK_RECORDS { 1024 };
+
+    struct Header
+    {
+        char          magic[8];     // "TRKSNAP"
+        std::uint32_t format;       // FORMAT
+        std::uint32_t activities;   // Entry count
+        std::uint64_t records;      // Record count
+        std::uint32_t blocks;       // Block count
+        std::int32_t  through;      // last epoch day in the file
+        std::int64_t  seq;          // meta seq of the db when written
+        std::uint64_t monthly_rows; // history_monthly rows when written
+        std::uint64_t checksum;     // FNV-1a 64 of the rest of the file
+    };
+
+    struct Entry
+    {
+        std::int32_t id;
+        std::int32_t group;
+    };
+
+    struct Block
+    {
+        std::int32_t  first_day;
+        std::int32_t  last_day;
+        std::uint64_t first;        // index of its first record
+    };
+
+    struct Record
+    {
+        std::int32_t day;           // epoch day
+        std::int32_t activity;      // id
+        std::int32_t seconds;       // hours of the day, to the second
+    };
+
+    static_assert(sizeof(Header) == 56 && sizeof(Entry) == 8 &&
+            sizeof(Block) == 16 && sizeof(Record) == 12);
+
+    // what write() put in the file
+    struct Written
+    {
+        std::size_t records;
+        std::size_t bytes;
+        int         through;
+    };
+
+    /* writes every history row up to yesterday to path (through a
+     * temporary file, so a reader never sees half of it)
+     */
+    Written write(soci::session& sql, std::string const& path);
+
+    /* a snapshot file mapped read only; throws if it can't be mapped, has
+     * another FORMAT or the wrong size for its header (the checksum is
+     * left to intact(), so opening one only touches the header)
+     * nothing is copied out of the mapping until stream() is called
+     */
+    class File
+    {
+    public:
+        explicit File(std::string const& path);
+        ~File();
+        File(File const&) = delete;
+        File& operator=(File const&) = delete;
+
+        int through() const { return header_->through; }
+        std::int64_t seq() const { return header_->seq; }
+        std::uint64_t monthly_rows() const { return header_->monthly_rows; }
+
+        // group the activity had when the file was written, -1 if unknown
+        int group(int const activity) const;
+
+        /* rows of first..last day in the layout of SQL::stream_dates_data,
+         * chunk by chunk; safe to call from several threads at once
+         */
+        void stream(int const first_day, int const last_day,
+                std::function<void(SQL::HistoryColumns const&)> const&
+                consume) const;
+
+        /* whether the db behind sql still has exactly the history the file
+         * was written from, up to its last day: no change logged for those
+         * days since, no month folded and no activity moved to another
+         * group (a few indexed lookups, no scan)
+         */
+        bool matches(soci::session& sql) const;
+
+        /* whether everything after the header still has the checksum it
+         * was written with; reads the whole file on the first call only
+         */
+        bool intact() const;
+
+    private:
+        void const*   map_ {};
+        std::size_t   size_ {};
+        Header const* header_ {};
+        Block const*  blocks_ {};
+        Record const* records_ {};
+        std::vector<int> group_of_; // by activity id, -1 for none
+        mutable std::once_flag checked_;
+        mutable bool           intact_ {};
+    };
+}
@@ -1,42 +1,29 @@
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <iomanip>
+#include <map>
+#include <numeric>
+#include <thread>
 #include <soci/soci.h>
 #include <fmt/core.h>
 
+#include "./retention.hpp"
+#include "./schema.hpp"
 #include "./time.hpp"
 #include "./sql.hpp"
+#include "./stats.hpp"
+#include "./storage.hpp"
 
 using namespace std;
 
 namespace SQL
 {
-    void bootup(soci::session& sql)
+    void bootup(STORAGE::Backend& storage)
     {
-        // create activities table
-        sql <<
-            "CREATE TABLE activities ("
-            "id INTEGER PRIMARY KEY, " // PRIMARY implies NOT NULL and UNIQUE
-            "group_id INTEGER NOT NULL, "
-            "name TEXT NOT NULL, "
-            "added_when TEXT NOT NULL, "
-            "is_activated INTEGER NOT NULL DEFAULT 1, "
-            "hours_total NUMERIC NOT NULL DEFAULT 0.0"
-            ");";
-
-        // create history table
-        sql << 
-            "CREATE TABLE history ("
-            "id_activity INTEGER NOT NULL, "
-            "year INTEGER NOT NULL, "
-            "month INTEGER NOT NULL, "
-            "day INTEGER NOT NULL, "
-            "weeknumber INTEGER NOT NULL, "
-            "hours_on_day NUMERIC NOT NULL DEFAULT 0.0, "
-            "date TEXT NOT NULL, " // simplifies some SQL queries
-            "FOREIGN KEY (id_activity) REFERENCES activities(id)"
-            ");";
-
+        /* first start: tables are in place (SCHEMA::open), so only ask for
+         * the activities to track
+         */
         cout <<
             "First time running: Add activities to track!"     << endl <<
             "Each activity has a name (string, no whitespace)" << endl <<
@@ -59,168 +46,1017 @@ namespace SQL
             unordered_map<string, string> dtmap =
                 TIME::get_datetime_map();
 
+            storage.add_activity(name, stoi(group_id), dtmap["date"]);
+        }
+    }
+
+    string user_clause(string const& column, vector<int> const& users)
+    {
+        /* the condition limiting a query to users, it always has a :users
+         * parameter (FILTER::id_list of users), so the statement binds the
+         * same either way; no users is everyone, a condition on nothing
+         * but a parameter is checked once per execution, not per row
+         */
+        if (users.empty()) {
+            return "(:users <> '')";
+        }
+        return column + " IN (SELECT value FROM json_each(:users))";
+    }
+
+    int ensure_user(soci::session& sql, string const& name)
+    {
+        sql << "INSERT OR IGNORE INTO users (name) VALUES (:name)",
+            soci::use(name);
+
+        int id {};
+        sql << "SELECT id FROM users WHERE name = :name",
+            soci::use(name), soci::into(id);
+        return id;
+    }
+
+    vector<Activity> get_activities(soci::session& sql,
+            vector<int> const& users)
+    {
+        /* reads the whole activities table into a vector
+         * names and totals are looked up here once instead of being carried
+         * along with every history row
+         */
+        vector<Activity> activities;
+
+        vector<int>    id(FETCH_CHUNK);
+        vector<int>    gr(FETCH_CHUNK);
+        vector<string> nm(FETCH_CHUNK);
+        vector<int>    ac(FETCH_CHUNK);
+        vector<double> hh(FETCH_CHUNK);
+
+        string const ids { FILTER::id_list(users) };
+        soci::statement st = (sql.prepare <<
+            "SELECT id, group_id, name, is_activated, "
+            "CAST(hours_total AS REAL) "
+            "FROM activities WHERE " + user_clause("user_id", users) + " "
+            "ORDER BY id",
+            soci::use(ids),
+            soci::into(id), soci::into(gr), soci::into(nm),
+            soci::into(ac), soci::into(hh));
+
+        st.execute();
+        while (st.fetch())
+        {
+            for (size_t i {}; i < id.size(); ++i) {
+                activities.push_back({ id[i], gr[i], nm[i], ac[i] != 0, hh[i] });
+            }
+            // fetch() shrinks the vectors to the rows it got, grow them back
+            id.resize(FETCH_CHUNK);
+            gr.resize(FETCH_CHUNK);
+            nm.resize(FETCH_CHUNK);
+            ac.resize(FETCH_CHUNK);
+            hh.resize(FETCH_CHUNK);
+        }
+
+        return activities;
+    }
+
+    string partition(soci::session& sql, string const& date,
+            bool const sealed_ok)
+    {
+        int const year { stoi(date.substr(0, 4)) };
+        if (!sealed_ok && year < SCHEMA::sealed_before()) {
+            throw runtime_error("History of " + to_string(year) +
+                    " is sealed (read-only), entry not recorded");
+        }
+        SCHEMA::ensure_partition(sql, year);
+        return SCHEMA::partition_table(year);
+    }
+
+    vector<string> partitions(soci::session& sql, string const& first,
+            string const& last)
+    {
+        // dates start with their year, so do the partitions' names
+        int const a { stoi(first.substr(0, 4)) };
+        int const b { stoi(last.substr(0, 4)) };
+        vector<string> tables;
+        for (int const year : SCHEMA::partition_years(sql)) {
+            if (year >= a && year <= b) {
+                tables.push_back(SCHEMA::partition_table(year));
+            }
+        }
+        return tables;
+    }
+
+    string oldest_day(soci::session& sql, vector<int> const& users)
+    {
+        // oldest partition first, later ones only if it has no rows
+        string const ids { FILTER::id_list(users) };
+        for (int const year : SCHEMA::partition_years(sql))
+        {
+            string date;
+            soci::indicator ind { soci::i_null };
             sql <<
-                "INSERT INTO activities "
-                "(name, group_id, added_when, hours_total) "
-                "VALUES "
-                "(:name, :group_id, :added_when, :hours_total)",
-                soci::use(name),
-                soci::use(group_id),
-                soci::use(dtmap["date"]),
-                soci::use(0);
+                "SELECT MIN(date) FROM " + SCHEMA::partition_table(year) +
+                " WHERE " + user_clause("user_id", users),
+                soci::use(ids), soci::into(date, ind);
+            if (ind == soci::i_ok) {
+                return date;
+            }
         }
+        return "";
     }
 
-    soci::rowset<soci::row> get_dates_data(
+    void stream_dates_data(
             soci::session& sql,
-            vector<string> const& dates)
+            string const& first,
+            string const& last,
+            function<void(HistoryColumns const&)> const& consume,
+            vector<int> const& users)
     {
-        // pick exactly the fields we need to make life easier for ourselves
-        // in print_stat function
-        string query = 
+        /* fetches all history rows with first <= date <= last, date ordered
+         * (dates are yyyy-mm-dd strings, so they compare correctly as text)
+         * rows are pulled FETCH_CHUNK at a time straight into the typed
+         * vectors of one HistoryColumns, which is handed to consume and then
+         * reused for the next chunk; no field goes through soci::row
+         * months folded by RETENTION come first (they're older than any
+         * daily row), each as one row on the first day of the month, then
+         * the days, partition after partition (years are in date order)
+         * rows of some users come out of history_yyyy_user_date (and
+         * history_monthly_user_date), ranges of several users are merged
+         * by date in a temp b-tree
+         */
+        HistoryColumns chunk;
+        string const ids { FILTER::id_list(users) };
+
+        vector<string> tables { "history_monthly" };
+        for (string& table : partitions(sql, first, last)) {
+            tables.push_back(move(table));
+        }
+
+        // julianday() of 1970-01-01 is 2440587.5, so this yields epoch days
+        for (string const& table : tables)
+        {
+            string const hours { table == "history_monthly" ?
+                "hours_on_month" : "hours_on_day" };
+
+            chunk.day.resize(FETCH_CHUNK);
+            chunk.activity.resize(FETCH_CHUNK);
+            chunk.group.resize(FETCH_CHUNK);
+            chunk.hours.resize(FETCH_CHUNK);
+
+            soci::statement st = (sql.prepare <<
+                "SELECT "
+                "CAST(julianday(h.date) - 2440587.5 AS INTEGER), "
+                "activities.id, activities.group_id, "
+                "CAST(h." + hours + " AS REAL) "
+                "FROM " + table + " AS h INNER JOIN activities "
+                "ON activities.id = h.id_activity "
+                "WHERE h.date BETWEEN :first AND :last "
+                "AND " + user_clause("h.user_id", users) + " "
+                "ORDER BY h.date",
+                soci::use(first), soci::use(last), soci::use(ids),
+                soci::into(chunk.day), soci::into(chunk.activity),
+                soci::into(chunk.group), soci::into(chunk.hours));
+
+            st.execute();
+            while (st.fetch())
+            {
+                consume(chunk);
+
+                // fetch() shrinks the vectors to the rows it got, grow them
+                chunk.day.resize(FETCH_CHUNK);
+                chunk.activity.resize(FETCH_CHUNK);
+                chunk.group.resize(FETCH_CHUNK);
+                chunk.hours.resize(FETCH_CHUNK);
+            }
+        }
+    }
+
+    FilteredDays::FilteredDays(soci::session& sql, string const& table,
+            vector<int> const& users)
+        : sql_(sql), table_(table), user_ids_(users),
+        users_(FILTER::id_list(users))
+    {
+    }
+
+    soci::statement FilteredDays::prepare(string const& table)
+    {
+        /* same select as stream_dates_data; every parameter shows up once,
+         * the any_* flags come first in their OR so an unset part costs
+         * one integer test per row; id sets are json arrays, sqlite turns
+         * the IN (json_each) into a lookup table once per execution
+         */
+        chunk_.day.resize(FETCH_CHUNK);
+        chunk_.activity.resize(FETCH_CHUNK);
+        chunk_.group.resize(FETCH_CHUNK);
+        chunk_.hours.resize(FETCH_CHUNK);
+
+        string const select {
             "SELECT "
-            "activities.id, activities.group_id, activities.name, "
-            "history.hours_on_day "
-            "FROM activities INNER JOIN history "
-            "ON activities.id = history.id_activity "
-            "WHERE DATE IN (";
-        for (size_t i {}; i < dates.size(); ++i)
+            "CAST(julianday(h.date) - 2440587.5 AS INTEGER), "
+            "activities.id, activities.group_id, "
+            "CAST(h." + string(table == "history_monthly" ?
+                    "hours_on_month" : "hours_on_day") + " AS REAL) "
+            "FROM " + table + " AS h INNER JOIN activities "
+            "ON activities.id = h.id_activity "
+            "WHERE h.date BETWEEN :first AND :last "
+            "AND " + user_clause("h.user_id", user_ids_) + " "
+            "AND (:any_act OR "
+            "h.id_activity IN (SELECT value FROM json_each(:acts))) "
+            "AND (:any_grp OR "
+            "activities.group_id IN (SELECT value FROM json_each(:grps))) " };
+
+        if (table == "history_monthly")
         {
-            query += "'" + dates[i] + "'";
-            if (i != dates.size() - 1) {
-                query += ", ";
+            return (sql_.prepare << select + "ORDER BY h.date",
+                soci::use(first_), soci::use(last_), soci::use(users_),
+                soci::use(any_activity_), soci::use(activities_),
+                soci::use(any_group_), soci::use(groups_),
+                soci::into(chunk_.day), soci::into(chunk_.activity),
+                soci::into(chunk_.group), soci::into(chunk_.hours));
+        }
+
+        // strftime's %w has Sunday as 0, the filter has Monday
+        return (sql_.prepare << select +
+            "AND (:any_wd OR (:wds >> "
+            "((CAST(strftime('%w', h.date) AS INTEGER) + 6) % 7)) & 1) "
+            "AND (:any_wk OR (:wks >> h.weeknumber) & 1) "
+            "AND h.hours_on_day >= :min "
+            "ORDER BY h.date",
+            soci::use(first_), soci::use(last_), soci::use(users_),
+            soci::use(any_activity_), soci::use(activities_),
+            soci::use(any_group_), soci::use(groups_),
+            soci::use(any_weekday_), soci::use(weekdays_),
+            soci::use(any_week_), soci::use(weeks_),
+            soci::use(min_hours_),
+            soci::into(chunk_.day), soci::into(chunk_.activity),
+            soci::into(chunk_.group), soci::into(chunk_.hours));
+    }
+
+    void FilteredDays::stream(
+            string const& first,
+            string const& last,
+            FILTER::Filter const& filter,
+            function<void(HistoryColumns const&)> const& consume)
+    {
+        first_ = filter.first.empty() ? first : max(first, filter.first);
+        last_  = filter.last.empty()  ? last  : min(last,  filter.last);
+
+        any_activity_ = filter.activities.empty();
+        activities_   = FILTER::id_list(filter.activities);
+        any_group_    = filter.groups.empty();
+        groups_       = FILTER::id_list(filter.groups);
+        any_weekday_  = filter.weekdays == 0x7f;
+        weekdays_     = filter.weekdays;
+        any_week_     = filter.weeks == ~0ULL;
+        weeks_        = static_cast<long long>(filter.weeks & ~(1ULL << 63));
+        min_hours_    = filter.min_hours;
+
+        vector<string> tables { table_ };
+        if (table_ == "history") {
+            tables = partitions(sql_, first_, last_);
+        }
+
+        for (string const& table : tables)
+        {
+            auto it { st_.find(table) };
+            if (it == st_.end()) {
+                it = st_.emplace(table, prepare(table)).first;
+            }
+
+            soci::statement& st { it->second };
+            st.execute();
+            while (st.fetch())
+            {
+                consume(chunk_);
+
+                chunk_.day.resize(FETCH_CHUNK);
+                chunk_.activity.resize(FETCH_CHUNK);
+                chunk_.group.resize(FETCH_CHUNK);
+                chunk_.hours.resize(FETCH_CHUNK);
             }
         }
-        query += ")";
+    }
 
-        soci::rowset<soci::row> dates_data =
-            sql.prepare << query;
+    HistoryColumns get_dates_data(
+            soci::session& sql,
+            string const& first,
+            string const& last)
+    {
+        /* same rows as stream_dates_data, collected into one HistoryColumns
+         */
+        HistoryColumns data;
 
-        return dates_data;
+        stream_dates_data(sql, first, last,
+                [&data](HistoryColumns const& chunk) {
+            data.day.insert(data.day.end(),
+                    chunk.day.begin(), chunk.day.end());
+            data.activity.insert(data.activity.end(),
+                    chunk.activity.begin(), chunk.activity.end());
+            data.group.insert(data.group.end(),
+                    chunk.group.begin(), chunk.group.end());
+            data.hours.insert(data.hours.end(),
+                    chunk.hours.begin(), chunk.hours.end());
+        });
+
+        return data;
     }
 
-    void print_stats(
+    void add_segment(
+            soci::session& sql,
+            int const activity,
+            long long const start,
+            int const duration)
+    {
+        /* records one work phase; callers split phases at midnight
+         * phases that didn't last a full second aren't worth a row
+         * a second phase of the activity starting in the same second (quick
+         * switches, an entry made twice) adds to the first instead of
+         * replacing it, like the daily sums in history do; capped at
+         * MAX_SEGMENT, which the overlap queries rely on
+         */
+        if (duration <= 0) {
+            return;
+        }
+
+        sql <<
+            "INSERT INTO segments (start, id_activity, duration) "
+            "VALUES (:start, :id, :duration) "
+            "ON CONFLICT (start, id_activity) DO UPDATE SET "
+            "duration = MIN(duration + excluded.duration, :max)",
+            soci::use(start), soci::use(activity), soci::use(duration),
+            soci::use(MAX_SEGMENT);
+    }
+
+    void stream_segments(
+            soci::session& sql,
+            long long const from,
+            long long const to,
+            function<void(SegmentColumns const&)> const& consume,
+            vector<int> const& users)
+    {
+        /* same chunked bulk fetch as stream_dates_data, over the primary
+         * key range of segments
+         */
+        SegmentColumns chunk;
+        string const ids { FILTER::id_list(users) };
+        chunk.start.resize(FETCH_CHUNK);
+        chunk.activity.resize(FETCH_CHUNK);
+        chunk.duration.resize(FETCH_CHUNK);
+
+        soci::statement st = (sql.prepare <<
+            "SELECT start, id_activity, duration FROM segments "
+            "WHERE start >= :from AND start < :to "
+            "AND " + string(users.empty() ? user_clause("", users) :
+                "id_activity IN (SELECT id FROM activities WHERE " +
+                user_clause("user_id", users) + ")") + " "
+            "ORDER BY start",
+            soci::use(from), soci::use(to), soci::use(ids),
+            soci::into(chunk.start), soci::into(chunk.activity),
+            soci::into(chunk.duration));
+
+        st.execute();
+        while (st.fetch())
+        {
+            consume(chunk);
+
+            chunk.start.resize(FETCH_CHUNK);
+            chunk.activity.resize(FETCH_CHUNK);
+            chunk.duration.resize(FETCH_CHUNK);
+        }
+    }
+
+    void stream_overlapping_segments(
+            soci::session& sql,
+            long long const from,
+            long long const to,
+            function<void(SegmentColumns const&)> const& consume)
+    {
+        /* a segment overlapping from can't have started more than
+         * MAX_SEGMENT earlier, so the index range only grows by a day;
+         * segments ending before from are dropped from each chunk
+         */
+        SegmentColumns kept;
+
+        stream_segments(sql, from - MAX_SEGMENT, to,
+                [&](SegmentColumns const& chunk) {
+            if (!chunk.empty() && chunk.start.front() >= from) {
+                consume(chunk);
+                return;
+            }
+
+            kept.start.clear();
+            kept.activity.clear();
+            kept.duration.clear();
+            for (size_t i {}; i < chunk.size(); ++i)
+            {
+                if (chunk.start[i] + chunk.duration[i] <= from) {
+                    continue;
+                }
+                kept.start.push_back(chunk.start[i]);
+                kept.activity.push_back(chunk.activity[i]);
+                kept.duration.push_back(chunk.duration[i]);
+            }
+            if (!kept.empty()) {
+                consume(kept);
+            }
+        });
+    }
+
+    SegmentColumns get_segments(
             soci::session& sql,
-            soci::rowset<soci::row> const& data,
-            int const days)
+            long long const from,
+            long long const to,
+            bool const overlapping)
+    {
+        SegmentColumns data;
+
+        auto append = [&data](SegmentColumns const& chunk) {
+            data.start.insert(data.start.end(),
+                    chunk.start.begin(), chunk.start.end());
+            data.activity.insert(data.activity.end(),
+                    chunk.activity.begin(), chunk.activity.end());
+            data.duration.insert(data.duration.end(),
+                    chunk.duration.begin(), chunk.duration.end());
+        };
+
+        if (overlapping) {
+            stream_overlapping_segments(sql, from, to, append);
+        }
+        else {
+            stream_segments(sql, from, to, append);
+        }
+        return data;
+    }
+
+    static string cache_shape(vector<int> const& act_ids,
+            vector<int> const& grp_ids)
+    {
+        /* identifies the activities/groups a persisted stats block was
+         * built for, blocks of another shape are never loaded
+         */
+        string shape;
+        for (int id : act_ids) {
+            shape += to_string(id) + ",";
+        }
+        shape += "/";
+        for (int id : grp_ids) {
+            shape += to_string(id) + ",";
+        }
+        return shape;
+    }
+
+    void invalidate_stats(soci::session& sql, string const& date)
+    {
+        /* drops cached stats blocks (in memory and persisted) containing
+         * date, has to be called by everything that writes to history
+         */
+        int const day { TIME::conv_date_to_epoch_day(date) };
+        STATS::cache().invalidate(day);
+
+        if (SCHEMA::has_table(sql, "stats_cache"))
+        {
+            sql <<
+                "DELETE FROM stats_cache "
+                "WHERE :day BETWEEN first_day AND last_day",
+                soci::use(day);
+        }
+    }
+
+    void invalidate_stats(
+            soci::session& sql,
+            string const& first,
+            string const& last)
+    {
+        // same as above for every day of first..last, in one statement
+        int const a { TIME::conv_date_to_epoch_day(first) };
+        int const b { TIME::conv_date_to_epoch_day(last) };
+        STATS::cache().invalidate(a, b);
+
+        if (SCHEMA::has_table(sql, "stats_cache"))
+        {
+            sql <<
+                "DELETE FROM stats_cache "
+                "WHERE first_day <= :last AND last_day >= :first",
+                soci::use(b), soci::use(a);
+        }
+    }
+
+    static STATS::RangeIndex const& range_totals(STORAGE::Backend& storage)
     {
-        map<int, double> id_to_hh; // activity id to hours
-        map<int, double> gr_to_hh; // group id to hours
-        map<int, string> id_to_nm; // activity id to name
-        
-        /* soci::rowset doesn't have a .size() method nor can its internal
-         * iterator be reset, this makes easily testing whether it's empty or
-         * not non-trivial, testing if data.begin() == data.end() will 
-         * advance the iterator; we could create a vector of our rowset,
-         * but that seems inefficient, so we count the rows here
+        /* STATS::totals(), built from all of history up to today the first
+         * time it's needed (and whenever it had to be cleared)
          */
+        STATS::RangeIndex& index { STATS::totals() };
+        if (index.built()) {
+            return index;
+        }
+        string const today { TIME::get_date_string() };
+        string oldest { storage.oldest_date() };
+        if (oldest.empty() || oldest > today) {
+            oldest = today;
+        }
+        index.build(storage.activities(),
+                TIME::conv_date_to_epoch_day(oldest),
+                TIME::conv_date_to_epoch_day(today),
+                [&storage](int const a, int const b,
+                    function<void(HistoryColumns const&)> const& sink) {
+                    storage.stream_days(TIME::conv_epoch_day_to_date(a),
+                            TIME::conv_epoch_day_to_date(b), sink);
+                });
+        return index;
+    }
 
-        /* for reference: data is rowset<row> of following columns:
-         * +----+----------+------+--------------+
-         * | id | group_id | name | hours_on_day |
-         * +----+----------+------+--------------+
+    static void print_summary(STATS::Summary const& s, string const& idt)
+    {
+        /* prints the lines shared by group and activity stats
          */
+        cout << fmt::format(
+                "{}Worked   : {:.2f} (avg {:.2f} per day, {} active days)\n"
+                "{}Per day  : median {:.2f}, p90 {:.2f}\n"
+                "{}Streaks  : longest {} days, current {} days\n"
+                "{}Rolling  : 7 day avg {:.2f}, 30 day avg {:.2f}\n"
+                "{}Last week: {:.2f} ({:+.2f} vs week before)\n",
+                idt, s.sum, s.mean, s.active_days,
+                idt, s.median, s.p90,
+                idt, s.longest_streak, s.current_streak,
+                idt, s.avg7, s.avg30,
+                idt, s.week, s.week_delta);
+    }
 
-        int rowcount {};
+    static void print_group_tree(vector<Group> const& groups,
+            unordered_map<int, double> const* range, string const& idt)
+    {
+        /* groups indented under their parents, with the hours of range
+         * (per subtree, if given) and the all time rollup
+         */
+        map<int, vector<Group const*>> children;
+        for (Group const& g : groups) {
+            children[g.parent].push_back(&g);
+        }
 
-        for (const soci::row& row : data)
+        function<void(int const, size_t const)> print =
+            [&](int const parent, size_t const depth)
         {
-            ++rowcount;
-            int         id { row.get<int>("id") };
-            int         gr { row.get<int>("group_id") };
-            string 		nm { row.get<string>("name") };
-            double      hh { row.get<double>("hours_on_day") };
+            for (Group const* g : children[parent])
+            {
+                string const name { string(2 * depth, ' ') + g->name };
+                string in_range;
+                if (range) {
+                    auto it = range->find(g->id);
+                    in_range = fmt::format("{:>10.2f}",
+                            it == range->end() ? 0.0 : it->second);
+                }
+                cout << fmt::format("{}{:<30}{}{:>12.2f}\n", idt, name,
+                        in_range, g->hours_total);
+                print(g->id, depth + 1);
+            }
+        };
+
+        cout << fmt::format("{}{:<30}{}{:>12}\n", idt, "",
+                range ? fmt::format("{:>10}", "in range") : "", "all time");
+        print(0, 0);
+    }
+
+    void print_stats(
+            STORAGE::Backend& storage,
+            string const& first,
+            string const& last,
+            FILTER::Filter const& filter)
+    {
+        /* collects per group and per activity statistics for first..last
+         * (through the block cache of STATS::collect) and prints them
+         * a filter turns it into one filtered scan straight into an Engine,
+         * its sums per activity and group are added up by STATS::aggregate
+         * unfiltered ranges up to today take their sums from STATS::totals()
+         */
+
+        // range totals as of every write so far, started over (along with
+        // the cached blocks) if another tracker on the db wrote meanwhile
+        STORAGE::catch_up(storage);
 
-            id_to_hh[id] += hh;
-            gr_to_hh[gr] += hh;
-            id_to_nm[id]  = nm;
+        // the filter's own dates narrow the range
+        if ((!filter.first.empty() && filter.first > first) ||
+                (!filter.last.empty() && filter.last < last))
+        {
+            string const from { max(first, filter.first) };
+            string const to   { filter.last.empty() ? last :
+                min(last, filter.last) };
+            if (from > to) {
+                cout << "No entries were retrieved, back to menu!" << endl;
+                return;
+            }
+            print_stats(storage, from, to, filter);
+            return;
         }
 
-        if (rowcount == 0)
+        // months folded by retention are one entry per activity on their
+        // first day, the report can't tell how their hours were spread
+        string const compacted { storage.compacted_before() };
+        if (first < compacted && filter.per_day())
+        {
+            // weekdays, weeks and hours per day aren't known for those
+            cout << fmt::format("Note: days before {} are kept as one entry "
+                    "per activity and month, weekday, week and min filters "
+                    "leave them out\n", compacted);
+        }
+        else if (first < compacted)
+        {
+            cout << fmt::format("Note: days before {} are kept as one entry "
+                    "per activity and month, active days, medians and "
+                    "streaks there count whole months\n", compacted);
+            if (first.substr(8) != "01") {
+                cout << fmt::format("Note: the month of {} is compacted and "
+                        "left out, start on {}-01 to include it\n",
+                        first, first.substr(0, 7));
+            }
+        }
+
+        // ordered by id, so activities[k] belongs to dense index k
+        vector<Activity> const activities { storage.activities() };
+
+        vector<int> act_ids;
+        vector<int> grp_ids;
+        for (Activity const& act : activities) {
+            act_ids.push_back(act.id);
+            grp_ids.push_back(act.group);
+        }
+
+        STATS::DenseIndex const act_index(act_ids);
+        STATS::DenseIndex const grp_index(grp_ids);
+
+        int const first_day { TIME::conv_date_to_epoch_day(first) };
+        int const last_day  { TIME::conv_date_to_epoch_day(last) };
+
+        // plain totals up to today come from the range index, O(log n) each
+        STATS::RangeIndex const* totals { nullptr };
+        if (filter.empty() && last <= TIME::get_date_string()) {
+            totals = &range_totals(storage);
+        }
+
+        // an empty range needs no scan at all
+        if (totals && totals->total(first_day, last_day) < 1e-9)
         {
             cout << "No entries were retrieved, back to menu!" << endl;
             return;
         }
 
+        vector<STATS::Accumulator> accs;
+
+        // sums of the filtered rows, chunk by chunk as they are scanned
+        STATS::Totals act_sums;
+        STATS::Totals grp_sums;
+
+        if (!filter.empty())
+        {
+            STATS::Engine engine(first_day, last_day, act_index, grp_index);
+            storage.stream_filtered_days(first, last, filter,
+                    [&](HistoryColumns const& c) {
+                        engine.add(c);
+                        STATS::aggregate(c.activity, c.hours, act_index,
+                                act_sums);
+                        STATS::aggregate(c.group, c.hours, grp_index,
+                                grp_sums);
+                    });
+            engine.finish();
+            accs = engine.accumulators();
+        }
+        else
+        {
+            // whole weeks for up to a year, four week blocks beyond
+            int const granularity { last_day - first_day < 366 ? 7 : 28 };
+
+            STATS::cache().reset(act_ids, grp_ids);
+            STATS::cache().attach(
+                    storage.stats_backing(cache_shape(act_ids, grp_ids)));
+
+            auto scan = [&storage](int const a, int const b,
+                    function<void(HistoryColumns const&)> const& sink) {
+                storage.stream_days(
+                        TIME::conv_epoch_day_to_date(a),
+                        TIME::conv_epoch_day_to_date(b),
+                        sink);
+            };
+
+            // ranges over a year long are scanned a partition per core
+            size_t const cores { thread::hardware_concurrency() };
+            vector<STATS::Scan> parallel;
+            if (last_day - first_day >= STATS::PARTITION_DAYS) {
+                parallel = storage.parallel_scans(cores);
+            }
+            // otherwise one core fetches and the rest add up; the fetch
+            // thread can't go through scan (storage may only be used from
+            // here), it gets a connection of its own, no pipeline without
+            size_t workers {};
+            if (parallel.size() < 2 && cores > 1) {
+                parallel = storage.parallel_scans(1);
+                workers = parallel.empty() ? 0 : cores - 1;
+            }
+
+            accs = STATS::collect(first_day, last_day, granularity,
+                    act_index, grp_index, scan, parallel, workers);
+
+            // the backing may hold on to a session, don't let it outlive this
+            STATS::cache().attach({});
+        }
+
+        if (none_of(accs.begin(), accs.end(),
+                    [](STATS::Accumulator const& a) { return a.sum > 0; }))
+        {
+            cout << "No entries were retrieved, back to menu!" << endl;
+            return;
+        }
+
+        // sums of a filtered range as added up by aggregate
+        auto filtered = [&](bool const group, int const id) {
+            STATS::Totals const& t { group ? grp_sums : act_sums };
+            int const k { group ? grp_index(id) : act_index(id) };
+            return k < 0 || t.sum.empty() ? 0.0 :
+                t.sum[static_cast<size_t>(k)];
+        };
+
+        // sums (and the mean) come from the range index when there is one,
+        // or from the filtered aggregate, the scan only adds the
+        // distribution and the streaks
+        auto summary = [&](STATS::Accumulator const& acc, bool const group,
+                int const id) {
+            STATS::Summary s { STATS::summarize(acc) };
+            if (totals || !filter.empty()) {
+                s.sum = !totals ? filtered(group, id) : group ?
+                    totals->group(id, first_day, last_day) :
+                    totals->activity(id, first_day, last_day);
+                s.mean = acc.days ? s.sum / acc.days : 0.0;
+            }
+            return s;
+        };
+
         // indentation levels
         string idt { "    " };   // 4 spaces
         string idT { "      " }; // 6 spaces
 
-        // print group stats first by iterating over gr_to_hh map
+        cout << fmt::format("Stats from {} to {} ({} days)\n\n",
+                first, last, last_day - first_day + 1);
+
+        // print group stats first, skipping groups without time in range
         cout << "Group stats: " << endl;
-        for (pair<int, double> group : gr_to_hh)
+        for (size_t k {}; k < grp_index.size(); ++k)
         {
-            cout << fmt::format(
-                    "{} Hours per group {}: {:7.2f} (avg of {:.2f} per day)\n",
-                    idt, group.first, group.second, group.second / days);
-       }
+            STATS::Accumulator const& acc { accs[act_index.size() + k] };
+            if (acc.active_days == 0) {
+                continue;
+            }
+            cout << fmt::format("{}Group {}\n", idt, grp_index.id(k));
+            print_summary(summary(acc, true, grp_index.id(k)), idT);
+        }
+
+        // nested groups: every subtree's hours from one pass over the
+        // closure, each group adding its own hours to all its ancestors
+        // (of the range index if there is one, the scanned rows otherwise)
+        vector<Group> const groups { storage.groups() };
+        if (any_of(groups.begin(), groups.end(),
+                    [](Group const& g) { return g.parent != 0; }))
+        {
+            unordered_map<int, double> range;
+            for (auto const& [ancestor, descendant] : storage.group_closure())
+            {
+                int const k { grp_index(descendant) };
+                if (totals) {
+                    range[ancestor] += totals->group(descendant, first_day,
+                            last_day);
+                }
+                else if (!filter.empty()) {
+                    range[ancestor] += filtered(true, descendant);
+                }
+                else if (k >= 0) {
+                    range[ancestor] += accs[act_index.size() +
+                        static_cast<size_t>(k)].sum;
+                }
+            }
+            cout << "Group tree: " << endl;
+            print_group_tree(groups, &range, idt);
+        }
 
         // print activity stats
 
         cout << "Activity stats: " << endl;
-        for (pair<int, double> pair : id_to_hh)
+        for (size_t k {}; k < act_index.size(); ++k)
         {
-            int    id { pair.first };
-            double hh { pair.second };
-            string nm { id_to_nm[id] };
+            STATS::Accumulator const& acc { accs[k] };
+            if (acc.active_days == 0) {
+                continue;
+            }
+            Activity const& act { activities[k] };
 
-            
+            cout << fmt::format("{}Activity: {}\n", idt, act.name);
+            print_summary(summary(acc, false, act.id), idT);
             cout << fmt::format(
-                    "  Activity: {} \n"
-                    "  Worked  : {:.2f} \n"
-                    "  Avg/Day : {:.2f} \n",
-                    nm, hh, hh/days);
+                    "{}(total hours tracked: {:.2f} hours)\n",
+                    idT, act.hours_total);
+        }
+        cout << endl;
+    }
 
-            double hh_total { 0.0 };
+    static void print_hour_grid(vector<double> const& hours,
+            string const& idt)
+    {
+        /* 7x24 grid, darker means more time in that hour (relative to the
+         * busiest hour of this grid)
+         */
+        string const shades { " .:-=+*#%@" };
+        char const* weekdays[] { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat",
+            "Sun" };
 
-            sql <<
-                "SELECT hours_total FROM activities "
-                "WHERE id = :id",
-                soci::use(id), soci::into(hh_total);
+        double const top { *max_element(hours.begin(), hours.end()) };
 
-            cout << fmt::format(
-                    "{} (total hours tracked: {:.2f} hours\n",
-                    idT, hh_total);
+        cout << idt << "     000000000011111111112222\n";
+        cout << idt << "     012345678901234567890123\n";
+        for (size_t d {}; d < 7; ++d)
+        {
+            string row;
+            for (size_t h {}; h < 24; ++h)
+            {
+                double v { hours[d * 24 + h] };
+                size_t level { 0 };
+                if (v > 0 && top > 0) {
+                    level = 1 + min<size_t>(8,
+                            static_cast<size_t>(v / top * 8));
+                }
+                row += shades[level];
+            }
+            cout << fmt::format("{}{}  {}\n", idt, weekdays[d], row);
+        }
+    }
+
+    static void print_calendar(STORAGE::Backend& storage, int const year)
+    {
+        /* daily totals of one year as weeks (columns) by weekday (rows),
+         * straight from the daily sums in history
+         */
+        string const first { to_string(year) + "-01-01" };
+        string const last  { to_string(year) + "-12-31" };
+        int const first_day { TIME::conv_date_to_epoch_day(first) };
+        int const last_day  { TIME::conv_date_to_epoch_day(last) };
+        int const monday    { STATS::block_start(first_day, 7) };
+
+        vector<double> totals(static_cast<size_t>(last_day - monday + 1));
+        storage.stream_days(first, last, [&](HistoryColumns const& c) {
+            for (size_t i {}; i < c.size(); ++i) {
+                totals[static_cast<size_t>(c.day[i] - monday)] += c.hours[i];
+            }
+        });
+
+        char const* weekdays[] { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat",
+            "Sun" };
+
+        cout << fmt::format(
+                "Daily totals {} ('.' <2h, ':' <4h, 'o' <6h, 'O' <8h, "
+                "'@' 8h+):\n", year);
+        for (int d {}; d < 7; ++d)
+        {
+            string row;
+            for (int day { monday + d }; day <= last_day; day += 7)
+            {
+                double v { totals[static_cast<size_t>(day - monday)] };
+                if (day < first_day) row += ' ';
+                else if (v <= 0)     row += '-';
+                else if (v < 2)      row += '.';
+                else if (v < 4)      row += ':';
+                else if (v < 6)      row += 'o';
+                else if (v < 8)      row += 'O';
+                else                 row += '@';
+            }
+            cout << fmt::format("    {}  {}\n", weekdays[d], row);
         }
         cout << endl;
     }
 
-    void print_activities(soci::session& sql, bool const print_deactivated)
+    void print_heatmap(
+            STORAGE::Backend& storage,
+            int const first_year,
+            int const last_year)
     {
-        /* prints the activities from activities table
-         * print_deactivated is a flag whether to print deactivated activities
+        /* hour of day by weekday grids per group and per activity, built
+         * from the raw segments of first_year..last_year, followed by the
+         * calendar of daily totals of last_year
          */
+        vector<Activity> const activities { storage.activities() };
+
+        vector<int> act_ids;
+        vector<int> grp_ids;
+        for (Activity const& act : activities) {
+            act_ids.push_back(act.id);
+            grp_ids.push_back(act.group);
+        }
+
+        STATS::DenseIndex const act_index(act_ids);
+        STATS::DenseIndex const grp_index(grp_ids);
+        size_t const na { act_index.size() };
+
+        // dense activity index -> grid entry of its group
+        vector<size_t> act_group(na);
+        for (size_t k {}; k < na; ++k) {
+            act_group[k] = na +
+                static_cast<size_t>(grp_index(activities[k].group));
+        }
+
+        long long const from { TIME::conv_datetime_to_epoch(
+                to_string(first_year) + "-01-01", "00:00:00") };
+        long long const to { TIME::conv_datetime_to_epoch(
+                to_string(last_year + 1) + "-01-01", "00:00:00") };
+
+        STATS::HourGrid grid(na + grp_index.size());
+        TIME::LocalOffset offset;
+        size_t segments {};
+
+        storage.stream_segments(from, to, [&](SegmentColumns const& c) {
+            segments += c.size();
+            for (size_t i {}; i < c.size(); ++i)
+            {
+                int a { act_index(c.activity[i]) };
+                if (a < 0) {
+                    continue;
+                }
+                long long local { c.start[i] + offset(c.start[i]) };
+                size_t k { static_cast<size_t>(a) };
+                grid.add(k, local, c.duration[i]);
+                grid.add(act_group[k], local, c.duration[i]);
+            }
+        });
 
-        soci::rowset<soci::row> activities =
-            sql.prepare << "SELECT * FROM activities";
+        cout << endl;
+
+        if (segments == 0) {
+            cout << "No work phases recorded in that range" << endl << endl;
+        }
+        else
+        {
+            cout << fmt::format("Hour of day by weekday, {} to {}:\n",
+                    first_year, last_year);
 
+            for (size_t g {}; g < grp_index.size(); ++g)
+            {
+                vector<double> hours { grid.finish(na + g) };
+                double total { accumulate(hours.begin(), hours.end(), 0.0) };
+                if (total <= 0) {
+                    continue;
+                }
+                cout << fmt::format("  Group {} ({:.2f} hours)\n",
+                        grp_index.id(g), total);
+                print_hour_grid(hours, "    ");
+            }
+
+            for (size_t k {}; k < na; ++k)
+            {
+                vector<double> hours { grid.finish(k) };
+                double total { accumulate(hours.begin(), hours.end(), 0.0) };
+                if (total <= 0) {
+                    continue;
+                }
+                cout << fmt::format("  Activity: {} ({:.2f} hours)\n",
+                        activities[k].name, total);
+                print_hour_grid(hours, "    ");
+            }
+            cout << endl;
+        }
+
+        print_calendar(storage, last_year);
+    }
+
+    void print_activities(STORAGE::Backend& storage,
+            bool const print_deactivated)
+    {
+        /* prints the activities from activities table
+         * print_deactivated is a flag whether to print deactivated activities
+         */
         cout << "\nActivities: \n\n";
 
         cout << fmt::format("{:<10}{:<10}{:<20}",
                 "id", "group", "name") << endl;
 
-        /* activities
-         * +----+----------+------+------------+--------------+-------------+
-         * | id | group_id | name | added_when | is_activated | hours_total |
-         * +----+----------+------+------------+--------------+-------------+
-         */
-
-        for (const soci::row& row : activities) {
-            if (!(row.get<int>("is_activated")) && !(print_deactivated))
+        for (Activity const& act : storage.activities()) {
+            if (!act.activated && !print_deactivated)
                 continue;
             cout << fmt::format("{:<10}{:<10}{:<20}",
-                    row.get<int>("id"),
-                    row.get<int>("group_id"),
-                    row.get<string>("name"));
+                    act.id, act.group, act.name);
 
-            if (!(row.get<int>("is_activated")))
+            if (!act.activated)
                 cout << "(deactivated)";
             cout << endl;
         }
         cout << endl << endl;
     }
 
-    void enter_work_time(
+    void print_groups(STORAGE::Backend& storage)
+    {
+        cout << "Groups: \n\n";
+        cout << fmt::format("{:<10}{:<10}{:<20}\n", "id", "parent", "name");
+        vector<Group> const groups { storage.groups() };
+        for (Group const& g : groups) {
+            cout << fmt::format("{:<10}{:<10}{:<20}\n", g.id,
+                    g.parent == 0 ? "-" : to_string(g.parent), g.name);
+        }
+        cout << endl;
+        print_group_tree(groups, nullptr, "");
+        cout << endl;
+    }
+
+    double enter_work_time(
             soci::session& sql,
             string const id,
             string const date,
@@ -228,7 +1064,17 @@ namespace SQL
     {
         // some basic sanity checks
         if ((date.length() != 10) || (hours < 0) || (stoi(id) < 0)) {
-            runtime_error("Failed input sanity checks for manual entry");
+            throw runtime_error("Failed input sanity checks for manual entry");
+        }
+        if (date > TIME::get_date_string()) {
+            throw runtime_error("Manual entry for " + date +
+                    " is in the future, not recorded");
+        }
+
+        // daily rows of that month are gone (RETENTION), so is the day
+        if (RETENTION::is_compacted(sql, date)) {
+            throw runtime_error("Daily history of " + date.substr(0, 7) +
+                    " isn't kept anymore, entry not recorded");
         }
 
         // round hours to four decimal places
@@ -245,20 +1091,29 @@ namespace SQL
 
         double hoursday { -1.0 };
 
+        // read-modify-write of the day and the total, concurrent writers
+        // must not slip in between
+        soci::transaction tr(sql);
+
+        // throws for a sealed year
+        string const table { partition(sql, date) };
+
         sql <<
-            "SELECT hours_on_day FROM history "
+            "SELECT hours_on_day FROM " + table + " "
             "WHERE id_activity = :id AND date = :date",
             soci::use(id), soci::use(date),
             soci::into(hoursday);
 
         if (hoursday == -1.0)
         {
+            // the user of the row is the one of its activity
             sql <<
-                "INSERT INTO history "
+                "INSERT INTO " + table + " "
                 "(id_activity, year, month, day, weeknumber, hours_on_day, "
-                "date) "
+                "date, user_id) "
                 "VALUES "
-                "(:id, :year, :month, :day, :wkno, :hours, :date)",
+                "(:id, :year, :month, :day, :wkno, :hours, :date, "
+                "(SELECT user_id FROM activities WHERE id = :id))",
                 soci::use(id),
                 soci::use(year),
                 soci::use(month),
@@ -269,16 +1124,18 @@ namespace SQL
         }
         else
         {
-            hours += hoursday;
+            hoursday += hours;
             sql <<
-                "UPDATE history "
+                "UPDATE " + table + " "
                 "SET hours_on_day = :hours "
                 "WHERE id_activity = :id AND date = :date",
-                soci::use(hours),
+                soci::use(hoursday),
                 soci::use(id),
                 soci::use(date);
         }
 
+        invalidate_stats(sql, date);
+
         // update hours value in activities table as well
         double total_hours {};
 
@@ -294,5 +1151,8 @@ namespace SQL
             "WHERE id = :id",
             soci::use(total_hours),
             soci::use(id);
+
+        tr.commit();
+        return hours;
     }
 }
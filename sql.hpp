@@ -2,27 +2,238 @@
 
 #include <soci/soci.h>
 
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "./filter.hpp"
+
+namespace STORAGE { class Backend; }
+
 namespace SQL {
 
-   void bootup(soci::session& sql); 
+   // rows pulled from sqlite per fetch() call in the bulk fetch functions
+   constexpr std::size_t FETCH_CHUNK { 4096 };
+
+   /* history rows of a date range, stored column-wise
+    * all vectors have the same length, row i is made up of element i of each
+    */
+   struct HistoryColumns
+   {
+       std::vector<int>    day;      // days since 1970-01-01
+       std::vector<int>    activity; // activities.id
+       std::vector<int>    group;    // activities.group_id
+       std::vector<double> hours;    // history.hours_on_day
+
+       std::size_t size() const { return hours.size(); }
+       bool empty() const { return hours.empty(); }
+   };
+
+   // segments never cross midnight, so none is longer than this (seconds)
+   constexpr long long MAX_SEGMENT { 24 * 60 * 60 };
+
+   /* rows of the segments table (one per work phase, split at midnight),
+    * stored column-wise like HistoryColumns
+    */
+   struct SegmentColumns
+   {
+       std::vector<long long> start;    // unix time, seconds
+       std::vector<int>       activity; // activities.id
+       std::vector<int>       duration; // seconds
+
+       std::size_t size() const { return start.size(); }
+       bool empty() const { return start.empty(); }
+   };
+
+   // one row of the activities table
+   struct Activity
+   {
+       int         id;
+       int         group;
+       std::string name;
+       bool        activated;
+       double      hours_total;
+   };
+
+   // one row of the activity_groups table
+   struct Group
+   {
+       int         id;
+       int         parent;      // 0 for a top level group
+       std::string name;
+       double      hours_total; // of the whole subtree
+   };
+
+   // first start, asks for the activities to track
+   void bootup(STORAGE::Backend& storage);
+
+   /* users are ids of the users table, several people can share one db
+    * wherever a function takes users, none means all of them
+    */
+
+   // id of the user called name, who is added if there's none yet
+   int ensure_user(soci::session& sql, std::string const& name);
+
+   // condition on column limiting a query to users, binds :users (see .cpp)
+   std::string user_clause(std::string const& column,
+           std::vector<int> const& users);
 
-   soci::rowset<soci::row> get_dates_data(
+   /* routing of daily history to its partitions (SCHEMA::partition_table)
+    * partition() is the table a row of date is written to, created the
+    * first time its year shows up; throws if the year is sealed unless
+    * sealed_ok (sync merging what a peer wrote before, the partition's
+    * triggers still guard everything else)
+    */
+   std::string partition(
            soci::session& sql,
-           std::vector<std::string> const& dates
+           std::string const& date,
+           bool const sealed_ok = false
            );
 
-   void print_stats(
+   // partitions with rows of first..last, oldest first
+   std::vector<std::string> partitions(
            soci::session& sql,
-           soci::rowset<soci::row> const& data,
-           int const days
+           std::string const& first,
+           std::string const& last
            );
 
-   void print_activities(
+   // oldest date of daily history (not history_monthly), "" if none
+   std::string oldest_day(
            soci::session& sql,
+           std::vector<int> const& users = {}
+           );
+
+   std::vector<Activity> get_activities(
+           soci::session& sql,
+           std::vector<int> const& users = {}
+           );
+
+   void stream_dates_data(
+           soci::session& sql,
+           std::string const& first,
+           std::string const& last,
+           std::function<void(HistoryColumns const&)> const& consume,
+           std::vector<int> const& users = {}
+           );
+
+   /* stream_dates_data restricted by a filter, on one table (history or
+    * history_monthly, the latter only knows about activities and groups)
+    * the statement is prepared once (per partition of history) and every
+    * stream() only binds new values, so all filters share one plan: the
+    * parts a filter leaves out are switched off by a flag that
+    * short-circuits per row
+    * the statements bind to the members, so it can't be copied or moved
+    */
+   class FilteredDays
+   {
+   public:
+       FilteredDays(soci::session& sql, std::string const& table,
+               std::vector<int> const& users = {});
+       FilteredDays(FilteredDays const&) = delete;
+       FilteredDays& operator=(FilteredDays const&) = delete;
+
+       void stream(
+               std::string const& first,
+               std::string const& last,
+               FILTER::Filter const& filter,
+               std::function<void(HistoryColumns const&)> const& consume
+               );
+
+   private:
+       soci::statement prepare(std::string const& table);
+
+       soci::session&   sql_;
+       std::string      table_;
+       std::vector<int> user_ids_;
+       std::string first_;
+       std::string last_;
+       std::string users_;        // FILTER::id_list, fixed when prepared
+       std::string activities_;   // FILTER::id_list
+       std::string groups_;
+       int         any_activity_ {};
+       int         any_group_ {};
+       int         any_weekday_ {};
+       int         any_week_ {};
+       long long   weekdays_ {};
+       long long   weeks_ {};
+       double      min_hours_ {};
+       HistoryColumns  chunk_;
+       std::map<std::string, soci::statement> st_; // by table
+   };
+
+   HistoryColumns get_dates_data(
+           soci::session& sql,
+           std::string const& first,
+           std::string const& last
+           );
+
+   void add_segment(
+           soci::session& sql,
+           int const activity,
+           long long const start,
+           int const duration
+           );
+
+   // segments starting in [from, to), ordered by start
+   void stream_segments(
+           soci::session& sql,
+           long long const from,
+           long long const to,
+           std::function<void(SegmentColumns const&)> const& consume,
+           std::vector<int> const& users = {}
+           );
+
+   // segments overlapping [from, to) (possibly starting before from)
+   void stream_overlapping_segments(
+           soci::session& sql,
+           long long const from,
+           long long const to,
+           std::function<void(SegmentColumns const&)> const& consume
+           );
+
+   SegmentColumns get_segments(
+           soci::session& sql,
+           long long const from,
+           long long const to,
+           bool const overlapping
+           );
+
+   void invalidate_stats(soci::session& sql, std::string const& date);
+   void invalidate_stats(
+           soci::session& sql,
+           std::string const& first,
+           std::string const& last
+           );
+
+   // filtered reports bypass the stats cache, its blocks hold every row
+   void print_stats(
+           STORAGE::Backend& storage,
+           std::string const& first,
+           std::string const& last,
+           FILTER::Filter const& filter = {}
+           );
+
+   void print_heatmap(
+           STORAGE::Backend& storage,
+           int const first_year,
+           int const last_year
+           );
+
+   void print_activities(
+           STORAGE::Backend& storage,
            bool const print_deactivated
            );
 
-   void enter_work_time(
+   // group ids, parents and names, then the tree with all time totals
+   void print_groups(STORAGE::Backend& storage);
+
+   /* adds hours to one day of activity id, returns the hours stored
+    * (rounded); throws if the day is in the future or its month was
+    * compacted (RETENTION)
+    */
+   double enter_work_time(
            soci::session& sql,
            std::string const id,
            std::string const date,
@@ -0,0 +1,1246 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STATS_X86
+#endif
+
+#include "./stats.hpp"
+#include "./time.hpp"
+#include "./writer.hpp"
+
+using namespace std;
+
+namespace STATS
+{
+    DenseIndex::DenseIndex(vector<int> ids)
+    {
+        sort(ids.begin(), ids.end());
+        ids.erase(unique(ids.begin(), ids.end()), ids.end());
+        ids_ = move(ids);
+
+        if (ids_.empty()) {
+            return;
+        }
+
+        /* ids are usually small and close together (INTEGER PRIMARY KEY,
+         * hand picked group numbers), a direct lookup table is cheapest then;
+         * for very sparse ids we fall back to binary search over ids_
+         */
+        min_ = ids_.front();
+        long long span { static_cast<long long>(ids_.back()) - min_ + 1 };
+
+        if (span <= static_cast<long long>(4 * ids_.size() + 1024))
+        {
+            lut_.assign(static_cast<size_t>(span), -1);
+            for (size_t i {}; i < ids_.size(); ++i) {
+                lut_[static_cast<size_t>(ids_[i] - min_)] =
+                    static_cast<int>(i);
+            }
+        }
+    }
+
+    int DenseIndex::operator()(int const id) const
+    {
+        if (!lut_.empty())
+        {
+            if (id < min_) {
+                return -1;
+            }
+            size_t off { static_cast<size_t>(id - min_) };
+            return off < lut_.size() ? lut_[off] : -1;
+        }
+
+        auto it = lower_bound(ids_.begin(), ids_.end(), id);
+        if (it == ids_.end() || *it != id) {
+            return -1;
+        }
+        return static_cast<int>(it - ids_.begin());
+    }
+
+    static double sum_scalar(double const* v, size_t const n)
+    {
+        // four independent accumulators so the adds can overlap
+        double a0 {}, a1 {}, a2 {}, a3 {};
+        size_t i {};
+        for (; i + 4 <= n; i += 4) {
+            a0 += v[i];
+            a1 += v[i + 1];
+            a2 += v[i + 2];
+            a3 += v[i + 3];
+        }
+        for (; i < n; ++i) {
+            a0 += v[i];
+        }
+        return (a0 + a1) + (a2 + a3);
+    }
+
+#ifdef STATS_X86
+    __attribute__((target("sse2")))
+    static double sum_sse2(double const* v, size_t const n)
+    {
+        __m128d a0 { _mm_setzero_pd() };
+        __m128d a1 { _mm_setzero_pd() };
+        size_t i {};
+        for (; i + 4 <= n; i += 4) {
+            a0 = _mm_add_pd(a0, _mm_loadu_pd(v + i));
+            a1 = _mm_add_pd(a1, _mm_loadu_pd(v + i + 2));
+        }
+        a0 = _mm_add_pd(a0, a1);
+        a0 = _mm_add_sd(a0, _mm_unpackhi_pd(a0, a0));
+
+        double s { _mm_cvtsd_f64(a0) };
+        for (; i < n; ++i) {
+            s += v[i];
+        }
+        return s;
+    }
+
+    __attribute__((target("avx2")))
+    static double sum_avx2(double const* v, size_t const n)
+    {
+        __m256d a0 { _mm256_setzero_pd() };
+        __m256d a1 { _mm256_setzero_pd() };
+        __m256d a2 { _mm256_setzero_pd() };
+        __m256d a3 { _mm256_setzero_pd() };
+        size_t i {};
+        for (; i + 16 <= n; i += 16) {
+            a0 = _mm256_add_pd(a0, _mm256_loadu_pd(v + i));
+            a1 = _mm256_add_pd(a1, _mm256_loadu_pd(v + i + 4));
+            a2 = _mm256_add_pd(a2, _mm256_loadu_pd(v + i + 8));
+            a3 = _mm256_add_pd(a3, _mm256_loadu_pd(v + i + 12));
+        }
+        for (; i + 4 <= n; i += 4) {
+            a0 = _mm256_add_pd(a0, _mm256_loadu_pd(v + i));
+        }
+        a0 = _mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3));
+
+        __m128d lo { _mm256_castpd256_pd128(a0) };
+        __m128d hi { _mm256_extractf128_pd(a0, 1) };
+        lo = _mm_add_pd(lo, hi);
+        lo = _mm_add_sd(lo, _mm_unpackhi_pd(lo, lo));
+
+        double s { _mm_cvtsd_f64(lo) };
+        for (; i < n; ++i) {
+            s += v[i];
+        }
+        return s;
+    }
+#endif
+
+    double sum(double const* values, size_t const n)
+    {
+        /* picks the widest kernel the cpu supports once, on first call
+         */
+        using kernel = double (*)(double const*, size_t);
+        static kernel const fn = []() -> kernel {
+#ifdef STATS_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return sum_avx2;
+            if (__builtin_cpu_supports("sse2")) return sum_sse2;
+#endif
+            return sum_scalar;
+        }();
+
+        return fn(values, n);
+    }
+
+    void aggregate(
+            vector<int> const& keys,
+            vector<double> const& values,
+            DenseIndex const& index,
+            Totals& totals)
+    {
+        /* sums values per key into flat arrays indexed by dense key
+         * rows are processed in blocks small enough to stay in cache:
+         * -) map keys to dense indices and count rows per index
+         * -) if the block is already grouped by key (e.g. ORDER BY id) its
+         *    runs are summed in place, otherwise the values are bucketed by
+         *    a counting sort into a reused buffer first
+         * -) each bucket is then one contiguous run, summed with sum()
+         * this way the reduction itself never scatters into the output
+         * keys without an entry in index are skipped
+         */
+        size_t const BLOCK { 4096 };
+        size_t const n { index.size() };
+
+        if (totals.sum.size() != n)
+        {
+            totals.sum.assign(n, 0.0);
+            totals.rows.assign(n, 0);
+        }
+
+        vector<int>    dense(min(BLOCK, keys.size()));
+        vector<size_t> count(n);
+        vector<size_t> offset(n + 1);
+        vector<size_t> pos(n);
+        vector<double> bucketed(dense.size());
+
+        for (size_t b {}; b < keys.size(); b += BLOCK)
+        {
+            size_t const len { min(BLOCK, keys.size() - b) };
+            bool grouped { true };
+            int  prev    { -1 };
+
+            fill(count.begin(), count.end(), 0);
+            for (size_t i {}; i < len; ++i)
+            {
+                int d { index(keys[b + i]) };
+                dense[i] = d;
+                if (d < 0) {
+                    grouped = false;
+                    continue;
+                }
+                ++count[static_cast<size_t>(d)];
+                grouped = grouped && d >= prev;
+                prev = d;
+            }
+
+            offset[0] = 0;
+            for (size_t k {}; k < n; ++k) {
+                offset[k + 1] = offset[k] + count[k];
+            }
+
+            double const* runs { values.data() + b };
+
+            if (!grouped)
+            {
+                copy(offset.begin(), offset.end() - 1, pos.begin());
+                for (size_t i {}; i < len; ++i) {
+                    if (dense[i] >= 0) {
+                        bucketed[pos[static_cast<size_t>(dense[i])]++] =
+                            values[b + i];
+                    }
+                }
+                runs = bucketed.data();
+            }
+
+            for (size_t k {}; k < n; ++k)
+            {
+                if (count[k] == 0) {
+                    continue;
+                }
+                totals.sum[k]  += sum(runs + offset[k], count[k]);
+                totals.rows[k] += count[k];
+            }
+        }
+    }
+
+    void DaySketch::add(double const hours, uint32_t const days)
+    {
+        double b { round(hours * 60 / SKETCH_MINUTES) };
+        size_t bin { 0 };
+        if (b >= static_cast<double>(SKETCH_BINS - 1)) {
+            bin = SKETCH_BINS - 1;
+        }
+        else if (b > 0) {
+            bin = static_cast<size_t>(b);
+        }
+        bins_[bin] += days;
+        count_ += days;
+    }
+
+    void DaySketch::set_bin(size_t const i, uint32_t const days)
+    {
+        count_ -= bins_[i];
+        bins_[i] = days;
+        count_ += days;
+    }
+
+    void DaySketch::merge(DaySketch const& other)
+    {
+        for (size_t i {}; i < SKETCH_BINS; ++i) {
+            bins_[i] += other.bins_[i];
+        }
+        count_ += other.count_;
+    }
+
+    double DaySketch::quantile(double const q) const
+    {
+        if (count_ == 0) {
+            return 0.0;
+        }
+
+        // rank of the wanted day, 1 based
+        uint64_t rank {
+            static_cast<uint64_t>(ceil(q * static_cast<double>(count_))) };
+        rank = clamp(rank, uint64_t { 1 }, count_);
+
+        uint64_t seen {};
+        for (size_t i {}; i < SKETCH_BINS; ++i)
+        {
+            seen += bins_[i];
+            if (seen >= rank) {
+                return static_cast<double>(i * SKETCH_MINUTES) / 60.0;
+            }
+        }
+        return static_cast<double>((SKETCH_BINS - 1) * SKETCH_MINUTES) / 60.0;
+    }
+
+    void Accumulator::add_day(double const hours)
+    {
+        recent[static_cast<size_t>(days) % RECENT_DAYS] = hours;
+        ++days;
+        sketch.add(hours);
+
+        if (hours > 0)
+        {
+            ++active_days;
+            sum += hours;
+            ++tail_run;
+            // every day so far was active, the first streak keeps growing
+            if (head_run == days - 1) {
+                head_run = days;
+            }
+            longest = max(longest, tail_run);
+        }
+        else {
+            tail_run = 0;
+        }
+    }
+
+    void Accumulator::add_zero_days(int const n)
+    {
+        if (n <= 0) {
+            return;
+        }
+
+        sketch.add(0.0, static_cast<uint32_t>(n));
+
+        // only the last RECENT_DAYS of them can still be in the ring
+        int const R { static_cast<int>(RECENT_DAYS) };
+        for (int j { max(0, n - R) }; j < n; ++j) {
+            recent[static_cast<size_t>(days + j) % RECENT_DAYS] = 0.0;
+        }
+
+        days += n;
+        tail_run = 0;
+    }
+
+    void Accumulator::merge(Accumulator const& later)
+    {
+        /* appends the range of later (which has to start the day after this
+         * one ends) to this accumulator
+         */
+        longest = max({ longest, later.longest, tail_run + later.head_run });
+
+        if (head_run == days) {
+            head_run = days + later.head_run;
+        }
+        if (later.tail_run == later.days) {
+            tail_run += later.days;
+        }
+        else {
+            tail_run = later.tail_run;
+        }
+
+        int const R { static_cast<int>(RECENT_DAYS) };
+        for (int j { max(0, later.days - R) }; j < later.days; ++j) {
+            recent[static_cast<size_t>(days + j) % RECENT_DAYS] =
+                later.recent[static_cast<size_t>(j) % RECENT_DAYS];
+        }
+
+        days        += later.days;
+        active_days += later.active_days;
+        sum         += later.sum;
+        sketch.merge(later.sketch);
+    }
+
+    double Accumulator::last_days(int const n, int const skip) const
+    {
+        double hours {};
+        for (int i { max(0, days - skip - n) }; i < days - skip; ++i) {
+            hours += recent[static_cast<size_t>(i) % RECENT_DAYS];
+        }
+        return hours;
+    }
+
+    Summary summarize(Accumulator const& acc)
+    {
+        Summary s {};
+        s.sum            = acc.sum;
+        s.mean           = acc.days ? acc.sum / acc.days : 0.0;
+        s.median         = acc.sketch.quantile(0.5);
+        s.p90            = acc.sketch.quantile(0.9);
+        s.active_days    = acc.active_days;
+        s.longest_streak = acc.longest;
+        s.current_streak = acc.tail_run;
+
+        int const d7  { min(acc.days, 7) };
+        int const d30 { min(acc.days, 30) };
+        s.avg7  = d7  ? acc.last_days(7)  / d7  : 0.0;
+        s.avg30 = d30 ? acc.last_days(30) / d30 : 0.0;
+
+        s.week       = acc.last_days(7);
+        s.week_delta = s.week - acc.last_days(7, 7);
+        return s;
+    }
+
+    Engine::Engine(int const first_day, int const last_day,
+            DenseIndex const& activities, DenseIndex const& groups)
+        : first_day_ { first_day },
+          last_day_ { last_day },
+          activities_ { &activities },
+          groups_ { &groups },
+          entries_(activities.size() + groups.size(), Entry { {}, first_day })
+    {
+    }
+
+    void Engine::add(SQL::HistoryColumns const& rows)
+    {
+        for (size_t i {}; i < rows.size(); ++i) {
+            add(rows.day[i], rows.activity[i], rows.group[i], rows.hours[i]);
+        }
+    }
+
+    void Engine::add(int const day, int const activity, int const group,
+            double const hours)
+    {
+        if (day < first_day_ || day > last_day_) {
+            return;
+        }
+
+        int a { (*activities_)(activity) };
+        if (a >= 0) {
+            add_to(entries_[static_cast<size_t>(a)], day, hours);
+        }
+
+        int g { (*groups_)(group) };
+        if (g >= 0) {
+            add_to(entries_[activities_->size() + static_cast<size_t>(g)],
+                    day, hours);
+        }
+    }
+
+    void Engine::add_to(Entry& e, int const day, double const hours)
+    {
+        if (day != e.open_day) {
+            close(e, day);
+        }
+        e.open_hours += hours;
+    }
+
+    void Engine::close(Entry& e, int const until)
+    {
+        /* commits the open day and zero days for the gap up to (excluding)
+         * until, which becomes the new open day
+         */
+        e.acc.add_day(e.open_hours);
+        e.acc.add_zero_days(until - e.open_day - 1);
+        e.open_day   = until;
+        e.open_hours = 0.0;
+    }
+
+    void Engine::finish(void)
+    {
+        for (Entry& e : entries_) {
+            if (e.open_day <= last_day_) {
+                close(e, last_day_ + 1);
+            }
+        }
+    }
+
+    Accumulator const& Engine::activity(size_t const k) const
+    {
+        return entries_[k].acc;
+    }
+
+    Accumulator const& Engine::group(size_t const k) const
+    {
+        return entries_[activities_->size() + k].acc;
+    }
+
+    vector<Accumulator> Engine::accumulators(void) const
+    {
+        vector<Accumulator> accs;
+        accs.reserve(entries_.size());
+        for (Entry const& e : entries_) {
+            accs.push_back(e.acc);
+        }
+        return accs;
+    }
+
+    string encode(vector<Accumulator> const& accs)
+    {
+        /* per accumulator, space separated:
+         * days active_days sum longest head_run tail_run
+         * <n> n x (bin days)   <m> m x ring value (oldest first)
+         */
+        string text { to_string(accs.size()) };
+        char buf[64];
+
+        for (Accumulator const& a : accs)
+        {
+            snprintf(buf, sizeof(buf), " %d %d %.17g %d %d %d",
+                    a.days, a.active_days, a.sum,
+                    a.longest, a.head_run, a.tail_run);
+            text += buf;
+
+            size_t bins {};
+            for (size_t i {}; i < SKETCH_BINS; ++i) {
+                bins += a.sketch.bin(i) ? 1 : 0;
+            }
+            text += " " + to_string(bins);
+            for (size_t i {}; i < SKETCH_BINS; ++i) {
+                if (a.sketch.bin(i)) {
+                    text += " " + to_string(i) + " " +
+                        to_string(a.sketch.bin(i));
+                }
+            }
+
+            int const m { min(a.days, static_cast<int>(RECENT_DAYS)) };
+            text += " " + to_string(m);
+            for (int j { a.days - m }; j < a.days; ++j) {
+                snprintf(buf, sizeof(buf), " %.17g",
+                        a.recent[static_cast<size_t>(j) % RECENT_DAYS]);
+                text += buf;
+            }
+        }
+        return text;
+    }
+
+    bool decode(string const& text, vector<Accumulator>& accs)
+    {
+        istringstream in(text);
+        size_t n {};
+        if (!(in >> n)) {
+            return false;
+        }
+
+        accs.assign(n, Accumulator {});
+        for (Accumulator& a : accs)
+        {
+            size_t bins {};
+            if (!(in >> a.days >> a.active_days >> a.sum >>
+                        a.longest >> a.head_run >> a.tail_run >> bins)) {
+                return false;
+            }
+            for (size_t b {}; b < bins; ++b)
+            {
+                size_t i {};
+                uint32_t days {};
+                if (!(in >> i >> days) || i >= SKETCH_BINS) {
+                    return false;
+                }
+                a.sketch.set_bin(i, days);
+            }
+
+            int m {};
+            if (!(in >> m) || m < 0 || m > static_cast<int>(RECENT_DAYS)) {
+                return false;
+            }
+            for (int j { a.days - m }; j < a.days; ++j) {
+                if (!(in >> a.recent[static_cast<size_t>(j) % RECENT_DAYS])) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    vector<Accumulator> const* Cache::find(
+            int const first_day, int const last_day, int const granularity)
+    {
+        tuple<int, int, int> const key { first_day, last_day, granularity };
+
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            it->second.used = ++tick_;
+            return &it->second.accs;
+        }
+
+        vector<Accumulator> accs;
+        if (backing_.load &&
+                backing_.load(first_day, last_day, granularity, accs))
+        {
+            insert(key, move(accs));
+            return &entries_[key].accs;
+        }
+        return nullptr;
+    }
+
+    void Cache::store(int const first_day, int const last_day,
+            int const granularity, vector<Accumulator> accs)
+    {
+        if (backing_.save) {
+            backing_.save(first_day, last_day, granularity, accs);
+        }
+        insert({ first_day, last_day, granularity }, move(accs));
+    }
+
+    void Cache::insert(tuple<int, int, int> const& key,
+            vector<Accumulator> accs)
+    {
+        if (entries_.size() >= CAPACITY)
+        {
+            auto lru = min_element(entries_.begin(), entries_.end(),
+                    [](auto const& a, auto const& b) {
+                        return a.second.used < b.second.used;
+                    });
+            entries_.erase(lru);
+        }
+        entries_[key] = Entry { move(accs), ++tick_ };
+    }
+
+    void Cache::invalidate(int const first_day, int const last_day)
+    {
+        for (auto it = entries_.begin(); it != entries_.end(); )
+        {
+            auto const& [first, last, granularity] = it->first;
+            if (first <= last_day && first_day <= last) {
+                it = entries_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    void Cache::reset(vector<int> const& activities, vector<int> const& groups)
+    {
+        if (activities != activities_ || groups != groups_)
+        {
+            entries_.clear();
+            activities_ = activities;
+            groups_     = groups;
+        }
+    }
+
+    Cache& cache(void)
+    {
+        static Cache c;
+        return c;
+    }
+
+    int block_start(int const day, int const granularity)
+    {
+        // epoch day 4 (1970-01-05) is a Monday, blocks are aligned to it
+        int off { (day - 4) % granularity };
+        if (off < 0) {
+            off += granularity;
+        }
+        return day - off;
+    }
+
+    // rows of the whole blocks start..run_end into one Engine per block
+    class BlockSplit
+    {
+    public:
+        BlockSplit(int const start, int const run_end, int const granularity,
+                DenseIndex const& activities, DenseIndex const& groups)
+            : run_end_ { run_end }, granularity_ { granularity },
+              blk_ { start }, activities_ { &activities },
+              groups_ { &groups },
+              engine_(start, start + granularity - 1, activities, groups)
+        {
+        }
+
+        void add(SQL::HistoryColumns const& c)
+        {
+            for (size_t i {}; i < c.size(); ++i)
+            {
+                while (c.day[i] >= blk_ + granularity_) {
+                    close_block();
+                }
+                engine_.add(c.day[i], c.activity[i], c.group[i], c.hours[i]);
+            }
+        }
+
+        // accumulators of each block, in order
+        vector<vector<Accumulator>> finish(void)
+        {
+            while (blk_ <= run_end_) {
+                close_block();
+            }
+            return move(blocks_);
+        }
+
+    private:
+        void close_block(void)
+        {
+            engine_.finish();
+            blocks_.push_back(engine_.accumulators());
+            blk_ += granularity_;
+            if (blk_ <= run_end_) {
+                engine_ = Engine(blk_, blk_ + granularity_ - 1, *activities_,
+                        *groups_);
+            }
+        }
+
+        int run_end_;
+        int granularity_;
+        int blk_;
+        DenseIndex const* activities_;
+        DenseIndex const* groups_;
+        Engine engine_;
+        vector<vector<Accumulator>> blocks_;
+    };
+
+    static vector<vector<Accumulator>> scan_blocks(
+            int const start, int const run_end, int const granularity,
+            DenseIndex const& activities, DenseIndex const& groups,
+            Scan const& scan)
+    {
+        /* accumulators of each of the whole blocks start..run_end, from a
+         * single query whose rows are split into one Engine per block
+         */
+        BlockSplit split(start, run_end, granularity, activities, groups);
+        scan(start, run_end, [&split](SQL::HistoryColumns const& c) {
+            split.add(c);
+        });
+        return split.finish();
+    }
+
+    static vector<vector<Accumulator>> pipeline_blocks(
+            int const start, int const run_end, int const granularity,
+            DenseIndex const& activities, DenseIndex const& groups,
+            Scan const& scan, size_t const workers)
+    {
+        /* scan_blocks through pipeline(): every sink sees only the rows of
+         * its groups, so an activity or group has its hours in exactly one
+         * sink and is empty in the others; the merge takes, per block and
+         * entry, the sink it isn't empty in
+         */
+        vector<BlockSplit> splits;
+        vector<Sink> sinks;
+        splits.reserve(workers);
+        for (size_t w {}; w < workers; ++w) {
+            splits.emplace_back(start, run_end, granularity, activities,
+                    groups);
+        }
+        for (BlockSplit& split : splits) {
+            sinks.push_back([&split](SQL::HistoryColumns const& c) {
+                split.add(c);
+            });
+        }
+
+        pipeline(scan, start, run_end, groups, sinks);
+
+        vector<vector<vector<Accumulator>>> parts;
+        for (BlockSplit& split : splits) {
+            parts.push_back(split.finish());
+        }
+        vector<vector<Accumulator>> blocks { move(parts[0]) };
+        for (size_t b {}; b < blocks.size(); ++b)
+        {
+            for (size_t k {}; k < blocks[b].size(); ++k)
+            {
+                for (size_t w { 1 }; w < parts.size(); ++w)
+                {
+                    Accumulator& acc { parts[w][b][k] };
+                    if (acc.active_days > 0 || acc.sum != 0) {
+                        blocks[b][k] = move(acc);
+                        break;
+                    }
+                }
+            }
+        }
+        return blocks;
+    }
+
+    void pipeline(Scan const& scan, int const first_day, int const last_day,
+            DenseIndex const& groups, vector<Sink> const& sinks)
+    {
+        /* one lane per sink: PIPELINE_DEPTH chunks that go round from the
+         * fetch (full) to the sink and back (empty), both ways through an
+         * SPSC ring, nullptr on full marks the end
+         * a failing sink keeps taking chunks (without looking at them) so
+         * the fetch never blocks for good; failures are rethrown at the end
+         */
+        struct Lane
+        {
+            WRITER::Ring<SQL::HistoryColumns*, PIPELINE_DEPTH> full;
+            WRITER::Ring<SQL::HistoryColumns*, PIPELINE_DEPTH> empty;
+            array<SQL::HistoryColumns, PIPELINE_DEPTH> pool;
+            SQL::HistoryColumns* filling {};
+            exception_ptr failed;
+        };
+
+        size_t const n { sinks.size() };
+        vector<unique_ptr<Lane>> lanes;
+        for (size_t w {}; w < n; ++w)
+        {
+            lanes.push_back(make_unique<Lane>());
+            for (SQL::HistoryColumns& chunk : lanes.back()->pool)
+            {
+                chunk.day.reserve(SQL::FETCH_CHUNK);
+                chunk.activity.reserve(SQL::FETCH_CHUNK);
+                chunk.group.reserve(SQL::FETCH_CHUNK);
+                chunk.hours.reserve(SQL::FETCH_CHUNK);
+                lanes.back()->empty.push(&chunk);
+            }
+            lanes.back()->filling = lanes.back()->empty.pop();
+        }
+
+        exception_ptr fetch_failed;
+        thread fetch([&]() {
+            try
+            {
+                scan(first_day, last_day, [&](SQL::HistoryColumns const& c) {
+                    for (size_t i {}; i < c.size(); ++i)
+                    {
+                        int const g { groups(c.group[i]) };
+                        Lane& lane { *lanes[g < 0 ? 0 :
+                            static_cast<size_t>(g) % n] };
+                        SQL::HistoryColumns& to { *lane.filling };
+                        to.day.push_back(c.day[i]);
+                        to.activity.push_back(c.activity[i]);
+                        to.group.push_back(c.group[i]);
+                        to.hours.push_back(c.hours[i]);
+                        if (to.size() == SQL::FETCH_CHUNK) {
+                            lane.full.push(lane.filling);
+                            lane.filling = lane.empty.pop();
+                        }
+                    }
+                });
+            }
+            catch (...) {
+                fetch_failed = current_exception();
+            }
+            for (unique_ptr<Lane>& lane : lanes)
+            {
+                if (!lane->filling->empty()) {
+                    lane->full.push(lane->filling);
+                }
+                lane->full.push(nullptr);
+            }
+        });
+
+        auto drain = [&](size_t const w) {
+            Lane& lane { *lanes[w] };
+            while (SQL::HistoryColumns* chunk { lane.full.pop() })
+            {
+                if (!lane.failed)
+                {
+                    try {
+                        sinks[w](*chunk);
+                    }
+                    catch (...) {
+                        lane.failed = current_exception();
+                    }
+                }
+                chunk->day.clear();
+                chunk->activity.clear();
+                chunk->group.clear();
+                chunk->hours.clear();
+                lane.empty.push(chunk);
+            }
+        };
+
+        vector<thread> workers;
+        for (size_t w { 1 }; w < n; ++w) {
+            workers.emplace_back(drain, w);
+        }
+        drain(0);
+        for (thread& t : workers) {
+            t.join();
+        }
+        fetch.join();
+
+        if (fetch_failed) {
+            rethrow_exception(fetch_failed);
+        }
+        for (unique_ptr<Lane> const& lane : lanes) {
+            if (lane->failed) {
+                rethrow_exception(lane->failed);
+            }
+        }
+    }
+
+    static vector<vector<Accumulator>> scan_partitions(
+            int const start, int const run_end, int const granularity,
+            DenseIndex const& activities, DenseIndex const& groups,
+            vector<Scan> const& parallel)
+    {
+        /* the blocks are cut into one part per year (history_yyyy, see
+         * SQL::partition), a block going with the year it starts in, so a
+         * part reads its own partition and at most a few days of the next;
+         * workers (one per scan) take the next part until none is left;
+         * every part ends on a block boundary, so the parts' blocks simply
+         * line up again afterwards
+         */
+        int const blocks { (run_end - start + 1) / granularity };
+
+        // first block of every part, and one past the last
+        vector<int> cuts { 0 };
+        string year { TIME::conv_epoch_day_to_date(start).substr(0, 4) };
+        for (int b { 1 }; b < blocks; ++b)
+        {
+            string const y { TIME::conv_epoch_day_to_date(
+                    start + b * granularity).substr(0, 4) };
+            if (y != year) {
+                cuts.push_back(b);
+                year = y;
+            }
+        }
+        cuts.push_back(blocks);
+        size_t const parts { cuts.size() - 1 };
+
+        vector<vector<vector<Accumulator>>> done(parts);
+        vector<exception_ptr> failed(parallel.size());
+        atomic<size_t> next {};
+
+        auto work = [&](size_t const w) {
+            try
+            {
+                for (size_t p { next++ }; p < parts; p = next++)
+                {
+                    int const first { start + cuts[p] * granularity };
+                    int const last  { start + cuts[p + 1] * granularity - 1 };
+                    done[p] = scan_blocks(first, last, granularity,
+                            activities, groups, parallel[w]);
+                }
+            }
+            catch (...) {
+                failed[w] = current_exception();
+            }
+        };
+
+        size_t const workers { min(parallel.size(), parts) };
+        vector<thread> threads;
+        for (size_t w { 1 }; w < workers; ++w) {
+            threads.emplace_back(work, w);
+        }
+        work(0);
+        for (thread& t : threads) {
+            t.join();
+        }
+        for (exception_ptr const& e : failed) {
+            if (e) {
+                rethrow_exception(e);
+            }
+        }
+
+        vector<vector<Accumulator>> all;
+        all.reserve(static_cast<size_t>(blocks));
+        for (vector<vector<Accumulator>>& part : done) {
+            move(part.begin(), part.end(), back_inserter(all));
+        }
+        return all;
+    }
+
+    vector<Accumulator> collect(
+            int const first_day, int const last_day, int const granularity,
+            DenseIndex const& activities, DenseIndex const& groups,
+            Scan const& scan, vector<Scan> const& parallel,
+            size_t const workers)
+    {
+        /* walks first..last block by block and merges the accumulators
+         * -) partial blocks (range doesn't cover them fully) are scanned
+         * -) whole blocks are taken from the cache; a run of consecutive
+         *    missing blocks is scanned with a single query (or one per
+         *    partition, in parallel, or pipelined), split into one Engine
+         *    per block and every block gets stored
+         * so "last 30 days" followed by "last 31 days" only rescans the
+         * partial blocks at the edges
+         */
+        size_t const n { activities.size() + groups.size() };
+        vector<Accumulator> result(n);
+
+        auto append = [&result](vector<Accumulator> const& part) {
+            for (size_t k {}; k < part.size(); ++k) {
+                result[k].merge(part[k]);
+            }
+        };
+
+        auto block_covered = [&](int const start) {
+            return start >= first_day && start + granularity - 1 <= last_day;
+        };
+
+        int day { first_day };
+        while (day <= last_day)
+        {
+            int const start { block_start(day, granularity) };
+            int const end   { start + granularity - 1 };
+
+            if (!block_covered(start))
+            {
+                int const until { min(last_day, end) };
+                Engine engine(day, until, activities, groups);
+                scan(day, until, [&engine](SQL::HistoryColumns const& c) {
+                    engine.add(c);
+                });
+                engine.finish();
+                append(engine.accumulators());
+                day = until + 1;
+                continue;
+            }
+
+            if (vector<Accumulator> const* hit {
+                    cache().find(start, end, granularity) })
+            {
+                append(*hit);
+                day = end + 1;
+                continue;
+            }
+
+            // extend over all following whole blocks that are missing too
+            int run_end { end };
+            while (block_covered(run_end + 1) &&
+                    !cache().find(run_end + 1, run_end + granularity,
+                        granularity)) {
+                run_end += granularity;
+            }
+
+            vector<vector<Accumulator>> blocks;
+            if (parallel.size() > 1 && run_end - start >= PARTITION_DAYS) {
+                blocks = scan_partitions(start, run_end, granularity,
+                        activities, groups, parallel);
+            }
+            else if (workers > 0 && !parallel.empty() &&
+                    run_end - start >= PIPELINE_DAYS) {
+                blocks = pipeline_blocks(start, run_end, granularity,
+                        activities, groups, parallel.front(), workers);
+            }
+            else {
+                blocks = scan_blocks(start, run_end, granularity,
+                        activities, groups, scan);
+            }
+
+            int blk { start };
+            for (vector<Accumulator>& accs : blocks)
+            {
+                append(accs);
+                cache().store(blk, blk + granularity - 1, granularity,
+                        move(accs));
+                blk += granularity;
+            }
+
+            day = run_end + 1;
+        }
+
+        return result;
+    }
+
+    Fenwick::Fenwick(int const origin, vector<double> const& hours)
+        : origin_ { origin }
+    {
+        // every node passes its sum on to its parent once, O(n)
+        tree_.reserve(hours.size() + 1);
+        tree_.insert(tree_.end(), hours.begin(), hours.end());
+        size_t const n { hours.size() };
+        for (size_t i { 1 }; i <= n; ++i)
+        {
+            size_t const parent { i + (i & (~i + 1)) };
+            if (parent <= n) {
+                tree_[parent] += tree_[i];
+            }
+        }
+    }
+
+    int Fenwick::end() const
+    {
+        return origin_ + static_cast<int>(tree_.size()) - 1;
+    }
+
+    void Fenwick::grow(int const day)
+    {
+        /* at least doubles, so a commit a day doesn't rebuild every day;
+         * the days are read back out and the tree built again in O(n)
+         */
+        size_t const n { tree_.size() - 1 };
+        size_t const size { max(2 * n,
+                static_cast<size_t>(day - origin_ + 1)) };
+        vector<double> hours(size, 0.0);
+        for (size_t i {}; i < n; ++i)
+        {
+            int const d { origin_ + static_cast<int>(i) };
+            hours[i] = range(d, d);
+        }
+        *this = Fenwick(origin_, hours);
+    }
+
+    void Fenwick::add(int const day, double const hours)
+    {
+        if (day >= end()) {
+            grow(day);
+        }
+        size_t const n { tree_.size() - 1 };
+        for (size_t i { static_cast<size_t>(day - origin_ + 1) }; i <= n;
+                i += i & (~i + 1)) {
+            tree_[i] += hours;
+        }
+    }
+
+    double Fenwick::prefix(int const day) const
+    {
+        if (day < origin_) {
+            return 0.0;
+        }
+        double total {};
+        for (size_t i { min(static_cast<size_t>(day - origin_ + 1),
+                    tree_.size() - 1) }; i > 0; i &= i - 1) {
+            total += tree_[i];
+        }
+        return total;
+    }
+
+    double Fenwick::range(int const first_day, int const last_day) const
+    {
+        if (last_day < first_day) {
+            return 0.0;
+        }
+        return prefix(last_day) - prefix(first_day - 1);
+    }
+
+    void RangeIndex::build(vector<SQL::Activity> const& activities,
+            int const first_day, int const last_day, Scan const& scan)
+    {
+        /* the days of every activity and group go into flat arrays first,
+         * each tree is then built from its array in one go
+         */
+        clear();
+        origin_ = first_day;
+        size_t const days { static_cast<size_t>(
+                max(last_day - first_day + 1, 1)) };
+
+        unordered_map<int, vector<double>> act_days;
+        unordered_map<int, vector<double>> grp_days;
+        for (SQL::Activity const& a : activities)
+        {
+            group_of_[a.id] = a.group;
+            act_days[a.id].assign(days, 0.0);
+            grp_days[a.group].assign(days, 0.0);
+        }
+
+        scan(first_day, last_day, [&](SQL::HistoryColumns const& c)
+        {
+            for (size_t i {}; i < c.size(); ++i)
+            {
+                auto act = act_days.find(c.activity[i]);
+                if (act == act_days.end()) {
+                    continue;
+                }
+                size_t const d { static_cast<size_t>(c.day[i] - first_day) };
+                act->second[d] += c.hours[i];
+                grp_days[group_of_[c.activity[i]]][d] += c.hours[i];
+            }
+        });
+
+        for (auto const& [id, hours] : act_days) {
+            activities_.emplace(id, Fenwick(first_day, hours));
+        }
+        for (auto const& [id, hours] : grp_days) {
+            groups_.emplace(id, Fenwick(first_day, hours));
+        }
+        built_ = true;
+    }
+
+    void RangeIndex::clear(void)
+    {
+        activities_.clear();
+        groups_.clear();
+        group_of_.clear();
+        built_ = false;
+    }
+
+    void RangeIndex::add(int const activity, int const day,
+            double const hours)
+    {
+        if (!built_) {
+            return;
+        }
+        auto it = group_of_.find(activity);
+        if (it == group_of_.end() || day < origin_) {
+            clear();
+            return;
+        }
+        activities_[activity].add(day, hours);
+        groups_[it->second].add(day, hours);
+    }
+
+    double RangeIndex::activity(int const id, int const first_day,
+            int const last_day) const
+    {
+        auto it = activities_.find(id);
+        return it == activities_.end() ? 0.0 :
+            it->second.range(first_day, last_day);
+    }
+
+    double RangeIndex::group(int const id, int const first_day,
+            int const last_day) const
+    {
+        auto it = groups_.find(id);
+        return it == groups_.end() ? 0.0 :
+            it->second.range(first_day, last_day);
+    }
+
+    double RangeIndex::total(int const first_day, int const last_day) const
+    {
+        double hours {};
+        for (auto const& [id, tree] : groups_) {
+            hours += tree.range(first_day, last_day);
+        }
+        return hours;
+    }
+
+    RangeIndex& totals(void)
+    {
+        static RangeIndex t;
+        return t;
+    }
+
+    HourGrid::HourGrid(size_t const entries)
+        : base_(entries * STRIDE, 0),
+          step_(entries * STRIDE, 0)
+    {
+    }
+
+    void HourGrid::add(size_t const entry, long long const local_start,
+            int const duration)
+    {
+        long long const DAY { 86400 };
+
+        // seconds since Monday 00:00; epoch day 0 was a Thursday
+        long long day  { local_start / DAY };
+        long long secs { local_start % DAY };
+        if (secs < 0) {
+            secs += DAY;
+            --day;
+        }
+        long long weekday { (day + 3) % 7 };
+        if (weekday < 0) {
+            weekday += 7;
+        }
+
+        long long const a { weekday * DAY + secs };
+        long long const b { a + duration };
+
+        size_t const row { entry * STRIDE };
+        size_t const ka { static_cast<size_t>(a / 3600) };
+        size_t const kb { static_cast<size_t>(b / 3600) };
+
+        base_[row + ka]     += 3600 - a % 3600;
+        step_[row + ka + 1] += 3600;
+        base_[row + kb]     -= 3600 - b % 3600;
+        step_[row + kb + 1] -= 3600;
+    }
+
+    vector<double> HourGrid::finish(size_t const entry) const
+    {
+        vector<double> hours(WEEK_HOURS);
+        size_t const row { entry * STRIDE };
+
+        long long run {};
+        for (size_t k {}; k < WEEK_HOURS; ++k)
+        {
+            run += step_[row + k];
+            hours[k] = static_cast<double>(base_[row + k] + run) / 3600.0;
+        }
+        return hours;
+    }
+}
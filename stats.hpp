@@ -0,0 +1,392 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./sql.hpp"
+
+namespace STATS {
+
+    /* maps sparse ids (activity ids, group ids) onto dense indices 0..n-1
+     * so per-id sums can live in flat arrays instead of std::map nodes
+     */
+    class DenseIndex
+    {
+    public:
+        DenseIndex() = default;
+        explicit DenseIndex(std::vector<int> ids);
+
+        // dense index of id, -1 if id is unknown
+        int operator()(int const id) const;
+
+        // id stored at dense index idx (ids are kept in ascending order)
+        int id(std::size_t const idx) const { return ids_[idx]; }
+
+        std::size_t size() const { return ids_.size(); }
+
+    private:
+        std::vector<int> ids_; // sorted, unique
+        std::vector<int> lut_; // id - min_ -> index, empty if ids too sparse
+        int min_ {};
+    };
+
+    // per dense index: summed values and number of rows that contributed
+    struct Totals
+    {
+        std::vector<double>      sum;
+        std::vector<std::size_t> rows;
+    };
+
+    // sum of n doubles, uses AVX2 or SSE2 if the cpu has it
+    double sum(double const* values, std::size_t const n);
+
+    /* adds values up per key into totals (sized to index on first use), so
+     * chunks of one scan can go in one after the other
+     */
+    void aggregate(
+            std::vector<int> const& keys,
+            std::vector<double> const& values,
+            DenseIndex const& index,
+            Totals& totals);
+
+    // days kept for rolling averages and week over week deltas
+    constexpr std::size_t RECENT_DAYS { 30 };
+    // minutes per sketch bin; the last bin also takes anything >= 24h
+    constexpr std::size_t SKETCH_MINUTES { 5 };
+    constexpr std::size_t SKETCH_BINS { 24 * 60 / SKETCH_MINUTES + 1 };
+
+    /* histogram of hours per day at SKETCH_MINUTES resolution
+     * fixed size no matter how many days are added, and two sketches merge
+     * by adding their bins, so quantiles of a range can be built from parts
+     */
+    class DaySketch
+    {
+    public:
+        void add(double const hours, std::uint32_t const days = 1);
+        void merge(DaySketch const& other);
+
+        // hours of the q-quantile day (q in [0, 1]), 0 if empty
+        double quantile(double const q) const;
+
+        std::uint64_t count() const { return count_; }
+
+        std::uint32_t bin(std::size_t const i) const { return bins_[i]; }
+        void set_bin(std::size_t const i, std::uint32_t const days);
+
+    private:
+        std::array<std::uint32_t, SKETCH_BINS> bins_ {};
+        std::uint64_t count_ {};
+    };
+
+    /* summary of one activity or group over a run of consecutive days
+     * days are appended in order (days without entries as zero days) and
+     * two accumulators of adjoining ranges can be merged, earlier.merge(later)
+     */
+    struct Accumulator
+    {
+        int    days        {}; // days covered
+        int    active_days {}; // days with hours > 0
+        double sum         {};
+
+        // streaks of active days
+        int    longest     {};
+        int    head_run    {}; // streak starting at the first day
+        int    tail_run    {}; // streak ending at the last day
+
+        DaySketch sketch;
+
+        // hours of the last RECENT_DAYS days, day i sits at i % RECENT_DAYS
+        std::array<double, RECENT_DAYS> recent {};
+
+        void add_day(double const hours);
+        void add_zero_days(int const n);
+        void merge(Accumulator const& later);
+
+        // hours of the last n days (n <= RECENT_DAYS), fewer if range shorter
+        double last_days(int const n, int const skip = 0) const;
+    };
+
+    // numbers shown by the stats report for one activity or group
+    struct Summary
+    {
+        double sum;
+        double mean;        // per day of the range
+        double median;      // daily hours
+        double p90;
+        int    active_days;
+        int    longest_streak;
+        int    current_streak;
+        double avg7;        // rolling averages at the end of the range
+        double avg30;
+        double week;        // hours of the last 7 days
+        double week_delta;  // week minus the 7 days before it
+    };
+
+    Summary summarize(Accumulator const& acc);
+
+    /* single pass statistics over date ordered history rows
+     * every activity and group gets an Accumulator covering first..last day,
+     * rows only have to arrive in day order, chunk after chunk;
+     * memory depends on the number of activities/groups, not on the range
+     */
+    class Engine
+    {
+    public:
+        Engine(int const first_day, int const last_day,
+                DenseIndex const& activities, DenseIndex const& groups);
+
+        void add(SQL::HistoryColumns const& rows);
+        void add(int const day, int const activity, int const group,
+                double const hours);
+
+        // closes the last open day of every entry, call once after all rows
+        void finish(void);
+
+        Accumulator const& activity(std::size_t const k) const;
+        Accumulator const& group(std::size_t const k) const;
+
+        // all accumulators, activities first, then groups
+        std::vector<Accumulator> accumulators(void) const;
+
+    private:
+        struct Entry
+        {
+            Accumulator acc;
+            int         open_day;   // day hours is collecting for
+            double      open_hours {};
+        };
+
+        void add_to(Entry& e, int const day, double const hours);
+        void close(Entry& e, int const until);
+
+        int first_day_;
+        int last_day_;
+        DenseIndex const* activities_;
+        DenseIndex const* groups_;
+        std::vector<Entry> entries_; // activities first, then groups
+    };
+
+    /* plain text form of a block's accumulators, used to persist cache()
+     * only non-empty sketch bins and the ring days actually covered are
+     * written, so a week block takes a few hundred bytes per entry
+     */
+    std::string encode(std::vector<Accumulator> const& accs);
+    bool decode(std::string const& text, std::vector<Accumulator>& accs);
+
+    // streams the history rows of first..last day (date ordered) into sink
+    using Scan = std::function<void(int const first_day, int const last_day,
+            std::function<void(SQL::HistoryColumns const&)> const& sink)>;
+
+    /* in memory cache of per block accumulators
+     * a block is granularity days long and starts on a Monday; entries are
+     * keyed by (first day, last day, granularity) and hold the accumulators
+     * of every activity and group (same layout as Engine::accumulators)
+     * writes to history have to call invalidate() with the day they touch
+     */
+    class Cache
+    {
+    public:
+        // blocks kept before the least recently used one is dropped
+        static constexpr std::size_t CAPACITY { 256 };
+
+        /* optional second level behind the in memory blocks (e.g. a table)
+         * load fills accs and returns true on a hit, save stores a block
+         */
+        struct Backing
+        {
+            std::function<bool(int const, int const, int const,
+                    std::vector<Accumulator>&)> load;
+            std::function<void(int const, int const, int const,
+                    std::vector<Accumulator> const&)> save;
+        };
+
+        void attach(Backing backing) { backing_ = std::move(backing); }
+
+        std::vector<Accumulator> const* find(
+                int const first_day, int const last_day,
+                int const granularity);
+
+        void store(int const first_day, int const last_day,
+                int const granularity, std::vector<Accumulator> accs);
+
+        // drops every block containing day
+        void invalidate(int const day) { invalidate(day, day); }
+
+        // drops every block overlapping first_day..last_day
+        void invalidate(int const first_day, int const last_day);
+
+        // drops every block (in memory only, the backing keeps its own)
+        void clear(void) { entries_.clear(); }
+
+        // drops everything if activities or groups changed since last call
+        void reset(std::vector<int> const& activities,
+                std::vector<int> const& groups);
+
+        std::size_t size() const { return entries_.size(); }
+
+    private:
+        struct Entry
+        {
+            std::vector<Accumulator> accs;
+            std::uint64_t            used;
+        };
+
+        void insert(std::tuple<int, int, int> const& key,
+                std::vector<Accumulator> accs);
+
+        std::map<std::tuple<int, int, int>, Entry> entries_;
+        Backing          backing_;
+        std::vector<int> activities_;
+        std::vector<int> groups_;
+        std::uint64_t    tick_ {};
+    };
+
+    // process wide cache used by the stats report
+    Cache& cache(void);
+
+    // first day of the block of granularity days that contains day
+    int block_start(int const day, int const granularity);
+
+    // runs of missing blocks at least this long are scanned by collect one
+    // history partition (year) per scan, side by side
+    constexpr int PARTITION_DAYS { 364 };
+
+    // chunks of rows on their way from the fetch to one sink of pipeline()
+    constexpr std::size_t PIPELINE_DEPTH { 8 };
+    // runs of missing blocks at least this long are pipelined by collect
+    constexpr int PIPELINE_DAYS { 112 };
+
+    using Sink = std::function<void(SQL::HistoryColumns const&)>;
+
+    /* scan(first, last) on a fetch thread of its own, its rows dealt out
+     * to the sinks by group (all rows of a group go to the same sink, in
+     * scan order), each sink running on a thread of its own (sinks[0] on
+     * the calling one)
+     * rows travel in pooled chunks through bounded queues, so fetching
+     * and aggregating overlap, and a slow sink holds up the fetch instead
+     * of letting rows pile up
+     */
+    void pipeline(Scan const& scan, int const first_day, int const last_day,
+            DenseIndex const& groups, std::vector<Sink> const& sinks);
+
+    /* accumulators of every activity and group for first..last
+     * whole blocks come from cache() (missing ones are scanned once, in one
+     * go, and stored); partial blocks at either end are scanned directly
+     * parallel are scans that may run at the same time, one per thread:
+     * given two or more, a run of missing blocks longer than a partition is
+     * cut into partitions that are scanned side by side
+     * otherwise, with workers > 0 and a scan in parallel, a run of
+     * PIPELINE_DAYS or more goes through pipeline() with that many
+     * aggregating sinks, each with its own Engines (for its groups), merged
+     * at the end, fetching with parallel[0] on the fetch thread
+     * scan itself only ever runs on the calling thread
+     * the result has the same layout as Engine::accumulators
+     */
+    std::vector<Accumulator> collect(
+            int const first_day, int const last_day, int const granularity,
+            DenseIndex const& activities, DenseIndex const& groups,
+            Scan const& scan, std::vector<Scan> const& parallel = {},
+            std::size_t const workers = 0);
+
+    /* hours per day of one activity or group as a Fenwick tree over epoch
+     * days from origin on, so adding to a day and the total of any range of
+     * days both cost O(log n), however long the range
+     */
+    class Fenwick
+    {
+    public:
+        Fenwick() = default;
+        // hours[i] are the hours of day origin + i, built in O(n)
+        Fenwick(int const origin, std::vector<double> const& hours);
+
+        // day has to be >= origin, the tree grows for days past its end
+        void add(int const day, double const hours);
+
+        // hours of origin..day
+        double prefix(int const day) const;
+        double range(int const first_day, int const last_day) const;
+
+        int origin() const { return origin_; }
+        // first day past the end of the tree
+        int end() const;
+
+    private:
+        void grow(int const day);
+
+        int origin_ {};
+        std::vector<double> tree_ { 0.0 }; // 1-based, tree_[0] unused
+    };
+
+    /* range totals of every activity and (direct) group, one Fenwick each
+     * build() reads the whole history once, after that every committed
+     * entry is added with add(); anything it can't take (an activity it
+     * doesn't know, a day before the oldest one) clears the index, so the
+     * next user builds it again
+     */
+    class RangeIndex
+    {
+    public:
+        // activities are all there are, history rows come from scan
+        void build(std::vector<SQL::Activity> const& activities,
+                int const first_day, int const last_day, Scan const& scan);
+        void clear(void);
+        bool built() const { return built_; }
+
+        void add(int const activity, int const day, double const hours);
+
+        // hours in first..last, 0 for an unknown id
+        double activity(int const id, int const first_day,
+                int const last_day) const;
+        double group(int const id, int const first_day,
+                int const last_day) const;
+        // of every activity
+        double total(int const first_day, int const last_day) const;
+
+    private:
+        std::unordered_map<int, Fenwick> activities_;
+        std::unordered_map<int, Fenwick> groups_;
+        std::unordered_map<int, int>     group_of_; // activity id -> group id
+        int  origin_ {};
+        bool built_ {};
+    };
+
+    // process wide range totals, kept up to date by the menus
+    RangeIndex& totals(void);
+
+    constexpr std::size_t WEEK_HOURS { 7 * 24 };
+
+    /* seconds per weekday and hour of day, one 7x24 grid per entry
+     * add() never loops over the hours a segment covers: a segment [a, b)
+     * is stored as ramp(a) - ramp(b), each ramp being one add to the hour
+     * it starts in plus one step of 3600 for every later hour, the steps
+     * get summed up once in finish()
+     */
+    class HourGrid
+    {
+    public:
+        explicit HourGrid(std::size_t const entries);
+
+        /* local_start is local time as seconds since the epoch; the segment
+         * must not run past local midnight (segments are split there)
+         */
+        void add(std::size_t const entry, long long const local_start,
+                int const duration);
+
+        // hours per cell, cell weekday * 24 + hour (weekday 0 is Monday)
+        std::vector<double> finish(std::size_t const entry) const;
+
+    private:
+        static constexpr std::size_t STRIDE { WEEK_HOURS + 2 };
+
+        std::vector<long long> base_;
+        std::vector<long long> step_;
+    };
+}
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "./status.hpp"
+
+using namespace std;
+
+namespace STATUS
+{
+    Publisher::Publisher(string const& name) : name_(name)
+    {
+        current_.layout = LAYOUT;
+        current_.pid    = static_cast<int32_t>(getpid());
+
+        int const fd { shm_open(name_.c_str(), O_CREAT | O_RDWR, 0600) };
+        if (fd < 0) {
+            return;
+        }
+        if (ftruncate(fd, sizeof(Segment)) == 0)
+        {
+            void* const p { mmap(nullptr, sizeof(Segment),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) };
+            if (p != MAP_FAILED) {
+                segment_ = static_cast<Segment*>(p);
+            }
+        }
+        close(fd);
+
+        store();
+    }
+
+    Publisher::~Publisher()
+    {
+        if (!segment_) {
+            return;
+        }
+        // readers that still have it mapped see an idle tracker
+        current_.activity = 0;
+        store();
+        munmap(segment_, sizeof(Segment));
+        shm_unlink(name_.c_str());
+    }
+
+    void Publisher::publish(Snapshot const& snapshot)
+    {
+        current_        = snapshot;
+        current_.layout = LAYOUT;
+        current_.pid    = static_cast<int32_t>(getpid());
+        current_.name[sizeof(current_.name) - 1] = '\0';
+        current_.heartbeat = time(nullptr);
+        store();
+    }
+
+    void Publisher::beat(void)
+    {
+        current_.heartbeat = time(nullptr);
+        store();
+    }
+
+    void Publisher::store(void)
+    {
+        /* the only writer: seq goes odd, the words are written, seq goes
+         * even again; the release fence keeps the word stores after the
+         * odd seq for any reader that sees one of them
+         */
+        if (!segment_) {
+            return;
+        }
+        uint64_t words[WORDS];
+        memcpy(words, &current_, sizeof(Snapshot));
+
+        uint32_t const seq { segment_->seq.load(memory_order_relaxed) };
+        segment_->seq.store(seq + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        for (size_t i {}; i < WORDS; ++i) {
+            segment_->words[i].store(words[i], memory_order_relaxed);
+        }
+
+        segment_->seq.store(seq + 2, memory_order_release);
+    }
+
+    Publisher& publisher(void)
+    {
+        static Publisher p;
+        return p;
+    }
+}
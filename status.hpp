@@ -0,0 +1,157 @@
+#pragma once
+
+/* live status of a running tracker, in shared memory
+ * the reading side (Snapshot, Reader) is header only and needs nothing
+ * else from the tracker, so status bars and editor plugins can include
+ * just this file; after the segment is mapped once, reading is a few
+ * loads, no syscalls and no locks, and never holds up the tracker
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace STATUS {
+
+    // bumped whenever Snapshot changes
+    constexpr std::uint32_t LAYOUT { 1 };
+
+    // a heartbeat older than this (seconds) means the tracker is gone
+    constexpr std::int64_t STALE_AFTER { 5 };
+
+    struct Snapshot
+    {
+        std::uint32_t layout;       // LAYOUT
+        std::int32_t  pid;          // of the publishing tracker
+        std::int32_t  activity;     // id, 0 when no timer is running
+        std::int32_t  on_break;     // 1 during a break
+        std::int64_t  phase_start;  // unix time the current phase started
+        std::int64_t  heartbeat;    // unix time, refreshed every timer tick
+        double        today_hours;  // tracked today, current phase excluded
+        char          name[48];     // activity name, nul terminated
+    };
+
+    // the snapshot travels as words, each of them an atomic of its own
+    constexpr std::size_t WORDS { sizeof(Snapshot) / 8 };
+    static_assert(sizeof(Snapshot) % 8 == 0);
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+    /* seqlock: seq is odd while the (single) writer is in the middle of an
+     * update; a reader copies the words and keeps the copy only if seq
+     * was even and unchanged around it
+     */
+    struct Segment
+    {
+        std::atomic<std::uint32_t> seq;
+        std::uint32_t              reserved;
+        std::atomic<std::uint64_t> words[WORDS];
+    };
+
+    // one segment per user
+    inline std::string segment_name(void)
+    {
+        return "/tracker-status-" + std::to_string(getuid());
+    }
+
+    class Reader
+    {
+    public:
+        explicit Reader(std::string const& name = segment_name())
+        {
+            int const fd { shm_open(name.c_str(), O_RDONLY, 0) };
+            if (fd < 0) {
+                return;
+            }
+            void* const p { mmap(nullptr, sizeof(Segment), PROT_READ,
+                    MAP_SHARED, fd, 0) };
+            close(fd);
+            if (p != MAP_FAILED) {
+                segment_ = static_cast<Segment const*>(p);
+            }
+        }
+
+        ~Reader()
+        {
+            if (segment_) {
+                munmap(const_cast<Segment*>(segment_), sizeof(Segment));
+            }
+        }
+
+        Reader(Reader const&) = delete;
+        Reader& operator=(Reader const&) = delete;
+
+        // false if no tracker has ever published (since boot)
+        bool mapped(void) const { return segment_ != nullptr; }
+
+        /* a consistent copy of the latest snapshot; false if there is none
+         * or the writer kept changing it (a few retries, then gives up
+         * rather than spin)
+         */
+        bool read(Snapshot& out) const
+        {
+            if (!segment_) {
+                return false;
+            }
+            for (int tries {}; tries < 64; ++tries)
+            {
+                std::uint32_t const before {
+                    segment_->seq.load(std::memory_order_acquire) };
+                if (before & 1U) {
+                    continue;
+                }
+
+                std::uint64_t words[WORDS];
+                for (std::size_t i {}; i < WORDS; ++i) {
+                    words[i] = segment_->words[i].load(
+                            std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (segment_->seq.load(std::memory_order_relaxed) == before)
+                {
+                    std::memcpy(&out, words, sizeof(Snapshot));
+                    return out.layout == LAYOUT;
+                }
+            }
+            return false;
+        }
+
+    private:
+        Segment const* segment_ { nullptr };
+    };
+
+    /* the writing side, used by the tracker itself
+     * creates the segment on first use; if shared memory isn't available
+     * it does nothing, the timer never depends on it
+     */
+    class Publisher
+    {
+    public:
+        explicit Publisher(std::string const& name = segment_name());
+        ~Publisher(); // publishes "not tracking" and removes the segment
+        Publisher(Publisher const&) = delete;
+        Publisher& operator=(Publisher const&) = delete;
+
+        void publish(Snapshot const& snapshot);
+
+        // refreshes the heartbeat of the current snapshot
+        void beat(void);
+
+        Snapshot const& current(void) const { return current_; }
+
+    private:
+        void store(void);
+
+        std::string name_;
+        Segment* segment_ { nullptr };
+        Snapshot current_ {};
+    };
+
+    // process wide publisher
+    Publisher& publisher(void);
+}
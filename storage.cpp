@@ -0,0 +1,916 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <soci/soci.h>
+
+#include "./retention.hpp"
+#include "./schema.hpp"
+#include "./sql.hpp"
+#include "./stats.hpp"
+#include "./storage.hpp"
+#include "./time.hpp"
+
+using namespace std;
+
+namespace STORAGE
+{
+    void Backend::stream_filtered_days(string const& first,
+            string const& last, FILTER::Filter const& filter,
+            function<void(SQL::HistoryColumns const&)> const& consume)
+    {
+        SQL::HistoryColumns kept;
+        stream_days(filter.first.empty() ? first : max(first, filter.first),
+                filter.last.empty() ? last : min(last, filter.last),
+                [&](SQL::HistoryColumns const& chunk)
+        {
+            kept.day.clear();
+            kept.activity.clear();
+            kept.group.clear();
+            kept.hours.clear();
+            for (size_t i {}; i < chunk.size(); ++i)
+            {
+                if (!filter.matches(chunk.day[i], chunk.activity[i],
+                            chunk.group[i], chunk.hours[i])) {
+                    continue;
+                }
+                kept.day.push_back(chunk.day[i]);
+                kept.activity.push_back(chunk.activity[i]);
+                kept.group.push_back(chunk.group[i]);
+                kept.hours.push_back(chunk.hours[i]);
+            }
+            if (!kept.empty()) {
+                consume(kept);
+            }
+        });
+    }
+
+    bool Backend::take_stored(vector<Stored>& out)
+    {
+        bool const complete { !lost_ };
+        out.insert(out.end(), stored_.begin(), stored_.end());
+        stored_.clear();
+        lost_ = false;
+        return complete;
+    }
+
+    void Backend::stored(int const activity, string const& date,
+            double const hours)
+    {
+        // nobody asked for them in a while, catch_up() starts over anyway
+        if (stored_.size() == STORED_MAX) {
+            stored_.clear();
+            lost_ = true;
+        }
+        if (!lost_) {
+            stored_.push_back({ activity, date, hours });
+        }
+    }
+
+    void catch_up(Backend& storage)
+    {
+        vector<Stored> stored;
+        bool const complete { storage.take_stored(stored) };
+        // asked either way, so the next call only sees newer changes
+        bool const elsewhere { storage.changed_elsewhere() };
+
+        if (!complete || elsewhere)
+        {
+            STATS::cache().clear();
+            STATS::totals().clear(); // rebuilt on the next report
+            GOALS::progress().rebuild(storage);
+            return;
+        }
+
+        for (Stored const& s : stored)
+        {
+            GOALS::progress().add(s.activity, s.date, s.hours);
+            STATS::totals().add(s.activity,
+                    TIME::conv_date_to_epoch_day(s.date), s.hours);
+        }
+    }
+
+    // sqlite
+
+    vector<SQL::Activity> Sqlite::activities(void)
+    {
+        return SQL::get_activities(*sql_, users_);
+    }
+
+    void Sqlite::check_user(int const id)
+    {
+        if (users_.empty()) {
+            return;
+        }
+        int user {};
+        soci::indicator ind { soci::i_null };
+        *sql_ << "SELECT user_id FROM activities WHERE id = :id",
+            soci::use(id), soci::into(user, ind);
+        if (ind == soci::i_ok &&
+                find(users_.begin(), users_.end(), user) == users_.end()) {
+            throw runtime_error("Activity " + to_string(id) +
+                    " belongs to another user");
+        }
+    }
+
+    void Sqlite::add_activity(string const& name, int const group,
+            string const& date)
+    {
+        int const user { users_.empty() ? 1 : users_.front() };
+        *sql_ <<
+            "INSERT INTO activities (name, group_id, added_when, user_id) "
+            "VALUES (:name, :groupid, :added, :user)",
+            soci::use(name), soci::use(group), soci::use(date),
+            soci::use(user);
+    }
+
+    void Sqlite::set_activated(int const id, bool const activated)
+    {
+        check_user(id);
+        int const flag { activated ? 1 : 0 };
+        *sql_ <<
+            "UPDATE activities SET is_activated = :flag WHERE id = :id",
+            soci::use(flag), soci::use(id);
+    }
+
+    vector<SQL::Group> Sqlite::groups(void)
+    {
+        /* the kept rollups are everyone's; limited to users, only groups
+         * with one of their activities below them are left, the hours
+         * summed over those activities (group_closure)
+         */
+        vector<SQL::Group> groups;
+        string const query { users_.empty() ?
+            "SELECT id, COALESCE(parent_id, 0) AS parent, name, hours_total "
+            "FROM activity_groups WHERE " + SQL::user_clause("", users_) +
+            " ORDER BY id" :
+            "SELECT g.id, COALESCE(g.parent_id, 0) AS parent, g.name, "
+            "SUM(a.hours_total) AS hours_total "
+            "FROM activities AS a "
+            "INNER JOIN group_closure AS c ON c.descendant = a.group_id "
+            "INNER JOIN activity_groups AS g ON g.id = c.ancestor "
+            "WHERE " + SQL::user_clause("a.user_id", users_) + " "
+            "GROUP BY g.id ORDER BY g.id" };
+        string const ids { FILTER::id_list(users_) };
+        soci::rowset<soci::row> rows = (sql_->prepare << query,
+                soci::use(ids));
+
+        for (soci::row const& row : rows)
+        {
+            groups.push_back({
+                row.get<int>("id"),
+                row.get<int>("parent"),
+                row.get<string>("name"),
+                row.get<double>("hours_total")
+            });
+        }
+        return groups;
+    }
+
+    void Sqlite::check_shared(void)
+    {
+        if (!users_.empty()) {
+            throw runtime_error("Groups are shared by every user, they can "
+                    "only be changed without --user");
+        }
+    }
+
+    void Sqlite::add_group(string const& name, int const parent)
+    {
+        check_shared();
+
+        // closure rows come from the insert trigger
+        *sql_ <<
+            "INSERT INTO activity_groups (name, parent_id) "
+            "VALUES (:name, NULLIF(:parent, 0))",
+            soci::use(name), soci::use(parent);
+    }
+
+    void Sqlite::move_group(int const id, int const parent)
+    {
+        check_shared();
+
+        // closure and rollups get rewritten by the update triggers
+        soci::transaction tr(*sql_);
+        *sql_ <<
+            "UPDATE activity_groups SET parent_id = NULLIF(:parent, 0) "
+            "WHERE id = :id",
+            soci::use(parent), soci::use(id);
+        tr.commit();
+    }
+
+    vector<pair<int, int>> Sqlite::group_closure(void)
+    {
+        vector<pair<int, int>> closure;
+        soci::rowset<soci::row> rows = (sql_->prepare <<
+            "SELECT ancestor, descendant FROM group_closure");
+
+        for (soci::row const& row : rows) {
+            closure.emplace_back(row.get<int>("ancestor"),
+                    row.get<int>("descendant"));
+        }
+        return closure;
+    }
+
+    static void add_to_day(soci::session& sql, int const id,
+            string const& date, double const hours)
+    {
+        /* adds hours to the history row of id and date, inserting the row
+         * if the day has none yet
+         */
+        // work is committed for today; a sealed partition's own triggers
+        // would turn it down, manual entries are checked up front
+        double hours_on_day { -1.0 };
+        string const table { SQL::partition(sql, date, true) };
+
+        sql <<
+            "SELECT hours_on_day FROM " + table + " "
+            "WHERE date = :date AND id_activity = :id",
+            soci::use(date), soci::use(id), soci::into(hours_on_day);
+
+        if (hours_on_day == -1.0)
+        {
+            string datetime { date + " xx:xx" };
+            string year  { TIME::from_datetime_extract_year(datetime) };
+            string month { TIME::from_datetime_extract_month(datetime) };
+            string day   { TIME::from_datetime_extract_day(datetime) };
+            string wkno  { TIME::get_weeknumber_for_date(date) };
+
+            // the user of the row is the one of its activity
+            sql <<
+                "INSERT INTO " + table + " (id_activity, year, month, day, "
+                "weeknumber, hours_on_day, date, user_id) "
+                "VALUES (:id, :yyyy, :mm, :dd, :wkno, :h_day, :date, "
+                "(SELECT user_id FROM activities WHERE id = :id))",
+                soci::use(id), soci::use(year), soci::use(month),
+                soci::use(day), soci::use(wkno), soci::use(hours),
+                soci::use(date);
+        }
+        else
+        {
+            hours_on_day += hours;
+            sql <<
+                "UPDATE " + table + " SET hours_on_day = :hours "
+                "WHERE date = :date AND id_activity = :id",
+                soci::use(hours_on_day), soci::use(date), soci::use(id);
+        }
+
+        // cached stats of this day are stale now
+        SQL::invalidate_stats(sql, date);
+    }
+
+    void Sqlite::commit_work(int const id, vector<WorkPart> const& parts)
+    {
+        check_user(id);
+
+        // daily sums, segments and totals go in together or not at all
+        soci::transaction tr(*sql_);
+
+        double hours {};
+        for (WorkPart const& p : parts)
+        {
+            SQL::add_segment(*sql_, id, p.start, p.duration);
+            add_to_day(*sql_, id, p.date, p.hours);
+            hours += p.hours;
+        }
+
+        *sql_ <<
+            "UPDATE activities SET hours_total = hours_total + :hours "
+            "WHERE id = :id",
+            soci::use(hours), soci::use(id);
+
+        tr.commit();
+
+        for (WorkPart const& p : parts) {
+            stored(id, p.date, p.hours);
+        }
+    }
+
+    void Sqlite::add_hours(int const id, string const& date,
+            double const hours)
+    {
+        check_user(id);
+        stored(id, date,
+                SQL::enter_work_time(*sql_, to_string(id), date, hours));
+    }
+
+    // ranges shorter than this are read from the db, snapshot or not
+    static constexpr int SNAPSHOT_MIN_DAYS { 62 };
+
+    static void stream_split(soci::session& sql,
+            SNAPSHOT::File const* snapshot, string const& first,
+            string const& last,
+            function<void(SQL::HistoryColumns const&)> const& consume,
+            vector<int> const& users)
+    {
+        // the snapshot's days first (they're older), the rest from sql
+        if (snapshot)
+        {
+            int const a { TIME::conv_date_to_epoch_day(first) };
+            int const b { TIME::conv_date_to_epoch_day(last) };
+            int const through { snapshot->through() };
+            if (a <= through)
+            {
+                snapshot->stream(a, min(b, through), consume);
+                if (b > through) {
+                    SQL::stream_dates_data(sql,
+                            TIME::conv_epoch_day_to_date(through + 1), last,
+                            consume, users);
+                }
+                return;
+            }
+        }
+        SQL::stream_dates_data(sql, first, last, consume, users);
+    }
+
+    shared_ptr<SNAPSHOT::File const> Sqlite::snapshot(void)
+    {
+        // the checksum is read by the first long report, not on startup
+        if (snapshot_ && users_.empty() && !snapshot_->intact()) {
+            cerr << "Ignoring snapshot: damaged (checksum)" << endl;
+            snapshot_.reset();
+        }
+        if (snapshot_ && (!users_.empty() || !snapshot_->matches(*sql_))) {
+            snapshot_.reset();
+        }
+        return snapshot_;
+    }
+
+    void Sqlite::stream_days(string const& first, string const& last,
+            function<void(SQL::HistoryColumns const&)> const& consume)
+    {
+        /* ranges after the snapshot (today's hours) skip the check, and so
+         * do short ones (goal progress): a few weeks are one indexed range
+         * in the db, not worth the snapshot's checksum on startup
+         */
+        int const a { TIME::conv_date_to_epoch_day(first) };
+        bool const covered { snapshot_ && a <= snapshot_->through() &&
+            TIME::conv_date_to_epoch_day(last) - a >= SNAPSHOT_MIN_DAYS };
+        stream_split(*sql_, covered ? snapshot().get() : nullptr, first, last,
+                consume, users_);
+    }
+
+    void Sqlite::stream_filtered_days(string const& first,
+            string const& last, FILTER::Filter const& filter,
+            function<void(SQL::HistoryColumns const&)> const& consume)
+    {
+        if (filter.empty()) {
+            stream_days(first, last, consume);
+            return;
+        }
+
+        // folded months have no days to check weekdays, weeks or hours on
+        if (!filter.per_day())
+        {
+            if (!filtered_monthly_) {
+                filtered_monthly_ = make_unique<SQL::FilteredDays>(
+                        *sql_, "history_monthly", users_);
+            }
+            filtered_monthly_->stream(first, last, filter, consume);
+        }
+
+        if (!filtered_daily_) {
+            filtered_daily_ = make_unique<SQL::FilteredDays>(*sql_, "history",
+                    users_);
+        }
+        filtered_daily_->stream(first, last, filter, consume);
+    }
+
+    void Sqlite::stream_segments(long long const from, long long const to,
+            function<void(SQL::SegmentColumns const&)> const& consume)
+    {
+        SQL::stream_segments(*sql_, from, to, consume, users_);
+    }
+
+    string Sqlite::oldest_date(void)
+    {
+        // months folded by retention are older than any daily row
+        string date;
+        soci::indicator ind { soci::i_null };
+        string const ids { FILTER::id_list(users_) };
+        *sql_ <<
+            "SELECT MIN(date) FROM history_monthly "
+            "WHERE " + SQL::user_clause("user_id", users_),
+            soci::use(ids), soci::into(date, ind);
+        return ind == soci::i_ok ? date : SQL::oldest_day(*sql_, users_);
+    }
+
+    vector<GOALS::Goal> Sqlite::goals(void)
+    {
+        vector<GOALS::Goal> goals;
+        string const ids { FILTER::id_list(users_) };
+        soci::rowset<soci::row> rows = (sql_->prepare <<
+            "SELECT id, scope, target_id, period, hours FROM goals "
+            "WHERE " + SQL::user_clause("user_id", users_) + " "
+            "ORDER BY id",
+            soci::use(ids));
+
+        for (soci::row const& row : rows)
+        {
+            string const period { row.get<string>("period") };
+            goals.push_back({
+                row.get<int>("id"),
+                row.get<string>("scope") == "group",
+                row.get<int>("target_id"),
+                period == "day"  ? GOALS::Period::day  :
+                period == "week" ? GOALS::Period::week : GOALS::Period::month,
+                row.get<double>("hours")
+            });
+        }
+        return goals;
+    }
+
+    void Sqlite::set_goal(GOALS::Goal const& goal)
+    {
+        /* a goal for an activity is its user's, one for a group the first
+         * of users' (user 1 without any)
+         */
+        if (!goal.group) {
+            check_user(goal.target);
+        }
+        string const scope  { goal.group ? "group" : "activity" };
+        string const period { GOALS::period_name(goal.period) };
+        int const user { users_.empty() ? 1 : users_.front() };
+        *sql_ <<
+            "INSERT INTO goals (user_id, scope, target_id, period, hours) "
+            "VALUES (COALESCE((SELECT user_id FROM activities "
+            "WHERE id = :target AND :scope = 'activity'), :user), "
+            ":scope, :target, :period, :hours) "
+            "ON CONFLICT (user_id, scope, target_id, period) "
+            "DO UPDATE SET hours = excluded.hours",
+            soci::use(goal.target), soci::use(scope), soci::use(user),
+            soci::use(period), soci::use(goal.hours);
+    }
+
+    void Sqlite::remove_goal(int const id)
+    {
+        if (!users_.empty())
+        {
+            int user {};
+            soci::indicator ind { soci::i_null };
+            *sql_ << "SELECT user_id FROM goals WHERE id = :id",
+                soci::use(id), soci::into(user, ind);
+            if (ind == soci::i_ok &&
+                    find(users_.begin(), users_.end(), user) == users_.end()) {
+                throw runtime_error("Goal " + to_string(id) +
+                        " belongs to another user");
+            }
+        }
+        *sql_ << "DELETE FROM goals WHERE id = :id", soci::use(id);
+    }
+
+    STATS::Cache::Backing Sqlite::stats_backing(string const& shape)
+    {
+        /* STATS::cache() backing stored in the stats_cache table
+         * the table is only created once the first block gets saved
+         */
+        soci::session& sql { *sql_ };
+        bool exists { SCHEMA::has_table(sql, "stats_cache") };
+
+        STATS::Cache::Backing backing;
+
+        backing.load = [&sql, shape, exists](int const first, int const last,
+                int const granularity, vector<STATS::Accumulator>& accs)
+        {
+            if (!exists) {
+                return false;
+            }
+            string found_shape, data;
+            soci::indicator ind { soci::i_null };
+            sql <<
+                "SELECT shape, data FROM stats_cache "
+                "WHERE granularity = :g AND first_day = :f AND last_day = :l",
+                soci::use(granularity), soci::use(first), soci::use(last),
+                soci::into(found_shape), soci::into(data, ind);
+
+            return ind == soci::i_ok && found_shape == shape &&
+                STATS::decode(data, accs);
+        };
+
+        backing.save = [&sql, shape, exists](int const first, int const last,
+                int const granularity, vector<STATS::Accumulator> const& accs)
+                mutable
+        {
+            if (!exists) {
+                SCHEMA::ensure_stats_cache(sql);
+                exists = true;
+            }
+            string data { STATS::encode(accs) };
+            sql <<
+                "INSERT OR REPLACE INTO stats_cache "
+                "(granularity, first_day, last_day, shape, data) "
+                "VALUES (:g, :f, :l, :shape, :data)",
+                soci::use(granularity), soci::use(first), soci::use(last),
+                soci::use(shape), soci::use(data);
+        };
+
+        return backing;
+    }
+
+    vector<STATS::Scan> Sqlite::parallel_scans(size_t const n)
+    {
+        /* every scan gets a connection of its own to the same file, kept
+         * for the next report; with WAL they all read next to each other
+         * and next to the writer, query_only makes sure they only read
+         * an in memory db has no file to open again, so it gets none
+         */
+        if (n == 0) {
+            return {};
+        }
+
+        string path;
+        soci::indicator ind { soci::i_null };
+        *sql_ << "SELECT file FROM pragma_database_list WHERE name = 'main'",
+            soci::into(path, ind);
+        if (ind != soci::i_ok || path.empty()) {
+            return {};
+        }
+
+        while (readers_.size() < n)
+        {
+            auto reader = make_unique<soci::session>("sqlite3", "db=" + path);
+            *reader << "PRAGMA query_only = 1";
+            *reader << "PRAGMA busy_timeout = 5000";
+            *reader << "PRAGMA mmap_size = 268435456";
+            readers_.push_back(move(reader));
+        }
+
+        // checked here once, the scans keep the file mapped while they run
+        shared_ptr<SNAPSHOT::File const> const snap { snapshot() };
+
+        vector<STATS::Scan> scans;
+        for (size_t i {}; i < n; ++i)
+        {
+            soci::session* reader { readers_[i].get() };
+            scans.push_back([reader, snap, users = users_](int const a,
+                    int const b,
+                    function<void(SQL::HistoryColumns const&)> const& sink) {
+                stream_split(*reader, snap.get(),
+                        TIME::conv_epoch_day_to_date(a),
+                        TIME::conv_epoch_day_to_date(b), sink, users);
+            });
+        }
+        return scans;
+    }
+
+    bool Sqlite::changed_elsewhere(void)
+    {
+        /* data_version only moves when another connection commits (our
+         * own writes leave it alone), the first call just takes note of it
+         */
+        long long version {};
+        *sql_ << "PRAGMA data_version", soci::into(version);
+        bool const changed { data_version_ >= 0 && version != data_version_ };
+        data_version_ = version;
+        return changed;
+    }
+
+    string Sqlite::compacted_before(void)
+    {
+        return RETENTION::compacted_before(*sql_);
+    }
+
+    // memory
+
+    SQL::Activity& Memory::find(int const id)
+    {
+        auto it = activities_.find(id);
+        if (it == activities_.end()) {
+            throw runtime_error("No activity with id " + to_string(id));
+        }
+        return it->second;
+    }
+
+    vector<SQL::Activity> Memory::activities(void)
+    {
+        vector<SQL::Activity> acts;
+        acts.reserve(activities_.size());
+        for (auto const& entry : activities_) {
+            acts.push_back(entry.second);
+        }
+        sort(acts.begin(), acts.end(),
+                [](SQL::Activity const& a, SQL::Activity const& b) {
+            return a.id < b.id;
+        });
+        return acts;
+    }
+
+    void Memory::add_activity(string const& name, int const group,
+            string const& date)
+    {
+        (void)date;
+        ensure_group(group);
+        int const id { next_id_++ };
+        activities_[id] = { id, group, name, true, 0.0 };
+    }
+
+    SQL::Group& Memory::ensure_group(int const id)
+    {
+        auto it = groups_.find(id);
+        if (it == groups_.end()) {
+            it = groups_.emplace(id,
+                    SQL::Group { id, 0, "Group " + to_string(id), 0.0 }).first;
+            ancestors_[id] = { id };
+        }
+        return it->second;
+    }
+
+    void Memory::roll_up(int const group, double const hours)
+    {
+        for (int const g : ancestors_[group]) {
+            groups_[g].hours_total += hours;
+        }
+    }
+
+    vector<SQL::Group> Memory::groups(void)
+    {
+        vector<SQL::Group> groups;
+        groups.reserve(groups_.size());
+        for (auto const& entry : groups_) {
+            groups.push_back(entry.second);
+        }
+        sort(groups.begin(), groups.end(),
+                [](SQL::Group const& a, SQL::Group const& b) {
+            return a.id < b.id;
+        });
+        return groups;
+    }
+
+    void Memory::add_group(string const& name, int const parent)
+    {
+        if (parent != 0 && !groups_.count(parent)) {
+            throw runtime_error("No group with id " + to_string(parent));
+        }
+        int id { 1 };
+        for (auto const& entry : groups_) {
+            id = max(id, entry.first + 1);
+        }
+        groups_[id] = { id, parent, name, 0.0 };
+
+        vector<int>& up { ancestors_[id] };
+        up.push_back(id);
+        if (parent != 0) {
+            vector<int> const& above { ancestors_[parent] };
+            up.insert(up.end(), above.begin(), above.end());
+        }
+    }
+
+    void Memory::move_group(int const id, int const parent)
+    {
+        /* the lists of the subtree keep their part up to id and get the
+         * new parent's list in place of the rest
+         */
+        SQL::Group& group { ensure_group(id) };
+        vector<int> above;
+        if (parent != 0)
+        {
+            if (!groups_.count(parent)) {
+                throw runtime_error("No group with id " + to_string(parent));
+            }
+            above = ancestors_[parent];
+            if (std::find(above.begin(), above.end(), id) != above.end()) {
+                throw runtime_error(
+                        "a group can not be moved into its own subtree");
+            }
+        }
+
+        if (group.parent != 0) {
+            roll_up(group.parent, -group.hours_total);
+        }
+
+        for (auto& entry : ancestors_)
+        {
+            vector<int>& up { entry.second };
+            auto it = std::find(up.begin(), up.end(), id);
+            if (it == up.end()) {
+                continue;
+            }
+            up.erase(it + 1, up.end());
+            up.insert(up.end(), above.begin(), above.end());
+        }
+
+        group.parent = parent;
+        if (parent != 0) {
+            roll_up(parent, group.hours_total);
+        }
+    }
+
+    vector<pair<int, int>> Memory::group_closure(void)
+    {
+        vector<pair<int, int>> closure;
+        for (auto const& entry : ancestors_) {
+            for (int const g : entry.second) {
+                closure.emplace_back(g, entry.first);
+            }
+        }
+        return closure;
+    }
+
+    void Memory::set_activated(int const id, bool const activated)
+    {
+        find(id).activated = activated;
+    }
+
+    void Memory::commit_work(int const id, vector<WorkPart> const& parts)
+    {
+        // nothing below can fail half way once the activity is known
+        find(id);
+
+        for (WorkPart const& p : parts)
+        {
+            add_hours(id, p.date, p.hours);
+
+            if (p.duration <= 0) {
+                continue;
+            }
+            tuple<long long, int, int> const seg { p.start, id, p.duration };
+            auto it = lower_bound(segments_.begin(), segments_.end(), seg,
+                    [](auto const& a, auto const& b) {
+                return tie(get<0>(a), get<1>(a)) < tie(get<0>(b), get<1>(b));
+            });
+            // same start as another phase: added up (see SQL::add_segment)
+            if (it != segments_.end() &&
+                    get<0>(*it) == p.start && get<1>(*it) == id) {
+                get<2>(*it) = static_cast<int>(min<long long>(
+                            get<2>(*it) + p.duration, SQL::MAX_SEGMENT));
+            }
+            else {
+                segments_.insert(it, seg);
+            }
+        }
+    }
+
+    void Memory::add_hours(int const id, string const& date,
+            double const hours)
+    {
+        SQL::Activity& act { find(id) };
+        int const day { TIME::conv_date_to_epoch_day(date) };
+
+        // mostly appends, days come in roughly in order
+        vector<pair<int, double>>& days { days_[id] };
+        auto it = lower_bound(days.begin(), days.end(), day,
+                [](pair<int, double> const& d, int const v) {
+            return d.first < v;
+        });
+        if (it != days.end() && it->first == day) {
+            it->second += hours;
+        }
+        else {
+            days.insert(it, { day, hours });
+        }
+
+        act.hours_total += hours;
+        roll_up(act.group, hours);
+        STATS::cache().invalidate(day);
+        stored(id, date, hours);
+    }
+
+    void Memory::stream_days(string const& first, string const& last,
+            function<void(SQL::HistoryColumns const&)> const& consume)
+    {
+        /* k-way merge of the per activity day arrays into date order,
+         * each array only from its first day >= first on
+         */
+        int const a { TIME::conv_date_to_epoch_day(first) };
+        int const b { TIME::conv_date_to_epoch_day(last) };
+
+        struct Cursor
+        {
+            vector<pair<int, double>> const* days;
+            size_t pos;
+            int    id;
+            int    group;
+        };
+        vector<Cursor> cursors;
+
+        for (auto const& entry : days_)
+        {
+            vector<pair<int, double>> const& days { entry.second };
+            auto it = lower_bound(days.begin(), days.end(), a,
+                    [](pair<int, double> const& d, int const v) {
+                return d.first < v;
+            });
+            if (it == days.end() || it->first > b) {
+                continue;
+            }
+            cursors.push_back({ &days, static_cast<size_t>(it - days.begin()),
+                    entry.first, find(entry.first).group });
+        }
+
+        // (day, cursor), smallest day on top
+        using Head = pair<int, size_t>;
+        priority_queue<Head, vector<Head>, greater<Head>> heads;
+        for (size_t c {}; c < cursors.size(); ++c) {
+            heads.push({ (*cursors[c].days)[cursors[c].pos].first, c });
+        }
+
+        SQL::HistoryColumns chunk;
+        auto flush = [&]() {
+            consume(chunk);
+            chunk.day.clear();
+            chunk.activity.clear();
+            chunk.group.clear();
+            chunk.hours.clear();
+        };
+
+        while (!heads.empty())
+        {
+            Cursor& cur { cursors[heads.top().second] };
+            heads.pop();
+
+            pair<int, double> const& d { (*cur.days)[cur.pos] };
+            chunk.day.push_back(d.first);
+            chunk.activity.push_back(cur.id);
+            chunk.group.push_back(cur.group);
+            chunk.hours.push_back(d.second);
+
+            if (++cur.pos < cur.days->size() &&
+                    (*cur.days)[cur.pos].first <= b) {
+                heads.push({ (*cur.days)[cur.pos].first,
+                        static_cast<size_t>(&cur - cursors.data()) });
+            }
+
+            if (chunk.size() == SQL::FETCH_CHUNK) {
+                flush();
+            }
+        }
+
+        if (!chunk.empty()) {
+            flush();
+        }
+    }
+
+    void Memory::stream_segments(long long const from, long long const to,
+            function<void(SQL::SegmentColumns const&)> const& consume)
+    {
+        auto it = lower_bound(segments_.begin(), segments_.end(), from,
+                [](tuple<long long, int, int> const& s, long long const v) {
+            return get<0>(s) < v;
+        });
+
+        SQL::SegmentColumns chunk;
+        for (; it != segments_.end() && get<0>(*it) < to; ++it)
+        {
+            chunk.start.push_back(get<0>(*it));
+            chunk.activity.push_back(get<1>(*it));
+            chunk.duration.push_back(get<2>(*it));
+
+            if (chunk.size() == SQL::FETCH_CHUNK)
+            {
+                consume(chunk);
+                chunk.start.clear();
+                chunk.activity.clear();
+                chunk.duration.clear();
+            }
+        }
+
+        if (!chunk.empty()) {
+            consume(chunk);
+        }
+    }
+
+    string Memory::oldest_date(void)
+    {
+        bool found { false };
+        int oldest {};
+        for (auto const& entry : days_)
+        {
+            if (entry.second.empty()) {
+                continue;
+            }
+            int const day { entry.second.front().first };
+            if (!found || day < oldest) {
+                oldest = day;
+                found = true;
+            }
+        }
+        return found ? TIME::conv_epoch_day_to_date(oldest) : "";
+    }
+
+    vector<GOALS::Goal> Memory::goals(void)
+    {
+        return goals_;
+    }
+
+    void Memory::set_goal(GOALS::Goal const& goal)
+    {
+        for (GOALS::Goal& g : goals_)
+        {
+            if (g.group == goal.group && g.target == goal.target &&
+                    g.period == goal.period) {
+                g.hours = goal.hours;
+                return;
+            }
+        }
+        GOALS::Goal added { goal };
+        added.id = next_goal_id_++;
+        goals_.push_back(added);
+    }
+
+    void Memory::remove_goal(int const id)
+    {
+        erase_if(goals_, [id](GOALS::Goal const& g) { return g.id == id; });
+    }
+}
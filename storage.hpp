@@ -0,0 +1,293 @@
+#pragma once
+#include <soci/soci.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./goals.hpp"
+#include "./snapshot.hpp"
+#include "./sql.hpp"
+#include "./stats.hpp"
+
+namespace STORAGE {
+
+    /* part of a work phase that falls on one day (phases running past
+     * midnight come in two parts), start is unix time
+     */
+    struct WorkPart
+    {
+        std::string date;
+        double      hours;
+        long long   start;
+        int         duration; // seconds
+    };
+
+    // hours a write stored on one day of an activity
+    struct Stored
+    {
+        int         activity;
+        std::string date;
+        double      hours;
+    };
+
+    /* everything the menus and reports need from storage
+     * writes have to invalidate STATS::cache() for the days they touch,
+     * and hand what they stored to stored() once it is stored
+     */
+    class Backend
+    {
+    public:
+        virtual ~Backend() = default;
+
+        // all activities, ordered by id
+        virtual std::vector<SQL::Activity> activities(void) = 0;
+        virtual void add_activity(std::string const& name, int const group,
+                std::string const& date) = 0;
+        virtual void set_activated(int const id, bool const activated) = 0;
+
+        /* groups form a tree, a group that only an activity refers to is
+         * a top level group named after its id; hours_total of a group is
+         * kept as the sum over its subtree on every write
+         */
+        virtual std::vector<SQL::Group> groups(void) = 0; // ordered by id
+        virtual void add_group(std::string const& name, int const parent) = 0;
+        // parent 0 makes it a top level group, throws on a cycle
+        virtual void move_group(int const id, int const parent) = 0;
+        // (ancestor, descendant) for every group below or equal to another
+        virtual std::vector<std::pair<int, int>> group_closure(void) = 0;
+
+        /* one work phase of activity id: hours go to the days of the parts
+         * and the activity's total, the parts are kept as segments;
+         * all of it or nothing
+         */
+        virtual void commit_work(int const id,
+                std::vector<WorkPart> const& parts) = 0;
+
+        // manual entry, adds hours to one day (no segment)
+        virtual void add_hours(int const id, std::string const& date,
+                double const hours) = 0;
+
+        // daily sums of first..last, date ordered (see SQL::stream_dates_data)
+        virtual void stream_days(std::string const& first,
+                std::string const& last,
+                std::function<void(SQL::HistoryColumns const&)> const&
+                consume) = 0;
+
+        /* stream_days with only the rows filter lets through (the range is
+         * also narrowed to the filter's dates); by default filter is applied
+         * to the rows of stream_days in memory
+         */
+        virtual void stream_filtered_days(std::string const& first,
+                std::string const& last, FILTER::Filter const& filter,
+                std::function<void(SQL::HistoryColumns const&)> const&
+                consume);
+
+        // segments starting in [from, to), ordered by start
+        virtual void stream_segments(long long const from, long long const to,
+                std::function<void(SQL::SegmentColumns const&)> const&
+                consume) = 0;
+
+        // oldest date with an entry, empty if there is none
+        virtual std::string oldest_date(void) = 0;
+
+        /* days before it are only kept as one entry per activity and month
+         * (see RETENTION), empty if none are; never unless overridden
+         */
+        virtual std::string compacted_before(void) { return {}; }
+
+        /* goals ordered by id; adding a goal for a target and period that
+         * already has one replaces its hours
+         */
+        virtual std::vector<GOALS::Goal> goals(void) = 0;
+        virtual void set_goal(GOALS::Goal const& goal) = 0;
+        virtual void remove_goal(int const id) = 0;
+
+        // returns once every write handed in so far is stored
+        virtual void flush(void) {}
+
+        /* true if another connection wrote to the db since the last call,
+         * so anything cached from it may be stale; never unless overridden
+         */
+        virtual bool changed_elsewhere(void) { return false; }
+
+        /* moves the hours stored since the last call to out, in the order
+         * they were stored (failed writes never show up); false if more
+         * were stored than kept in between, out is incomplete then
+         */
+        virtual bool take_stored(std::vector<Stored>& out);
+
+        // second level behind STATS::cache(), none unless overridden
+        virtual STATS::Cache::Backing stats_backing(std::string const& shape)
+        {
+            (void)shape;
+            return {};
+        }
+
+        /* up to n scans of stream_days that may run on threads of their
+         * own, all at the same time (see STATS::collect); they see every
+         * write handed in before the call, none unless overridden
+         */
+        virtual std::vector<STATS::Scan> parallel_scans(std::size_t const n)
+        {
+            (void)n;
+            return {};
+        }
+
+    protected:
+        // up to STORED_MAX writes wait for take_stored(), later ones are lost
+        static constexpr std::size_t STORED_MAX { 4096 };
+
+        void stored(int const activity, std::string const& date,
+                double const hours);
+
+    private:
+        std::vector<Stored> stored_;
+        bool                lost_ {};
+    };
+
+    /* brings STATS::totals() and GOALS::progress() up to what storage
+     * stored since the last call, writes still on their way count once
+     * they're through; if another connection wrote (or too much came in
+     * between) they start over from the db along with STATS::cache()
+     * the ui calls it before it reads any of them
+     */
+    void catch_up(Backend& storage);
+
+    /* the sqlite db, through a session the caller owns and has opened
+     * users (ids, see SQL::ensure_user) limits it to their activities, the
+     * history and goals of those and the groups they're in (with their
+     * hours only), new activities and group goals go to the first of them;
+     * with none it's everyone's
+     * the group tree itself is shared, only changed without users
+     */
+    class Sqlite : public Backend
+    {
+    public:
+        explicit Sqlite(soci::session& sql, std::vector<int> users = {})
+            : sql_(&sql), users_(std::move(users)) {}
+
+        std::vector<SQL::Activity> activities(void) override;
+        void add_activity(std::string const& name, int const group,
+                std::string const& date) override;
+        void set_activated(int const id, bool const activated) override;
+
+        std::vector<SQL::Group> groups(void) override;
+        void add_group(std::string const& name, int const parent) override;
+        void move_group(int const id, int const parent) override;
+        std::vector<std::pair<int, int>> group_closure(void) override;
+
+        void commit_work(int const id,
+                std::vector<WorkPart> const& parts) override;
+        void add_hours(int const id, std::string const& date,
+                double const hours) override;
+
+        void stream_days(std::string const& first, std::string const& last,
+                std::function<void(SQL::HistoryColumns const&)> const&
+                consume) override;
+        void stream_filtered_days(std::string const& first,
+                std::string const& last, FILTER::Filter const& filter,
+                std::function<void(SQL::HistoryColumns const&)> const&
+                consume) override;
+        void stream_segments(long long const from, long long const to,
+                std::function<void(SQL::SegmentColumns const&)> const&
+                consume) override;
+        std::string oldest_date(void) override;
+
+        std::vector<GOALS::Goal> goals(void) override;
+        void set_goal(GOALS::Goal const& goal) override;
+        void remove_goal(int const id) override;
+
+        STATS::Cache::Backing stats_backing(std::string const& shape) override;
+        std::vector<STATS::Scan> parallel_scans(std::size_t const n) override;
+        bool changed_elsewhere(void) override;
+        std::string compacted_before(void) override;
+
+        /* days up to the snapshot's last one are streamed from it instead
+         * of the db, for as long as it matches the db (checked on every
+         * read, once it doesn't it's dropped); it holds every user's days,
+         * so one limited to users never reads it
+         */
+        void attach_snapshot(std::shared_ptr<SNAPSHOT::File const> snapshot)
+        {
+            snapshot_ = std::move(snapshot);
+        }
+
+    private:
+        // the snapshot if it still matches the db, else nullptr
+        std::shared_ptr<SNAPSHOT::File const> snapshot(void);
+        // throws unless activity id belongs to one of users_
+        void check_user(int const id);
+        // throws if limited to users, the group tree is everyone's
+        void check_shared(void);
+
+        soci::session* sql_;
+        std::vector<int> users_;
+        std::shared_ptr<SNAPSHOT::File const> snapshot_;
+        // read only connections of the parallel scans, opened on first use
+        std::vector<std::unique_ptr<soci::session>> readers_;
+        // prepared on first use, then kept for every filter that follows
+        std::unique_ptr<SQL::FilteredDays> filtered_daily_;
+        std::unique_ptr<SQL::FilteredDays> filtered_monthly_;
+        // PRAGMA data_version seen by the last changed_elsewhere()
+        long long data_version_ { -1 };
+    };
+
+    /* everything in memory, gone on exit
+     * activities are hashed by id, each activity has its days as a day
+     * sorted array, segments are one array sorted by start; every group
+     * has its ancestor list (the closure, one row per group)
+     */
+    class Memory : public Backend
+    {
+    public:
+        std::vector<SQL::Activity> activities(void) override;
+        void add_activity(std::string const& name, int const group,
+                std::string const& date) override;
+        void set_activated(int const id, bool const activated) override;
+
+        std::vector<SQL::Group> groups(void) override;
+        void add_group(std::string const& name, int const parent) override;
+        void move_group(int const id, int const parent) override;
+        std::vector<std::pair<int, int>> group_closure(void) override;
+
+        void commit_work(int const id,
+                std::vector<WorkPart> const& parts) override;
+        void add_hours(int const id, std::string const& date,
+                double const hours) override;
+
+        void stream_days(std::string const& first, std::string const& last,
+                std::function<void(SQL::HistoryColumns const&)> const&
+                consume) override;
+        void stream_segments(long long const from, long long const to,
+                std::function<void(SQL::SegmentColumns const&)> const&
+                consume) override;
+        std::string oldest_date(void) override;
+
+        std::vector<GOALS::Goal> goals(void) override;
+        void set_goal(GOALS::Goal const& goal) override;
+        void remove_goal(int const id) override;
+
+    private:
+        SQL::Activity& find(int const id);
+        SQL::Group& ensure_group(int const id);
+        void roll_up(int const group, double const hours);
+
+        std::unordered_map<int, SQL::Activity> activities_;
+        // activity id -> (epoch day, hours), sorted by day
+        std::unordered_map<int, std::vector<std::pair<int, double>>> days_;
+        // (start, activity id, duration), sorted by start then activity
+        std::vector<std::tuple<long long, int, int>> segments_;
+        std::vector<GOALS::Goal> goals_; // sorted by id
+        std::unordered_map<int, SQL::Group> groups_;
+        // group id -> the group itself, its parent, .. up to the top
+        std::unordered_map<int, std::vector<int>> ancestors_;
+        int next_id_ { 1 };
+        int next_goal_id_ { 1 };
+    };
+}
@@ -0,0 +1,409 @@
+#include <cmath>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <soci/soci.h>
+#include <fmt/core.h>
+
+#include "./retention.hpp"
+#include "./schema.hpp"
+#include "./sql.hpp"
+#include "./sync.hpp"
+#include "./time.hpp"
+
+using namespace std;
+
+/* how syncing works (tables are created by SCHEMA migration 4):
+ * -) every db is a replica with a random id and a change counter (seq)
+ * -) activities carry a uuid, so they're matched by uuid, never by id
+ * -) history.hours_on_day is the sum of what each replica contributed to
+ *    that activity and day; a replica's contribution only ever grows, so two
+ *    versions of it merge by taking the larger one, in any order, any number
+ *    of times, with the same result on both sides
+ * -) every changed activity/contribution row gets the next seq, a pull only
+ *    reads rows with a seq above what was pulled from that peer last time
+ * -) activity attributes (name, group, activation) go to the latest change,
+ *    ties broken by name so both sides pick the same one
+ * -) months folded by RETENTION keep one contribution per replica and
+ *    activity, dated "yyyy-mm"; where either side has a month folded (or
+ *    a folded row of it) the two merge by month: a replica's month only
+ *    grows as well, so the larger sum of it wins (its days, if any, are
+ *    replaced by the folded row)
+ */
+
+namespace SYNC
+{
+    static string replica_id(soci::session& sql)
+    {
+        string id;
+        sql << "SELECT value FROM meta WHERE key = 'replica_id'",
+            soci::into(id);
+        return id;
+    }
+
+    static long long current_seq(soci::session& sql)
+    {
+        long long seq {};
+        sql << "SELECT value FROM meta WHERE key = 'seq'", soci::into(seq);
+        return seq;
+    }
+
+    static void add_to_history(
+            soci::session& sql,
+            int const id,
+            string const& date,
+            double const delta)
+    {
+        /* adds delta hours to an activity's day, creating the row if needed
+         * (the triggers are off while syncing, so this doesn't count as a
+         * local contribution); days compacted here go to their month
+         */
+        if (RETENTION::add_to_month(sql, id, date, delta))
+        {
+            sql <<
+                "UPDATE activities SET hours_total = hours_total + :delta "
+                "WHERE id = :id",
+                soci::use(delta), soci::use(id);
+            return;
+        }
+
+        // sealed years too, the peer wrote there before it got sealed
+        string const table { SQL::partition(sql, date, true) };
+
+        double hours { -1.0 };
+        sql <<
+            "SELECT hours_on_day FROM " + table + " "
+            "WHERE id_activity = :id AND date = :date",
+            soci::use(id), soci::use(date), soci::into(hours);
+
+        if (hours == -1.0)
+        {
+            string datetime { date + " xx:xx" };
+            string year  { TIME::from_datetime_extract_year(datetime) };
+            string month { TIME::from_datetime_extract_month(datetime) };
+            string day   { TIME::from_datetime_extract_day(datetime) };
+            string wkno  { TIME::get_weeknumber_for_date(date) };
+
+            // the user of the row is the one of its activity
+            sql <<
+                "INSERT INTO " + table + " "
+                "(id_activity, year, month, day, weeknumber, hours_on_day, "
+                "date, user_id) "
+                "VALUES (:id, :year, :month, :day, :wkno, :hours, :date, "
+                "(SELECT user_id FROM activities WHERE id = :id))",
+                soci::use(id), soci::use(year), soci::use(month),
+                soci::use(day), soci::use(wkno), soci::use(delta),
+                soci::use(date);
+        }
+        else
+        {
+            hours += delta;
+            sql <<
+                "UPDATE " + table + " SET hours_on_day = :hours "
+                "WHERE id_activity = :id AND date = :date",
+                soci::use(hours), soci::use(id), soci::use(date);
+        }
+
+        sql <<
+            "UPDATE activities SET hours_total = hours_total + :delta "
+            "WHERE id = :id",
+            soci::use(delta), soci::use(id);
+    }
+
+    static double month_total(
+            soci::session& sql,
+            string const& origin,
+            string const& uuid,
+            string const& month)
+    {
+        // folded row and days of month alike ("yyyy-mm" sorts before both)
+        string const next { RETENTION::next_month(month).substr(0, 7) };
+        double hours {};
+        sql <<
+            "SELECT COALESCE(SUM(hours), 0) FROM contributions "
+            "WHERE origin = :origin AND activity_uuid = :uuid "
+            "AND date >= :month AND date < :next",
+            soci::use(origin), soci::use(uuid), soci::use(month),
+            soci::use(next), soci::into(hours);
+        return hours;
+    }
+
+    static bool by_month(
+            soci::session& dst,
+            string const& compacted,
+            string const& origin,
+            string const& uuid,
+            string const& date)
+    {
+        // a folded row, a day dst has folded, or a day of a month dst got
+        // a folded row for
+        if (date.size() == 7 || date < compacted) {
+            return true;
+        }
+        int rows {};
+        string const month { date.substr(0, 7) };
+        dst <<
+            "SELECT COUNT(*) FROM contributions "
+            "WHERE origin = :origin AND activity_uuid = :uuid "
+            "AND date = :month",
+            soci::use(origin), soci::use(uuid), soci::use(month),
+            soci::into(rows);
+        return rows > 0;
+    }
+
+    static size_t pull_activities(
+            soci::session& dst,
+            soci::session& src,
+            long long const pulled,
+            long long& seq)
+    {
+        size_t changed {};
+
+        soci::rowset<soci::row> rows = (src.prepare <<
+            "SELECT uuid, group_id, name, added_when, is_activated, "
+            "changed_at FROM activities WHERE seq > :pulled ORDER BY seq",
+            soci::use(pulled));
+
+        for (soci::row const& row : rows)
+        {
+            string    uuid       { row.get<string>("uuid") };
+            int       group      { row.get<int>("group_id") };
+            string    name       { row.get<string>("name") };
+            string    added      { row.get<string>("added_when") };
+            int       activated  { row.get<int>("is_activated") };
+            long long changed_at { row.get<long long>("changed_at") };
+
+            int id { -1 };
+            long long dst_changed_at {};
+            string dst_name;
+            dst <<
+                "SELECT id, changed_at, name FROM activities "
+                "WHERE uuid = :uuid",
+                soci::use(uuid),
+                soci::into(id), soci::into(dst_changed_at),
+                soci::into(dst_name);
+
+            if (id == -1)
+            {
+                ++seq;
+                dst <<
+                    "INSERT INTO activities "
+                    "(group_id, name, added_when, is_activated, uuid, seq, "
+                    "changed_at) "
+                    "VALUES (:group, :name, :added, :activated, :uuid, :seq, "
+                    ":changed_at)",
+                    soci::use(group), soci::use(name), soci::use(added),
+                    soci::use(activated), soci::use(uuid), soci::use(seq),
+                    soci::use(changed_at);
+                ++changed;
+            }
+            else if (changed_at > dst_changed_at ||
+                    (changed_at == dst_changed_at && name > dst_name))
+            {
+                ++seq;
+                dst <<
+                    "UPDATE activities SET group_id = :group, name = :name, "
+                    "is_activated = :activated, changed_at = :changed_at, "
+                    "seq = :seq WHERE id = :id",
+                    soci::use(group), soci::use(name), soci::use(activated),
+                    soci::use(changed_at), soci::use(seq), soci::use(id);
+                ++changed;
+            }
+        }
+
+        return changed;
+    }
+
+    static size_t pull_hours(
+            soci::session& dst,
+            soci::session& src,
+            long long const pulled,
+            long long& seq)
+    {
+        size_t changed {};
+        unordered_map<string, int> ids; // activity uuid -> dst id
+        set<string> dates;
+        string const compacted { RETENTION::compacted_before(dst) };
+
+        vector<string> origin(SQL::FETCH_CHUNK);
+        vector<string> uuid(SQL::FETCH_CHUNK);
+        vector<string> date(SQL::FETCH_CHUNK);
+        vector<double> hours(SQL::FETCH_CHUNK);
+
+        soci::statement st = (src.prepare <<
+            "SELECT origin, activity_uuid, date, hours FROM contributions "
+            "WHERE seq > :pulled ORDER BY seq",
+            soci::use(pulled),
+            soci::into(origin), soci::into(uuid), soci::into(date),
+            soci::into(hours));
+
+        st.execute();
+        while (st.fetch())
+        {
+            for (size_t i {}; i < origin.size(); ++i)
+            {
+                auto it = ids.find(uuid[i]);
+                if (it == ids.end())
+                {
+                    int id { -1 };
+                    dst << "SELECT id FROM activities WHERE uuid = :uuid",
+                        soci::use(uuid[i]), soci::into(id);
+                    if (id == -1) {
+                        throw runtime_error("sync: unknown activity " + uuid[i]);
+                    }
+                    it = ids.emplace(uuid[i], id).first;
+                }
+
+                if (by_month(dst, compacted, origin[i], uuid[i], date[i]))
+                {
+                    // the month's hours go to its first day (or its
+                    // history_monthly row, if it's folded here too)
+                    string const month { date[i].substr(0, 7) };
+                    string const next {
+                        RETENTION::next_month(month).substr(0, 7) };
+                    double const theirs {
+                        month_total(src, origin[i], uuid[i], month) };
+                    double const mine {
+                        month_total(dst, origin[i], uuid[i], month) };
+                    if (theirs <= mine + 1e-9) {
+                        continue;
+                    }
+
+                    ++seq;
+                    dst <<
+                        "DELETE FROM contributions "
+                        "WHERE origin = :origin AND activity_uuid = :uuid "
+                        "AND date > :month AND date < :next",
+                        soci::use(origin[i]), soci::use(uuid[i]),
+                        soci::use(month), soci::use(next);
+                    dst <<
+                        "INSERT INTO contributions "
+                        "(origin, activity_uuid, date, hours, seq) "
+                        "VALUES (:origin, :uuid, :month, :hours, :seq) "
+                        "ON CONFLICT (origin, activity_uuid, date) DO UPDATE "
+                        "SET hours = excluded.hours, seq = excluded.seq",
+                        soci::use(origin[i]), soci::use(uuid[i]),
+                        soci::use(month), soci::use(theirs), soci::use(seq);
+
+                    add_to_history(dst, it->second, month + "-01",
+                            theirs - mine);
+                    dates.insert(month + "-01");
+                    ++changed;
+                    continue;
+                }
+
+                double mine { 0.0 };
+                soci::indicator ind { soci::i_null };
+                dst <<
+                    "SELECT hours FROM contributions "
+                    "WHERE origin = :origin AND activity_uuid = :uuid "
+                    "AND date = :date",
+                    soci::use(origin[i]), soci::use(uuid[i]),
+                    soci::use(date[i]), soci::into(mine, ind);
+
+                // the larger contribution is the newer one, equal is a no-op
+                if (ind == soci::i_ok && hours[i] <= mine + 1e-9) {
+                    continue;
+                }
+                double const delta { hours[i] - (ind == soci::i_ok ? mine : 0.0) };
+
+                ++seq;
+                dst <<
+                    "INSERT INTO contributions "
+                    "(origin, activity_uuid, date, hours, seq) "
+                    "VALUES (:origin, :uuid, :date, :hours, :seq) "
+                    "ON CONFLICT (origin, activity_uuid, date) DO UPDATE SET "
+                    "hours = excluded.hours, seq = excluded.seq",
+                    soci::use(origin[i]), soci::use(uuid[i]),
+                    soci::use(date[i]), soci::use(hours[i]), soci::use(seq);
+
+                add_to_history(dst, it->second, date[i], delta);
+                dates.insert(date[i]);
+                ++changed;
+            }
+
+            origin.resize(SQL::FETCH_CHUNK);
+            uuid.resize(SQL::FETCH_CHUNK);
+            date.resize(SQL::FETCH_CHUNK);
+            hours.resize(SQL::FETCH_CHUNK);
+        }
+
+        for (string const& d : dates) {
+            SQL::invalidate_stats(dst, d);
+        }
+
+        return changed;
+    }
+
+    Pulled pull(soci::session& dst, soci::session& src)
+    {
+        string const src_id { replica_id(src) };
+        string const dst_id { replica_id(dst) };
+
+        if (src_id == dst_id) {
+            throw runtime_error("both dbs have the same replica id, one is a "
+                    "copy of the other; run 'tracker sync --fork' on one "
+                    "of them first");
+        }
+
+        // read transaction on src: everything below sees one snapshot
+        soci::transaction src_tr(src);
+        long long const src_seq { current_seq(src) };
+
+        soci::transaction tr(dst);
+
+        long long pulled {};
+        dst << "SELECT pulled_seq FROM sync_peers WHERE replica = :id",
+            soci::use(src_id), soci::into(pulled);
+
+        long long seq { current_seq(dst) };
+
+        Pulled result;
+        dst << "UPDATE meta SET value = 1 WHERE key = 'applying_sync'";
+
+        result.activities = pull_activities(dst, src, pulled, seq);
+        result.hours      = pull_hours(dst, src, pulled, seq);
+
+        dst << "UPDATE meta SET value = 0 WHERE key = 'applying_sync'";
+        dst << "UPDATE meta SET value = :seq WHERE key = 'seq'",
+            soci::use(seq);
+        dst <<
+            "INSERT INTO sync_peers (replica, pulled_seq) "
+            "VALUES (:id, :seq) "
+            "ON CONFLICT (replica) DO UPDATE SET pulled_seq = excluded.pulled_seq",
+            soci::use(src_id), soci::use(src_seq);
+
+        tr.commit();
+        src_tr.commit();
+
+        return result;
+    }
+
+    void sync(soci::session& sql, string const& path)
+    {
+        soci::session other("sqlite3", "db=" + path);
+        SCHEMA::open(other);
+
+        Pulled const in  { pull(sql, other) };
+        Pulled const out { pull(other, sql) };
+
+        cout << fmt::format(
+                "Synced with {}\n"
+                "  from there: {} activity changes, {} day changes\n"
+                "  to there  : {} activity changes, {} day changes\n",
+                path, in.activities, in.hours, out.activities, out.hours);
+    }
+
+    void fork(soci::session& sql)
+    {
+        sql <<
+            "UPDATE meta SET value = lower(hex(randomblob(16))) "
+            "WHERE key = 'replica_id'";
+        sql << "DELETE FROM sync_peers";
+
+        cout << "New replica id: " << replica_id(sql) << endl;
+    }
+}
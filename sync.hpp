@@ -0,0 +1,28 @@
+#pragma once
+#include <soci/soci.h>
+
+#include <cstddef>
+#include <string>
+
+namespace SYNC {
+
+    // what one pull brought over
+    struct Pulled
+    {
+        std::size_t activities {};
+        std::size_t hours {};
+    };
+
+    /* applies every change of src that dst hasn't seen yet to dst
+     * only rows of the change log newer than the last pull are read
+     */
+    Pulled pull(soci::session& dst, soci::session& src);
+
+    // two way sync of the db behind sql with the db file at path
+    void sync(soci::session& sql, std::string const& path);
+
+    /* gives the db a new replica id, needed once after copying a db file
+     * to another machine (both copies would share the id otherwise)
+     */
+    void fork(soci::session& sql);
+}
@@ -105,6 +105,35 @@ namespace TIME
             return datetime_map;
         }
 
+    static long long utc_offset(long long const utc)
+    {
+        time_t t { static_cast<time_t>(utc) };
+        tm local {};
+        localtime_r(&t, &local);
+        return static_cast<long long>(local.tm_gmtoff);
+    }
+
+    long long LocalOffset::operator()(long long const utc)
+    {
+        if (utc >= from_ && utc < until_) {
+            return offset_;
+        }
+
+        /* dst changes at most twice a year and always on an hour boundary:
+         * if the offset a day later is the same, it holds for that whole day,
+         * otherwise only until the end of the current hour
+         */
+        offset_ = utc_offset(utc);
+        from_   = utc;
+        if (utc_offset(utc + 86400) == offset_) {
+            until_ = utc + 86400;
+        }
+        else {
+            until_ = (utc / 3600 + 1) * 3600;
+        }
+        return offset_;
+    }
+
     string from_datetime_extract_date(string const datetime)
     {
         /*  takes chrono datetime string and returns just date portion
@@ -185,6 +214,52 @@ namespace TIME
             to_string(minutes);
     }
 
+    int conv_date_to_epoch_day(string const date)
+    {
+        /* takes yyyy-mm-dd string and returns days since 1970-01-01
+         * (same numbering sqlite's julianday(date) - 2440587.5 gives)
+         */
+        int yy {}, mm {}, dd {};
+        sscanf(date.c_str(), "%d-%d-%d", &yy, &mm, &dd);
+
+        chrono::sys_days const days {
+            chrono::year { yy } /
+            chrono::month { static_cast<unsigned>(mm) } /
+            chrono::day { static_cast<unsigned>(dd) } };
+
+        return static_cast<int>(days.time_since_epoch().count());
+    }
+
+    string conv_epoch_day_to_date(int const day)
+    {
+        /* inverse of conv_date_to_epoch_day, returns yyyy-mm-dd string
+         */
+        chrono::year_month_day const ymd {
+            chrono::sys_days { chrono::days { day } } };
+
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%04d-%02u-%02u",
+                static_cast<int>(ymd.year()),
+                static_cast<unsigned>(ymd.month()),
+                static_cast<unsigned>(ymd.day()));
+
+        return string(buf);
+    }
+
+    long long conv_datetime_to_epoch(string const date, string const time)
+    {
+        /* takes local yyyy-mm-dd and hh:mm:ss strings and returns seconds
+         * since the unix epoch (mktime works out the dst offset)
+         */
+        tm t {};
+        sscanf(date.c_str(), "%d-%d-%d", &t.tm_year, &t.tm_mon, &t.tm_mday);
+        sscanf(time.c_str(), "%d:%d:%d", &t.tm_hour, &t.tm_min, &t.tm_sec);
+        t.tm_year -= 1900;
+        t.tm_mon  -= 1;
+        t.tm_isdst = -1;
+
+        return static_cast<long long>(mktime(&t));
+    }
 
     vector<int> get_time_vector(void)
     {
@@ -24,7 +24,26 @@ namespace TIME {
     std::string from_datetime_extract_month(std::string const datetime);
     std::string from_datetime_extract_year(std::string const datetime);
 
+    /* offset of local time from UTC (seconds) at a unix time
+     * remembers the last answer and the window it's valid for, so scanning
+     * date ordered timestamps costs about two localtime calls per day
+     */
+    class LocalOffset
+    {
+    public:
+        long long operator()(long long const utc);
+
+    private:
+        long long from_   { 1 };  // window [from_, until_) offset_ applies to
+        long long until_  { 0 };
+        long long offset_ { 0 };
+    };
+
     // conversion functions
     double conv_seconds_to_hours(unsigned int const seconds);
     std::string conv_hours_to_timestring(double const hours);
+    int conv_date_to_epoch_day(std::string const date);
+    std::string conv_epoch_day_to_date(int const day);
+    long long conv_datetime_to_epoch(std::string const date,
+            std::string const time);
 }
@@ -1,11 +1,17 @@
+#include <algorithm>
 #include <condition_variable>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 #include <fmt/core.h>
 
+#include "./goals.hpp"
+#include "./stats.hpp"
+#include "./status.hpp"
+#include "./storage.hpp"
 #include "./time.hpp"
 #include "./tracker.hpp"
 
@@ -17,8 +23,11 @@ namespace TRACKER
     condition_variable cv;
     bool done { false };
 
-    void print_time(bool& countdown, int& countdown_seconds, bool& br) {
+    void print_time(bool& countdown, int& countdown_seconds, bool& br,
+            int const activity) {
         /* prints a timer counting upwards in seconds
+         * during work phases followed by the goal progress of activity, with
+         * the running phase counted in (from memory, see GOALS::Progress)
          */
         auto start = chrono::steady_clock::now();
 		double countdown_hours {};
@@ -33,19 +42,28 @@ namespace TRACKER
             if (done) {
                 break; // exit loop, complete thread
             }
+            // lets `tracker status` tell a running timer from a dead one
+            STATUS::publisher().beat();
             auto now = chrono::steady_clock::now();
             auto duration = chrono::duration_cast<chrono::seconds>(now-start);
             int hours   { static_cast<int>(duration.count() / 3600) };
             int minutes { static_cast<int>((duration.count() % 3600) / 60) };
             int seconds { static_cast<int>(duration.count() % 60) };
 
+            string goals;
+            if (!br) {
+                goals = GOALS::progress().status(activity,
+                        static_cast<double>(duration.count()) / 3600);
+            }
+
 			if (!br & countdown)
 			{
 				countdown_seconds -= 1;
 				countdown_hours =
 					static_cast<double>(countdown_seconds) / 3600;
 
-				cout << fmt::format("\t{:02.2f}\r", countdown_hours) << flush;
+				cout << fmt::format("\t{:02.2f}  {}\r", countdown_hours, goals)
+					<< flush;
 
 				if (countdown_hours < 0) {
 					cout << fmt::format(
@@ -60,13 +78,14 @@ namespace TRACKER
 			}
 			else
 			{
-				cout << fmt::format("\t{:02}:{:02}:{:02}\r",
-						hours, minutes, seconds) << flush;
+				cout << fmt::format("\t{:02}:{:02}:{:02}  {}\r",
+						hours, minutes, seconds, goals) << flush;
 			}
 		}
     }
 
-    string timeloop(bool& countdown, int& countdown_seconds, bool& br)
+    string timeloop(bool& countdown, int& countdown_seconds, bool& br,
+            int const activity)
     {
         /* spawns timer (print_time) as separate thread
          * then waits for user input
@@ -76,7 +95,9 @@ namespace TRACKER
         string input;
         done = false;
 		// launch print_time as separate thread
-		thread t([&]() { print_time(countdown, countdown_seconds, br); });
+		thread t([&]() {
+			print_time(countdown, countdown_seconds, br, activity);
+		});
 
         getline(cin, input);
         {
@@ -98,8 +119,22 @@ namespace TRACKER
         }
     }
 
+    void print_menu(void)
+    {
+        cout <<
+            "Available options:\n"
+            "(w)ork\n"
+            "(s)tats\n"
+            "(h)eatmap\n"
+            "(c)onfigure\n"
+            "(m)anual\n"
+            "(q)uit\n\n";
+
+        cout << "Enter option: ";
+    }
+
     void update_work_time(
-            soci::session& sql,
+            STORAGE::Backend& storage,
             string const actid,
             unordered_map<string, string>& smap,
             unordered_map<string, string>& emap,
@@ -124,84 +159,31 @@ namespace TRACKER
             before_midnight = hours;
         }
 
-        if (DAY_CHANGED) {
-            // we know the current day can't have an entry yet
-            // we can simply insert the time here
-            // (emap and after_midnight)
-            sql <<
-                "INSERT INTO history (id_activity, year, month, day, "
-                "weeknumber, hours_on_day, date) "
-                "VALUES "
-                "(:id, :year, :month, :day, :wkno, :h_day, :date)",
-                soci::use(actid),
-                soci::use(emap["year"]),
-                soci::use(emap["month"]),
-                soci::use(emap["day"]),
-                soci::use(emap["wkno"]),
-                soci::use(after_midnight),
-                soci::use(emap["date"]);
-        }
-
-        // time after midnight has been taken care of
-        // now deal w/ before midnight and smap
+        // raw segments, split at midnight like the daily sums
+        int const id { stoi(actid) };
+        long long const start {
+            TIME::conv_datetime_to_epoch(smap["date"], smap["time"]) };
+        int const seconds { static_cast<int>(worked_seconds) };
 
-        double hours_on_day { -1.0 };
+        vector<STORAGE::WorkPart> parts;
 
-        sql <<
-            "SELECT hours_on_day FROM history "
-            "WHERE date = :date "
-            "AND id_activity = :id ",
-            soci::use(smap["date"]),
-            soci::use(actid),
-            soci::into(hours_on_day);
-
-        // if no value retrieved, insert
-        if (hours_on_day == -1.0)
+        if (DAY_CHANGED)
         {
-            sql <<
-                "INSERT INTO history (id_activity, year, month, day, "
-                "weeknumber, hours_on_day, date) "
-                "VALUES "
-                "(:id, :yyyy, :mm, :dd, :wkno, :h_day, :dateval)",
-                soci::use(actid),
-                soci::use(smap["year"]),
-                soci::use(smap["month"]),
-                soci::use(smap["day"]),
-                soci::use(smap["wkno"]),
-                soci::use(before_midnight),
-                soci::use(smap["date"]);
+            long long const midnight {
+                TIME::conv_datetime_to_epoch(emap["date"], "00:00:00") };
+            int const before { static_cast<int>(min<long long>(
+                        seconds, max<long long>(0, midnight - start))) };
+            parts.push_back({ smap["date"], before_midnight, start, before });
+            parts.push_back({ emap["date"], after_midnight, midnight,
+                    seconds - before });
         }
-        // if value retrieved, update
-        else
-        {
-            hours_on_day += before_midnight;
-            sql <<
-                "UPDATE history SET "
-                "hours_on_day = :hours "
-                "WHERE date = :date "
-                "AND id_activity = :id ",
-                soci::use(hours_on_day),
-                soci::use(smap["date"]),
-                soci::use(actid);
+        else {
+            parts.push_back({ smap["date"], before_midnight, start, seconds });
         }
 
-        // get hours_total from activities table and update value
-
-        double hours_total { 0.0 };
-
-        sql <<
-            "SELECT hours_total FROM activities "
-            "WHERE id = :id",
-            soci::use(actid), soci::into(hours_total);
-
-        hours_total += hours;
-
-        sql <<
-            "UPDATE activities SET "
-            "hours_total = :hours "
-            "WHERE id = :id",
-            soci::use(hours_total),
-            soci::use(actid);
+        // daily sums, segments and totals go in together or not at all;
+        // goals and range totals count it once it's through (catch_up)
+        storage.commit_work(id, parts);
 
         return;
     }
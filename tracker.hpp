@@ -1,16 +1,24 @@
 #pragma once
-#include <soci/soci.h>
 
 #include <string>
+#include <unordered_map>
+
+#include "./storage.hpp"
 
 namespace TRACKER {
 
-    std::string timeloop(bool& countdown, int& countdown_seconds, bool& br);
-    void print_time(bool& countdown, int& countdown_seconds, bool& br);
+    // activity is the one being worked on, its goals are shown with the timer
+    std::string timeloop(bool& countdown, int& countdown_seconds, bool& br,
+            int const activity);
+    void print_time(bool& countdown, int& countdown_seconds, bool& br,
+            int const activity);
 	void print_time_old(void);
 
+    // main menu with the prompt for the option key
+    void print_menu(void);
+
     void update_work_time(
-            soci::session& sql,
+            STORAGE::Backend& storage,
             std::string const actid,
             std::unordered_map<std::string, std::string>& smap,
             std::unordered_map<std::string, std::string>& emap,
@@ -0,0 +1,243 @@
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./alloc.hpp"
+#include "./writer.hpp"
+
+using namespace std;
+
+namespace WRITER
+{
+    // thread
+
+    Thread::Thread() : thread_(&Thread::run, this)
+    {
+    }
+
+    Thread::~Thread()
+    {
+        // an empty task is the stop sign, everything before it still runs
+        push(packaged_task<void()>());
+        thread_.join();
+    }
+
+    void Thread::run(void)
+    {
+        while (true)
+        {
+            packaged_task<void()> job { ring_.pop() };
+            if (!job.valid()) {
+                break;
+            }
+            job();
+        }
+    }
+
+    void Thread::push(packaged_task<void()> job)
+    {
+        if (this_thread::get_id() != owner_) {
+            throw runtime_error("db thread: jobs can only be handed in by "
+                    "the thread that started it");
+        }
+
+        // what the job allocates counts towards the scope handing it in
+        // (the empty stop sign stays empty)
+        char const* const tag {
+            ALLOC::enabled() && job.valid() ? ALLOC::current() : nullptr };
+        if (tag) {
+            job = packaged_task<void()>([tag, inner = move(job)]() mutable {
+                ALLOC::Scope scope(tag, false);
+                inner();
+            });
+        }
+        ring_.push(move(job));
+    }
+
+    void Thread::post(function<void()> job)
+    {
+        push(packaged_task<void()>([this, job = move(job)]() {
+            try {
+                job();
+            }
+            catch (...) {
+                // a failed write is rolled back, the ones after it go on
+                lock_guard<mutex> lock(failures_mutex_);
+                failures_.push_back(current_exception());
+            }
+        }));
+    }
+
+    void Thread::flush(void)
+    {
+        call([]() {}).get();
+    }
+
+    vector<exception_ptr> Thread::take_failures(void)
+    {
+        lock_guard<mutex> lock(failures_mutex_);
+        return exchange(failures_, {});
+    }
+
+    // queued
+
+    vector<SQL::Activity> Queued::activities(void)
+    {
+        return wait([this]() { return inner_->activities(); });
+    }
+
+    void Queued::add_activity(string const& name, int const group,
+            string const& date)
+    {
+        wait([&]() { inner_->add_activity(name, group, date); });
+    }
+
+    void Queued::set_activated(int const id, bool const activated)
+    {
+        wait([&]() { inner_->set_activated(id, activated); });
+    }
+
+    vector<SQL::Group> Queued::groups(void)
+    {
+        return wait([this]() { return inner_->groups(); });
+    }
+
+    void Queued::add_group(string const& name, int const parent)
+    {
+        wait([&]() { inner_->add_group(name, parent); });
+    }
+
+    void Queued::move_group(int const id, int const parent)
+    {
+        wait([&]() { inner_->move_group(id, parent); });
+    }
+
+    vector<pair<int, int>> Queued::group_closure(void)
+    {
+        return wait([this]() { return inner_->group_closure(); });
+    }
+
+    void Queued::commit_work(int const id,
+            vector<STORAGE::WorkPart> const& parts)
+    {
+        // the phase switch doesn't wait for the transaction
+        thread_->post([inner = inner_, id, parts]() {
+            inner->commit_work(id, parts);
+        });
+    }
+
+    void Queued::add_hours(int const id, string const& date,
+            double const hours)
+    {
+        thread_->post([inner = inner_, id, date, hours]() {
+            inner->add_hours(id, date, hours);
+        });
+    }
+
+    /* consume runs on the thread while the caller waits, so it may touch
+     * the caller's data
+     */
+    void Queued::stream_days(string const& first, string const& last,
+            function<void(SQL::HistoryColumns const&)> const& consume)
+    {
+        wait([&]() { inner_->stream_days(first, last, consume); });
+    }
+
+    void Queued::stream_filtered_days(string const& first,
+            string const& last, FILTER::Filter const& filter,
+            function<void(SQL::HistoryColumns const&)> const& consume)
+    {
+        wait([&]() {
+            inner_->stream_filtered_days(first, last, filter, consume);
+        });
+    }
+
+    void Queued::stream_segments(long long const from, long long const to,
+            function<void(SQL::SegmentColumns const&)> const& consume)
+    {
+        wait([&]() { inner_->stream_segments(from, to, consume); });
+    }
+
+    string Queued::oldest_date(void)
+    {
+        return wait([this]() { return inner_->oldest_date(); });
+    }
+
+    string Queued::compacted_before(void)
+    {
+        return wait([this]() { return inner_->compacted_before(); });
+    }
+
+    vector<GOALS::Goal> Queued::goals(void)
+    {
+        return wait([this]() { return inner_->goals(); });
+    }
+
+    void Queued::set_goal(GOALS::Goal const& goal)
+    {
+        wait([&]() { inner_->set_goal(goal); });
+    }
+
+    void Queued::remove_goal(int const id)
+    {
+        wait([&]() { inner_->remove_goal(id); });
+    }
+
+    vector<STATS::Scan> Queued::parallel_scans(size_t const n)
+    {
+        // the scans read on connections of their own, not on the thread;
+        // asking through the thread puts the call behind all posted writes
+        return wait([this, n]() { return inner_->parallel_scans(n); });
+    }
+
+    STATS::Cache::Backing Queued::stats_backing(string const& shape)
+    {
+        /* the inner backing reads and writes the db, so its calls have to
+         * go to the thread as well
+         */
+        auto inner = make_shared<STATS::Cache::Backing>(
+                wait([&]() { return inner_->stats_backing(shape); }));
+        if (!inner->load) {
+            return {};
+        }
+
+        STATS::Cache::Backing backing;
+        backing.load = [this, inner](int const first, int const last,
+                int const granularity, vector<STATS::Accumulator>& accs)
+        {
+            return wait([&]() {
+                return inner->load(first, last, granularity, accs);
+            });
+        };
+        backing.save = [this, inner](int const first, int const last,
+                int const granularity,
+                vector<STATS::Accumulator> const& accs)
+        {
+            wait([&]() { inner->save(first, last, granularity, accs); });
+        };
+        return backing;
+    }
+
+    void Queued::flush(void)
+    {
+        thread_->flush();
+    }
+
+    bool Queued::changed_elsewhere(void)
+    {
+        return wait([this]() { return inner_->changed_elsewhere(); });
+    }
+
+    bool Queued::take_stored(vector<STORAGE::Stored>& out)
+    {
+        // behind every write handed in so far, stored there by the thread
+        return wait([this, &out]() { return inner_->take_stored(out); });
+    }
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "./storage.hpp"
+
+namespace WRITER {
+
+    /* bounded single producer, single consumer queue without locks
+     * head and tail only ever grow, slot i of the ring is i % N; each side
+     * only writes its own index, the other one reads it with acquire, so a
+     * slot is handed over by the release store of the index behind it
+     * waiting (full or empty) sleeps on the index of the other side
+     */
+    template <typename T, std::size_t N>
+    class Ring
+    {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "N has to be a power of 2");
+
+    public:
+        // producer only, blocks while full
+        void push(T item)
+        {
+            std::size_t const tail { tail_.load(std::memory_order_relaxed) };
+            std::size_t head { head_.load(std::memory_order_acquire) };
+            while (tail - head == N) {
+                head_.wait(head, std::memory_order_acquire);
+                head = head_.load(std::memory_order_acquire);
+            }
+            slots_[tail & (N - 1)] = std::move(item);
+            tail_.store(tail + 1, std::memory_order_release);
+            tail_.notify_one();
+        }
+
+        // consumer only, blocks while empty
+        T pop(void)
+        {
+            std::size_t const head { head_.load(std::memory_order_relaxed) };
+            std::size_t tail { tail_.load(std::memory_order_acquire) };
+            while (head == tail) {
+                tail_.wait(tail, std::memory_order_acquire);
+                tail = tail_.load(std::memory_order_acquire);
+            }
+            T item { std::move(slots_[head & (N - 1)]) };
+            head_.store(head + 1, std::memory_order_release);
+            head_.notify_one();
+            return item;
+        }
+
+    private:
+        // on their own cache lines, each side keeps writing one of them
+        alignas(64) std::atomic<std::size_t> head_ {};
+        alignas(64) std::atomic<std::size_t> tail_ {};
+        std::array<T, N> slots_;
+    };
+
+    /* a thread that runs jobs one after the other, in the order they were
+     * handed in; only the thread that created it may hand in jobs (the ui,
+     * the Ring has a single producer), any other one gets an exception
+     * everything touching the db session goes through it, so the session
+     * is only ever used from this thread
+     */
+    class Thread
+    {
+    public:
+        // jobs that can be queued before call() and post() block
+        static constexpr std::size_t CAPACITY { 64 };
+
+        Thread();
+        ~Thread(); // runs what's queued, then stops
+        Thread(Thread const&) = delete;
+        Thread& operator=(Thread const&) = delete;
+
+        // runs f on the thread, its result (or exception) comes with the future
+        template <typename F>
+        auto call(F f) -> std::future<std::invoke_result_t<F&>>
+        {
+            using R = std::invoke_result_t<F&>;
+            auto promise = std::make_shared<std::promise<R>>();
+            std::future<R> result { promise->get_future() };
+
+            push(std::packaged_task<void()>(
+                    [promise, f = std::move(f)]() mutable {
+                try {
+                    if constexpr (std::is_void_v<R>) {
+                        f();
+                        promise->set_value();
+                    }
+                    else {
+                        promise->set_value(f());
+                    }
+                }
+                catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            }));
+            return result;
+        }
+
+        /* runs job on the thread, nobody waits for it; if it fails, its
+         * exception is kept for take_failures() and the thread carries on
+         * with the next job
+         */
+        void post(std::function<void()> job);
+
+        // returns once everything handed in so far has run
+        void flush(void);
+
+        // exceptions of the posted jobs that failed since the last call
+        std::vector<std::exception_ptr> take_failures(void);
+
+    private:
+        void push(std::packaged_task<void()> job);
+        void run(void);
+
+        Ring<std::packaged_task<void()>, CAPACITY> ring_;
+        std::mutex                      failures_mutex_;
+        std::vector<std::exception_ptr> failures_;
+        std::thread::id const           owner_ { std::this_thread::get_id() };
+        std::thread                     thread_;
+    };
+
+    /* a backend whose every call runs on a Thread
+     * commits and manual entries are posted, so they return right away
+     * (see Thread::take_failures for errors); everything else waits for
+     * its result,
+     * behind all writes handed in before it
+     */
+    class Queued : public STORAGE::Backend
+    {
+    public:
+        Queued(STORAGE::Backend& inner, Thread& thread)
+            : inner_(&inner), thread_(&thread) {}
+
+        std::vector<SQL::Activity> activities(void) override;
+        void add_activity(std::string const& name, int const group,
+                std::string const& date) override;
+        void set_activated(int const id, bool const activated) override;
+
+        std::vector<SQL::Group> groups(void) override;
+        void add_group(std::string const& name, int const parent) override;
+        void move_group(int const id, int const parent) override;
+        std::vector<std::pair<int, int>> group_closure(void) override;
+
+        void commit_work(int const id,
+                std::vector<STORAGE::WorkPart> const& parts) override;
+        void add_hours(int const id, std::string const& date,
+                double const hours) override;
+
+        void stream_days(std::string const& first, std::string const& last,
+                std::function<void(SQL::HistoryColumns const&)> const&
+                consume) override;
+        void stream_filtered_days(std::string const& first,
+                std::string const& last, FILTER::Filter const& filter,
+                std::function<void(SQL::HistoryColumns const&)> const&
+                consume) override;
+        void stream_segments(long long const from, long long const to,
+                std::function<void(SQL::SegmentColumns const&)> const&
+                consume) override;
+        std::string oldest_date(void) override;
+        std::string compacted_before(void) override;
+
+        std::vector<GOALS::Goal> goals(void) override;
+        void set_goal(GOALS::Goal const& goal) override;
+        void remove_goal(int const id) override;
+
+        STATS::Cache::Backing stats_backing(std::string const& shape) override;
+        std::vector<STATS::Scan> parallel_scans(std::size_t const n) override;
+
+        void flush(void) override;
+        bool changed_elsewhere(void) override;
+        bool take_stored(std::vector<STORAGE::Stored>& out) override;
+
+    private:
+        // runs f on the thread and waits for it
+        template <typename F>
+        auto wait(F f) { return thread_->call(std::move(f)).get(); }
+
+        STORAGE::Backend* inner_;
+        Thread*           thread_;
+    };
+}